@@ -7,10 +7,6 @@
 
 #define MQTT_DEFAULT_PORT 1883
 
-// Note: adjust this chip select pin to match your hardware's SD CS pin.
-// Common values are 4 or 10 depending on shield/module.
-static const uint8_t SDCARD_CS_PIN = 4;
-
 // Forward declarations for helper functions used below.
 static bool macStringToMacAddr(const char *macstr, size_t macstrSize);
 static sensorType sensorTypeFromString(const char *s);
@@ -24,62 +20,62 @@ bool readSDConfig(const char *filepath) {
     char cardType[12];
     memset(cardType, '\0', sizeof(cardType));
     if(! card.init(SPI_HALF_SPEED, SDCARD_CS_PIN)) {
-        Serial.println("Sd2Card.init() failed.");
+        Serial.println(F("Sd2Card.init() failed."));
         return false;
     }
     switch (card.type()) {
         case SD_CARD_TYPE_SD1:
-            sprintf(cardType, "SD1");          
+            strcpy_P(cardType, PSTR("SD1"));          
           break;
 
         case SD_CARD_TYPE_SD2:
-            sprintf(cardType, "SD2");
+            strcpy_P(cardType, PSTR("SD2"));
           break;
 
         case SD_CARD_TYPE_SDHC:
-            sprintf(cardType, "SDHC");
+            strcpy_P(cardType, PSTR("SDHC"));
           break;
 
         default:
-          Serial.println("SD Card Type: Unknown");
+          Serial.println(F("SD Card Type: Unknown"));
     }
 
     SdVolume volume;
     if (!volume.init(card)) {
-        Serial.println("Could not find FAT16/FAT32 partition.");
-        Serial.println("Please validte your SD card partition is formatted either FAT16 or FAT32.");
-        Serial.println("Note: exFAT is NOT supported.");
+        Serial.println(F("Could not find FAT16/FAT32 partition."));
+        Serial.println(F("Please validte your SD card partition is formatted either FAT16 or FAT32."));
+        Serial.println(F("Note: exFAT is NOT supported."));
         return false;
     }
 
     for(int i = 0; i < 5; i++) {
         if (!SD.begin(SDCARD_CS_PIN)) {
-            Serial.print("Will retry SD.begin(");
+            Serial.print(F("Will retry SD.begin("));
             Serial.print(SDCARD_CS_PIN);
-            Serial.print(") on ");
+            Serial.print(F(") on "));
             Serial.print(cardType);
-            Serial.print(". Attempt ");
+            Serial.print(F(". Attempt "));
             Serial.print(i + 1);
-            Serial.println(" of 5");
+            Serial.println(F(" of 5"));
             delay(2000);
             continue;
         } else {
             break;
         }
         if(i == 4) {
-            Serial.print("SD.begin(");
+            Serial.print(F("SD.begin("));
             Serial.print(SDCARD_CS_PIN);
-            Serial.println(") failed to initialize.");  
+            Serial.println(F(") failed to initialize."));  
             return false;
         }   
     }
 
     // Validate File exists.
     if(! SD.exists(filepath)) {
-        Serial.print("File: ");
+        Serial.print(F("File: "));
         Serial.print(filepath);
-        Serial.println(" not found on SD Card.");
-        Serial.println(" Files Found on Card .....");
+        Serial.println(F(" not found on SD Card."));
+        Serial.println(F(" Files Found on Card ....."));
         File root = SD.open("/");
         printDirectory(root, 0);
         SD.end();
@@ -92,23 +88,23 @@ bool readSDConfig(const char *filepath) {
     IniFile ini(filepath);
     
     if (!ini.open()) {
-        Serial.print("Cannot Open INI File: ");
+        Serial.print(F("Cannot Open INI File: "));
         Serial.println(filepath);
         SD.end();
         return false;
     }
-    Serial.print("Opened INI File: ");
+    Serial.print(F("Opened INI File: "));
     Serial.print(filepath);
-    Serial.print(" from ");
+    Serial.print(F(" from "));
     Serial.print(cardType);
-    Serial.print(" Card Using SD CS PIN: ");
+    Serial.print(F(" Card Using SD CS PIN: "));
     Serial.print(SDCARD_CS_PIN);    
     Serial.println();
 
     if (!ini.validate(buffer, bufferLen)) {
-        Serial.print("INI file ");
+        Serial.print(F("INI file "));
         Serial.print(filepath);
-        Serial.print(" not a valid format: ");
+        Serial.print(F(" not a valid format: "));
         Serial.println(buffer);
         ini.close();
         SD.end();
@@ -120,16 +116,16 @@ bool readSDConfig(const char *filepath) {
     if (ini.getValue("network", "macaddress", buffer, bufferLen)) {
         size_t maclen = strlen(buffer);
         if (!macStringToMacAddr(buffer, maclen)) {
-            Serial.print("Invalid macaddress in ");
+            Serial.print(F("Invalid macaddress in "));
             Serial.println(filepath);
             ini.close();
             SD.end();
             return false;
         }
-        Serial.print("Read macaddress: ");
+        Serial.print(F("Read macaddress: "));
         Serial.println(buffer);
     } else {
-        Serial.print("Warning: 'macaddress' missing from ");
+        Serial.print(F("Warning: 'macaddress' missing from "));
         Serial.println(filepath);
         ini.close();
         SD.end();
@@ -137,19 +133,18 @@ bool readSDConfig(const char *filepath) {
     }
 
     // Read MQTT address
-    mqtt_address = IPAddress(127, 0, 0, 1);
-    memset(&mqtt_address, 0, sizeof(mqtt_address));
+    mqtt_address = IPAddress(0, 0, 0, 0);
     if (ini.getValue("network", "mqtt_address", buffer, bufferLen)) {
         unsigned int a, b, c, d;
         if (sscanf(buffer, "%u.%u.%u.%u", &a, &b, &c, &d) == 4) {
             mqtt_address = IPAddress((uint8_t)a, (uint8_t)b, (uint8_t)c, (uint8_t)d);
-            Serial.print("Read mqtt_address: ");
+            Serial.print(F("Read mqtt_address: "));
             Serial.println(buffer);
         } else {
-            Serial.println("mqtt_address not a valid IPv4 string; using 0.0.0.0");
+            Serial.println(F("mqtt_address not a valid IPv4 string; using 0.0.0.0"));
         }
     } else {
-        Serial.print("Warning: 'mqtt_address' missing from ");
+        Serial.print(F("Warning: 'mqtt_address' missing from "));
         Serial.println(filepath);
         ini.close();
         SD.end();
@@ -160,12 +155,12 @@ bool readSDConfig(const char *filepath) {
     mqtt_port = MQTT_DEFAULT_PORT;
     if (ini.getValue("network", "mqtt_port", buffer, bufferLen)) {
         mqtt_port = atoi(buffer);
-        Serial.print("Read mqtt_port: ");
+        Serial.print(F("Read mqtt_port: "));
         Serial.println(buffer);
     } else {
-        Serial.print("Warning: 'mqtt_port' missing from ");
+        Serial.print(F("Warning: 'mqtt_port' missing from "));
         Serial.print(filepath);
-        Serial.print(" Assuming default port ");
+        Serial.print(F(" Assuming default port "));
         Serial.println(MQTT_DEFAULT_PORT);
     }
 
@@ -173,10 +168,10 @@ bool readSDConfig(const char *filepath) {
     memset(mqtt_username, '\0', sizeof(mqtt_username));
     if (ini.getValue("network", "mqtt_username", buffer, bufferLen)) {
         strncpy(mqtt_username, buffer, sizeof(mqtt_username) - 1);
-        Serial.print("Read mqtt_username: ");
+        Serial.print(F("Read mqtt_username: "));
         Serial.println(buffer);
     } else {
-        Serial.print("Warning: 'mqtt_username' missing from ");
+        Serial.print(F("Warning: 'mqtt_username' missing from "));
         Serial.println(filepath);
         ini.close();
         SD.end();
@@ -187,10 +182,11 @@ bool readSDConfig(const char *filepath) {
     memset(mqtt_password, '\0', sizeof(mqtt_password));
     if (ini.getValue("network", "mqtt_password", buffer, bufferLen)) {
         strncpy(mqtt_password, buffer, sizeof(mqtt_password) - 1);
-        Serial.print("Read mqtt_password: ");
-        Serial.println(buffer);
+        Serial.print(F("Read mqtt_password: "));
+        Serial.print(strlen(buffer));
+        Serial.println(F(" characters"));
     } else {
-        Serial.print("Warning: 'mqtt_password' missing from ");
+        Serial.print(F("Warning: 'mqtt_password' missing from "));
         Serial.println(filepath);
         ini.close();
         SD.end();
@@ -203,12 +199,13 @@ bool readSDConfig(const char *filepath) {
         allSensors[i].type = unused; 
         allSensors[i].pin1 = -1; 
         allSensors[i].pin2 = -1; 
+        allSensors[i].debounceMs = 0;
     }
 
     int sensorCount = 0;
     for (int i = 0; i < maxSensors; i++) {
         char sectionName[16];
-        snprintf(sectionName, sizeof(sectionName), "sensor%d", i);
+        snprintf_P(sectionName, sizeof(sectionName), PSTR("sensor%d"), i);
         
         // Check if this sensor section exists
         if (!ini.getValue(sectionName, "type", buffer, bufferLen)) {
@@ -233,11 +230,19 @@ bool readSDConfig(const char *filepath) {
             pin2 = atoi(buffer);
         }
         
+        // Read debounce_ms (inputs only; switches are outputs)
+        long debounceMs = DEBOUNCE_DEFAULT_MS;
+        if (ini.getValue(sectionName, "debounce_ms", buffer, bufferLen)) {
+            debounceMs = atol(buffer);
+            if (debounceMs < 0) debounceMs = 0;
+            if (debounceMs > 60000L) debounceMs = 60000L;
+        }
+        
         // Skip sensors that use reserved pins
         if (isPinReserved(pin1) || isPinReserved(pin2)) {
-            Serial.print("Skipping sensor on reserved pin(s): pin1=");
+            Serial.print(F("Skipping sensor on reserved pin(s): pin1="));
             Serial.print(pin1);
-            Serial.print(", pin2=");
+            Serial.print(F(", pin2="));
             Serial.println(pin2);
             continue;
         }
@@ -245,15 +250,18 @@ bool readSDConfig(const char *filepath) {
         allSensors[sensorCount].type = sensorTypeFromString(typeStr);
         allSensors[sensorCount].pin1 = (int8_t)pin1;
         allSensors[sensorCount].pin2 = (int8_t)pin2;
+        allSensors[sensorCount].debounceMs = (uint16_t)debounceMs;
         sensorCount++;
         
         // tell user a one-line summary of "this" sensor just read.
-        Serial.print("Read sensor: type=");
+        Serial.print(F("Read sensor: type="));
         Serial.print(typeStr);
-        Serial.print(", pin1=");
+        Serial.print(F(", pin1="));
         Serial.print(pin1);
-        Serial.print(", pin2=");
-        Serial.println(pin2);
+        Serial.print(F(", pin2="));
+        Serial.print(pin2);
+        Serial.print(F(", debounce_ms="));
+        Serial.println(debounceMs);
     }
     
     ini.close();
@@ -319,20 +327,9 @@ static bool isPinReserved(int pin) {
 }
 
 static sensorType sensorTypeFromString(const char *s) {
-    if (!s) return unused;
     // Use bounded string comparison (max 32 chars for sensor type names)
     const size_t MAX_TYPE_LEN = 32;
-    if (strncmp(s, "door2", MAX_TYPE_LEN) == 0) return door2;
-    if (strncmp(s, "garagedoor2", MAX_TYPE_LEN) == 0) return garagedoor2;
-    if (strncmp(s, "window2", MAX_TYPE_LEN) == 0) return window2;
-    if (strncmp(s, "motion2", MAX_TYPE_LEN) == 0) return motion2;
-    if (strncmp(s, "motion2_laser", MAX_TYPE_LEN) == 0) return motion2_laser;
-    if (strncmp(s, "switch1", MAX_TYPE_LEN) == 0) return switch1;
-    if (strncmp(s, "switch1_radiator", MAX_TYPE_LEN) == 0) return switch1_radiator;
-    if (strncmp(s, "switch1_fan", MAX_TYPE_LEN) == 0) return switch1_fan;
-    if (strncmp(s, "switch1_fire", MAX_TYPE_LEN) == 0) return switch1_fire;
-    if (strncmp(s, "switch1_alarmlight", MAX_TYPE_LEN) == 0) return switch1_alarmlight;
-    return unused;
+    return sensorTypeFromName(s, MAX_TYPE_LEN); // Names are in sensorTraits.cpp.
 }
 
 
@@ -352,11 +349,11 @@ static void printDirectory(File dir, int numTabs) {
         Serial.print(entry.name());
 
         if (entry.isDirectory()) {
-            Serial.println("/");
+            Serial.println(F("/"));
             printDirectory(entry, numTabs + 1);
         } else {
             // files have sizes, directories do not
-            Serial.print("\t\t");
+            Serial.print(F("\t\t"));
             Serial.println(entry.size(), DEC);
         }
 
@@ -4,10 +4,7 @@
 #include "guarduino.h"
 
 
-static size_t mqttSensorDiscovery(baseSensor_t thisSensor, uint64_t pinReadings, size_t paramSize);
-static sensorStates getSensorStateEnum(baseSensor_t sensor, uint64_t pinReadings);
-static const char *getSensorStateName(baseSensor_t sensor, uint64_t pinReadings);
-static const char *getSensorStateIcon(baseSensor_t sensor, uint64_t pinReadings);
+static size_t mqttSensorDiscovery(baseSensor_t thisSensor, const pinBitset_t *pinReadings);
 
 
 
@@ -15,53 +12,289 @@ static const char *getSensorStateIcon(baseSensor_t sensor, uint64_t pinReadings)
 
 
 /**
- * Step through each of "allSensors" and send "discovery/data" pairs to MQTT, based on readings found
- * in "pinReadings". Ignores any sensors of status 'offline'.
+ * Queue "discovery/data" for sensors[sensor] (see mqttQueue.cpp), based on readings found in "pinReadings".
+ * A sensor which is 'offline' (no power) only has its state queued: HA must see it go, as cutting a sensor's
+ * power is how it would be defeated, but it's not discovered like that.
  */
-void sendSensorsMQTT(uint64_t pinReadings, baseSensor_t *allSensors, size_t allSensorsSize) {
-  for(int i = 0; i < (allSensorsSize / sizeof(baseSensor_t)); i++) {
-    baseSensor_t thisSensor = allSensors[i];
+static void queueSensorMQTT(baseSensor_t *sensors, uint8_t sensor, const pinBitset_t *pinReadings) {
+  baseSensor_t thisSensor = sensors[sensor];
+
+  if(thisSensor.type == reserved) return;
+  if(sensorStateOffline(thisSensor, pinReadings)) {
+#if ! AGGREGATE_STATE
+    mqttQueuePut(queuedSensorState, sensor); // With AGGREGATE_STATE, its absence from the document is "offline".
+#endif
+    return;
+  }
+  if(! sensorStateReportable(thisSensor, pinReadings)) return; // unknown.
 
-    switch(thisSensor.type) {      
-      case reserved:
-        continue;
-        break;
-
-      case door2:
-      case garagedoor2:
-      case window2:
-      case motion2:
-      case motion2_laser:
-      case switch1:
-      case switch1_radiator:
-      case switch1_fan:
-      case switch1_fire:
-      case switch1_alarmlight:
-
-        sensorStates thisState = getSensorStateEnum(thisSensor, pinReadings);
-        if(thisState == unknown) continue;
-        if(thisState == door2_offline) continue;
-        if(thisState == garagedoor2_offline) continue;
-        if(thisState == window2_offline) continue;
-        if(thisState == motion2_offline) continue;
-
-        // Send "Discovery" first. This births the entity on the HA device. This also 'sets' the icon according to pinReadings.   
-        mqttSensorDiscovery(thisSensor, pinReadings, 0);
-
-        // Send "the Reading" for this sensor.    
-        char *sensorStateTopic = getSensorStateTopic(thisSensor);
-        if(sensorStateTopic) {
-          char thisName[48];
-          getSensorName(thisName, sizeof(thisName), thisSensor);
-          const char *reading = getSensorStateName(thisSensor, pinReadings);    
-          pubsubClient.publish(sensorStateTopic, reading, false);
-          free(sensorStateTopic);
-          sensorStateTopic = NULL;
-        }   
-        break;
-    } // thisSensor.type
-
-  } // thisSensor
+#if DISCOVERY_ONCE
+  // Discovery is retained, so the first time we see this sensor each MQTT session is enough.
+  if(! thisSensor.discovered) mqttQueuePut(queuedSensorDiscovery, sensor);
+#endif
+
+#if AGGREGATE_STATE
+  // The reading goes out with every other sensor's; the caller queues the device state.
+  return;
+#endif
+
+  mqttQueuePut(queuedSensorState, sensor);
+}
+
+
+/**
+ * mqttQueue's sender for allSensors[sensor]'s state (DISCOVERY_ONCE 0: discovery, then state).
+ * A sensor whose reading has become unknown since it was queued has nothing to send; one with no power sends "offline".
+ */
+bool publishSensorState(uint8_t sensor, const pinBitset_t *pinReadings) {
+  baseSensor_t thisSensor = allSensors[sensor];
+
+  if(thisSensor.type == reserved) return true;
+  if(! sensorStateReportable(thisSensor, pinReadings) && ! sensorStateOffline(thisSensor, pinReadings)) return true;
+
+#if ! DISCOVERY_ONCE
+  // Send "Discovery" first. This births the entity on the HA device. This also 'sets' the icon according to pinReadings.   
+  mqttSensorDiscovery(thisSensor, pinReadings);
+#endif
+
+  // Send "the Reading" for this sensor.    
+  const char *sensorStateTopic = getSensorStateTopic(thisSensor);
+  if(! sensorStateTopic) return true;
+  PGM_P reading = getSensorStateName(thisSensor, pinReadings);    
+#if DISCOVERY_ONCE
+  // e.g. {"state":"open","icon":"mdi:door-open"}. Discovery's value_template picks out "state".
+  char statePayload[64];
+  strlcpy_P(statePayload, PSTR("{\"state\":\""), sizeof(statePayload));
+  strlcat_P(statePayload, reading, sizeof(statePayload));
+  strlcat_P(statePayload, PSTR("\",\"icon\":\""), sizeof(statePayload));
+  strlcat_P(statePayload, getSensorStateIcon(thisSensor, pinReadings), sizeof(statePayload));
+  strlcat_P(statePayload, PSTR("\"}"), sizeof(statePayload));
+  if(! pubsubClient.publish(sensorStateTopic, statePayload, false)) return false;
+#else
+  if(! pubsubClient.publish_P(sensorStateTopic, reading, false)) return false;
+#endif
+  latencyPublished(sensor);
+  return true;
+}
+
+
+/**
+ * mqttQueue's sender for allSensors[sensor]'s (retained) discovery. DISCOVERY_ONCE only.
+ */
+bool publishSensorDiscovery(uint8_t sensor, const pinBitset_t *pinReadings) {
+  baseSensor_t *thisSensor = &allSensors[sensor];
+
+  if(thisSensor->discovered) return true;
+  if(thisSensor->type == reserved) return true;
+  if(! sensorStateReportable(*thisSensor, pinReadings)) return true;
+  if(! mqttSensorDiscovery(*thisSensor, pinReadings)) return false;
+  thisSensor->discovered = true;
+
+  // Security states go out ahead of discovery; one sent before HA had the entity went nowhere, so send it again.
+#if AGGREGATE_STATE
+  mqttQueuePut(queuedDeviceState, 0);
+#else
+  mqttQueuePut(queuedSensorState, sensor);
+#endif
+  return true;
+}
+
+
+/**
+ * Step through each of "allSensors" and queue "discovery/data" pairs for MQTT, based on readings found
+ * in "pinReadings". Sensors with no power ('offline') only have their state queued.
+ * This is the full sweep. When pins change, sendChangedSensorsMQTT() only queues the sensors on them;
+ * otherwise sendHeartbeatsMQTT() queues each class of sensor on its own period.
+ */
+void sendSensorsMQTT(const pinBitset_t *pinReadings, baseSensor_t *allSensors, size_t allSensorsSize) {
+  for(size_t i = 0; i < (allSensorsSize / sizeof(baseSensor_t)); i++) {
+    queueSensorMQTT(allSensors, i, pinReadings);
+  }
+#if AGGREGATE_STATE
+  mqttQueuePut(queuedDeviceState, 0);
+#endif
+}
+
+
+static unsigned long heartbeatSentAt[heartbeatClassCount];
+static uint8_t heartbeatForced = 0xFF; // Bit per heartbeatClass: sweep it next time, due or not.
+
+
+/**
+ * Sweep every class on the next sendHeartbeatsMQTT(), e.g. once we've (re)connected, or HA has restarted
+ * and lost our (non-retained) states.
+ */
+void resetSensorHeartbeats(void) {
+  heartbeatForced = 0xFF;
+}
+
+
+/**
+ * Re-send the sensors whose class's heartbeat (HEARTBEAT_CONTACT, ...) is due. Call as often as you like;
+ * between periods it does nothing.
+ */
+void sendHeartbeatsMQTT(const pinBitset_t *pinReadings, baseSensor_t *allSensors, size_t allSensorsSize) {
+  unsigned long now = millis();
+  uint8_t due = heartbeatForced;
+  for(uint8_t heartbeat = 1; heartbeat < heartbeatClassCount; heartbeat++) {
+    if((now - heartbeatSentAt[heartbeat]) >= heartbeatPeriod((heartbeatClass) heartbeat)) due |= (1 << heartbeat);
+  }
+  due &= ~(1 << heartbeat_none);
+  heartbeatForced = 0;
+  if(! due) return;
+
+  for(uint8_t heartbeat = 1; heartbeat < heartbeatClassCount; heartbeat++) {
+    if(due & (1 << heartbeat)) heartbeatSentAt[heartbeat] = now;
+  }
+
+  for(size_t i = 0; i < (allSensorsSize / sizeof(baseSensor_t)); i++) {
+    if(due & (1 << sensorHeartbeatClass(allSensors[i].type))) queueSensorMQTT(allSensors, i, pinReadings);
+  }
+#if AGGREGATE_STATE
+  // One document has everyone in it, so whichever class is due, it's the lot.
+  mqttQueuePut(queuedDeviceState, 0);
+#endif
+}
+
+
+#if AGGREGATE_STATE
+/**
+ * Sends (or if "out" is NULL, just counts) one piece of the device state document.
+ */
+static size_t deviceStatePut(Print *out, const char *text, bool inFlash) {
+  if(! out) return inFlash ? strlen_P(text) : strlen(text);
+  if(inFlash) return out->print((const __FlashStringHelper *) text);
+  return out->print(text);
+}
+
+
+/**
+ * Every sensor's state in one message on getDeviceStateTopic(), e.g.
+ * {"door_2223_CC1578":["open","mdi:door-open"],"switch_07_CC1578":["OFF","mdi:radiator-off"]}
+ * Sensors which are offline (or unknown) are left out. Each entity's discovery value_template picks out its own.
+ * Counted first, then streamed, so there is no buffer to outgrow however many sensors there are.
+ * mqttQueue's sender for queuedDeviceState.
+ */
+bool publishDeviceState(const pinBitset_t *pinReadings, baseSensor_t *sensors, size_t sensorsSize) {
+  size_t payloadsize = 0;
+  for(int pass = 0; pass < 2; pass++) {
+    Print *out = NULL;
+    if(pass == 1) {
+      if(! pubsubClient.beginPublish(getDeviceStateTopic(), payloadsize, false)) return false;
+      out = &pubsubClient;
+    }
+
+    size_t len = deviceStatePut(out, PSTR("{"), true);
+    bool first = true;
+    for(size_t i = 0; i < (sensorsSize / sizeof(baseSensor_t)); i++) {
+      baseSensor_t thisSensor = sensors[i];
+      if(thisSensor.type == reserved) continue;
+      if(! sensorStateReportable(thisSensor, pinReadings)) continue;
+
+      len += deviceStatePut(out, first ? PSTR("\"") : PSTR(",\""), true);
+      len += deviceStatePut(out, getSensorName(thisSensor), false);
+      len += deviceStatePut(out, PSTR("\":[\""), true);
+      len += deviceStatePut(out, getSensorStateName(thisSensor, pinReadings), true);
+      len += deviceStatePut(out, PSTR("\",\""), true);
+      len += deviceStatePut(out, getSensorStateIcon(thisSensor, pinReadings), true);
+      len += deviceStatePut(out, PSTR("\"]"), true);
+      first = false;
+    }
+    len += deviceStatePut(out, PSTR("}"), true);
+
+    if(pass == 0) payloadsize = len;
+  }
+  if(! pubsubClient.endPublish()) return false;
+  latencyPublishedAll();
+  return true;
+}
+#endif
+
+
+/**
+ * Pin to sensor index, built by setupSensorIndex().
+ * pinSensorHead[] has one slot per pin, by port then bit (the same order as a pinBitset_t), holding the first
+ * of that pin's entries in pinSensorEntries[]. Entries chain on to the next sensor using the same pin, if any.
+ */
+#define SENSOR_INDEX_NONE 0xFF
+#define SENSOR_INDEX_MAX_ENTRIES 128 // Two pins for each of allSensors[64].
+
+typedef struct pinSensorEntry_t
+{
+    uint8_t sensor; // Index into allSensors[].
+    uint8_t next;   // Next entry for the same pin, or SENSOR_INDEX_NONE.
+} pinSensorEntry_t;
+
+static uint8_t pinSensorHead[PINBITSET_PORTS * 8];
+static pinSensorEntry_t pinSensorEntries[SENSOR_INDEX_MAX_ENTRIES];
+static uint8_t pinSensorEntryCount = 0;
+
+
+static void sensorIndexAddPin(int8_t pin, uint8_t sensor) {
+  if((pin < 0) || (pin >= NUM_DIGITAL_PINS)) return;
+  uint8_t port = digitalPinToPort(pin);
+  if((port == NOT_A_PORT) || (port > PINBITSET_PORTS)) return;
+  if(pinSensorEntryCount >= SENSOR_INDEX_MAX_ENTRIES) return;
+
+  uint8_t slot = ((port - 1) * 8) + (uint8_t) __builtin_ctz(digitalPinToBitMask(pin));
+  pinSensorEntry_t *entry = &pinSensorEntries[pinSensorEntryCount];
+  entry->sensor = sensor;
+  entry->next = pinSensorHead[slot];
+  pinSensorHead[slot] = pinSensorEntryCount++;
+}
+
+
+/**
+ * Build the pin to sensor index from "sensors". Call from setupSensors().
+ */
+void setupSensorIndex(baseSensor_t *sensors, size_t sensorsSize) {
+  memset(pinSensorHead, SENSOR_INDEX_NONE, sizeof(pinSensorHead));
+  pinSensorEntryCount = 0;
+
+  for(size_t i = 0; i < (sensorsSize / sizeof(baseSensor_t)); i++) {
+    baseSensor_t *thisSensor = &sensors[i];
+    uint8_t pinCount = sensorPinCount(thisSensor->type);
+    if(pinCount >= 1) sensorIndexAddPin(thisSensor->pin1, i);
+    if((pinCount >= 2) && (thisSensor->pin2 != thisSensor->pin1)) sensorIndexAddPin(thisSensor->pin2, i);
+  }
+}
+
+
+/**
+ * Queue "discovery/data" for only those of "allSensors" with a pin which differs between "oldReadings" and "newReadings".
+ * The changed pins are found a port (byte) at a time, then looked up in the pin to sensor index.
+ * With JOURNAL_ENABLE, each of those sensors' transitions is also appended to the SD card journal.
+ * "changedAt" is micros() when the change was captured, for the edge-to-publish latency (latency.cpp).
+ */
+void sendChangedSensorsMQTT(const pinBitset_t *oldReadings, const pinBitset_t *newReadings, baseSensor_t *allSensors, size_t allSensorsSize, unsigned long changedAt) {
+  int sensorCount = allSensorsSize / sizeof(baseSensor_t);
+  uint8_t sent[(SENSOR_INDEX_MAX_ENTRIES / 2) / 8]; // One bit per sensor, so a sensor with both pins changed goes once.
+  memset(sent, '\0', sizeof(sent));
+
+  for(uint8_t port = 0; port < PINBITSET_PORTS; port++) {
+    uint8_t changed = oldReadings->ports[port] ^ newReadings->ports[port];
+    while(changed) {
+      uint8_t bit = (uint8_t) __builtin_ctz(changed);
+      changed &= changed - 1;
+
+      for(uint8_t e = pinSensorHead[(port * 8) + bit]; e != SENSOR_INDEX_NONE; e = pinSensorEntries[e].next) {
+        uint8_t sensor = pinSensorEntries[e].sensor;
+        if(sensor >= sensorCount) continue;
+        if(sent[sensor / 8] & (1 << (sensor % 8))) continue;
+        sent[sensor / 8] |= (1 << (sensor % 8));
+#if JOURNAL_ENABLE
+        journalSensor(sensor, newReadings);
+#endif
+        if(sensorStateReportable(allSensors[sensor], newReadings) || sensorStateOffline(allSensors[sensor], newReadings)) {
+          latencyChanged(sensor, changedAt);
+        }
+        queueSensorMQTT(allSensors, sensor, newReadings);
+      }
+    }
+  }
+#if AGGREGATE_STATE
+  mqttQueuePut(queuedDeviceState, 0);
+#endif
 }
 
 
@@ -74,70 +307,161 @@ void sendSensorsMQTT(uint64_t pinReadings, baseSensor_t *allSensors, size_t allS
   // https://www.home-assistant.io/integrations/sensor.mqtt/
   // https://community.home-assistant.io/t/mqtt-auto-discovery-and-json-payload/409459
 */
-void mqttSensorSendDiscovery(uint64_t pinReadings) {
-  Serial.println("mqttSensorSendDiscovery()");
-  char sensorName[32];
+void mqttSensorSendDiscovery(const pinBitset_t *pinReadings) {
+  LOG(LOG_DEBUG).println(F("mqttSensorSendDiscovery()"));
   
   
   for(int i = 0; i < allSensorCount(); i++) {
     baseSensor_t *thisSensor = &allSensors[i];    
-    mqttSensorDiscovery(*thisSensor, pinReadings, 0);
+    mqttSensorDiscovery(*thisSensor, pinReadings);
+  }
+}
+
+
+/**
+ * Forget which sensors have had discovery sent. Call on each new MQTT session.
+ */
+void resetSensorDiscovery(baseSensor_t *sensors, size_t sensorsSize) {
+  for(size_t i = 0; i < (sensorsSize / sizeof(baseSensor_t)); i++) {
+    sensors[i].discovered = false;
   }
 }
 
 
+/**
+ * Every name and topic we publish with is built once, by setupSensorStrings(), right after CONFIG.INI is read.
+ * Device strings live in fixed buffers below. Each sensor's name and state topic live in one arena, allocated once
+ * and sized to fit exactly, pointed to by that sensor's baseSensor_t::name and ::stateTopic.
+ * Nothing on the publish path allocates.
+ */
+static char deviceName[24];
+static char deviceCommandTopic[48];
+static char deviceStateTopic[48];
+static char deviceAvailabilityTopic[56];
+static char deviceJournalTopic[56];
+static char deviceDiagnosticsTopic[56];
+static char deviceMacString[18];
+static char deviceIPString[16];
+static IPAddress deviceIP;
+static char *sensorStringArena = NULL;
+
+
 /**
   * Arduino_MACADDR
   * Board make + last 3 bytes of mac address.
   */
-void getDeviceName(char *destbuf, size_t destbufsize) {
-  memset(destbuf, '\0', destbufsize);
-  byte macBytes[6];
-  Ethernet.MACAddress(macBytes); // https://www.arduino.cc/reference/en/libraries/ethernet/ethernet.macaddress/  
-  snprintf(destbuf, destbufsize, "%s_%02X%02X%02X", BoardIdentify::make, macBytes[3], macBytes[4], macBytes[5]);
-  
+const char *getDeviceName(void) {
+  return deviceName;
+}
+
+
+/**
+ * This sensor's name, e.g. door_2223_CC1578. Empty for unused/reserved sensors.
+ */
+const char *getSensorName(baseSensor_t thisSensor) {
+  if(! thisSensor.name) return "";
+  return thisSensor.name;
 }
 
 
-void getSensorName(char *destbuf, size_t destbufsize, baseSensor_t thisSensor) {
-  if(destbufsize < strlen("someplaceholder_NNNN_NNNNNN")) {
-    Serial.println("Developer bug getSensorName(). Please use a longer destbuf. Suggest >= 48 bytes.");
+/*
+ * Builds the name getSensorName() will return for this sensor. Only setupSensorStrings() should need this.
+ */
+static void buildSensorName(char *destbuf, size_t destbufsize, baseSensor_t thisSensor) {
+  memset(destbuf, '\0', destbufsize);
+  PGM_P prefix = sensorNamePrefix(thisSensor.type);
+  if(! prefix) {
+    snprintf_P(destbuf, destbufsize, PSTR("%s_%02X%02X%02X"), BoardIdentify::make, mac[3], mac[4], mac[5]);
     return;
   }
-  
-  byte macBytes[6];
-  Ethernet.MACAddress(macBytes); // https://www.arduino.cc/reference/en/libraries/ethernet/ethernet.macaddress/  
+
+  // e.g. door_2223_CC1578, switch_22_CC1578
+  strlcpy_P(destbuf, prefix, destbufsize);
+  size_t len = strlen(destbuf);
+  if(sensorPinCount(thisSensor.type) == 2) {
+    snprintf_P(destbuf + len, destbufsize - len, PSTR("_%02d%02d_%02X%02X%02X"), thisSensor.pin1, thisSensor.pin2, mac[3], mac[4], mac[5]);
+  } else {
+    snprintf_P(destbuf + len, destbufsize - len, PSTR("_%02d_%02X%02X%02X"), thisSensor.pin1, mac[3], mac[4], mac[5]);
+  }
+}
+
+
+/**
+ *
+ * Examples:
+ * aha/sensor/deviceNameHere/door_0809/state
+ * aha/sensor/sensorBedroom/state
+ * aha/switch/switch_NN/state/sw
+ */
+static void buildSensorStateTopic(char *destbuf, size_t destbufsize, const char *sensorName, baseSensor_t thisSensor) {
   memset(destbuf, '\0', destbufsize);
-  snprintf(destbuf, destbufsize, "%s_%02X%02X%02X", BoardIdentify::make, macBytes[3], macBytes[4], macBytes[5]);
- 
-  switch(thisSensor.type) {
-    case door2:
-      snprintf(destbuf, destbufsize, "door_%02d%02d_%02X%02X%02X", thisSensor.pin1, thisSensor.pin2, macBytes[3], macBytes[4], macBytes[5]);
-      break;
-    case garagedoor2:
-      snprintf(destbuf, destbufsize, "garagedoor_%02d%02d_%02X%02X%02X", thisSensor.pin1, thisSensor.pin2, macBytes[3], macBytes[4], macBytes[5]);
-      break;    
-    case window2:
-      snprintf(destbuf, destbufsize, "window_%02d%02d_%02X%02X%02X", thisSensor.pin1, thisSensor.pin2, macBytes[3], macBytes[4], macBytes[5]);
-      break;
-    case motion2:
-      snprintf(destbuf, destbufsize, "motion_%02d%02d_%02X%02X%02X", thisSensor.pin1, thisSensor.pin2, macBytes[3], macBytes[4], macBytes[5]);
-      break;
-    case motion2_laser:
-      snprintf(destbuf, destbufsize, "laser_%02d%02d_%02X%02X%02X", thisSensor.pin1, thisSensor.pin2, macBytes[3], macBytes[4], macBytes[5]);
-      break;
-
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      snprintf(destbuf, destbufsize, "switch_%02d_%02X%02X%02X", thisSensor.pin1, macBytes[3], macBytes[4], macBytes[5]);
-      break;
-    default:
-      break;
-  }  
+  if(sensorIsSwitch(thisSensor.type)) {
+    snprintf_P(destbuf, destbufsize - 1, PSTR(HA_TOPIC_DATA "/switch/%s/%s/state"), deviceName, sensorName);
+  } else {
+    snprintf_P(destbuf, destbufsize - 1, PSTR(HA_TOPIC_DATA "/sensor/%s/%s/state"), deviceName, sensorName);
+  }
+}
 
+
+/**
+ * Build the device's strings, and every configured sensor's name and state topic, from "mac" and "sensors".
+ * Call once, after readSDConfig().
+ */
+void setupSensorStrings(baseSensor_t *sensors, size_t sensorsSize) {
+  int sensorCount = sensorsSize / sizeof(baseSensor_t);
+
+  snprintf_P(deviceName, sizeof(deviceName), PSTR("%s_%02X%02X%02X"), BoardIdentify::make, mac[3], mac[4], mac[5]);
+  snprintf_P(deviceCommandTopic, sizeof(deviceCommandTopic), PSTR(HA_TOPIC_DATA "/switch/%s/cmd"), deviceName);
+  snprintf_P(deviceStateTopic, sizeof(deviceStateTopic), PSTR(HA_TOPIC_DATA "/sensor/%s/state"), deviceName);
+  snprintf_P(deviceAvailabilityTopic, sizeof(deviceAvailabilityTopic), PSTR(HA_TOPIC_DATA "/sensor/%s/availability"), deviceName);
+  snprintf_P(deviceJournalTopic, sizeof(deviceJournalTopic), PSTR(HA_TOPIC_DATA "/sensor/%s/journal"), deviceName);
+  snprintf_P(deviceDiagnosticsTopic, sizeof(deviceDiagnosticsTopic), PSTR(HA_TOPIC_DATA "/sensor/%s/diagnostics"), deviceName);
+  snprintf_P(deviceMacString, sizeof(deviceMacString), PSTR("%02X:%02X:%02X:%02X:%02X:%02X"), mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+  if(sensorStringArena) {
+    free(sensorStringArena);
+    sensorStringArena = NULL;
+  }
+
+  // First pass adds up how much room we need, second pass fills the arena.
+  size_t arenaSize = 0;
+  for(int pass = 0; pass < 2; pass++) {
+    char *cursor = sensorStringArena;
+
+    for(int i = 0; i < sensorCount; i++) {
+      baseSensor_t *thisSensor = &sensors[i];
+      thisSensor->name = NULL;
+      thisSensor->stateTopic = NULL;
+      if(thisSensor->type == unused) continue;
+
+      char sensorName[48];
+      char stateTopic[96];
+      buildSensorName(sensorName, sizeof(sensorName), *thisSensor);
+      buildSensorStateTopic(stateTopic, sizeof(stateTopic), sensorName, *thisSensor);
+
+      if(pass == 0) {
+        arenaSize += strlen(sensorName) + 1;
+        arenaSize += strlen(stateTopic) + 1;
+        continue;
+      }
+      if(! cursor) continue;
+      strcpy(cursor, sensorName);
+      thisSensor->name = cursor;
+      cursor += strlen(sensorName) + 1;
+      strcpy(cursor, stateTopic);
+      thisSensor->stateTopic = cursor;
+      cursor += strlen(stateTopic) + 1;
+    }
+
+    if(pass == 0) {
+      sensorStringArena = (char *) malloc(arenaSize);
+      if(! sensorStringArena) Serial.println(F("setupSensorStrings(): out of memory."));
+    }
+  }
+
+  Serial.print(F("Sensor strings: "));
+  Serial.print(arenaSize);
+  Serial.println(F(" bytes."));
 }
 
 
@@ -150,52 +474,24 @@ void getSensorName(char *destbuf, size_t destbufsize, baseSensor_t thisSensor) {
  * homeassistant/binary_sensor/garden/config
  *
  */
-static char *getSensorDiscoveryTopic(baseSensor_t thisSensor) {   
-  char sensorName[48];
-  getSensorName(sensorName, sizeof(sensorName), thisSensor);
-
-  size_t topicsize = 0;
-  topicsize += strlen(HA_TOPIC_DISCOVERY);
-  topicsize += strlen("/need_need_enough_space_here_for_sensor_name/");
-  topicsize += strlen(sensorName);
-  topicsize += strlen("/config");
-  topicsize += 1;  
-  char *topic = (char *) calloc(topicsize, sizeof(char));
-  memset(topic, '\0', topicsize);
-
-
-  switch(thisSensor.type) {
-    case reserved:
-      break;
-      
-    case door2:
-    case garagedoor2:
-    case window2:
-    case motion2:
-    case motion2_laser:
-      snprintf(topic, topicsize, "%s/sensor/%s/config", HA_TOPIC_DISCOVERY, sensorName);
-      break;
-
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      snprintf(topic, topicsize, "%s/switch/%s/config", HA_TOPIC_DISCOVERY, sensorName);
-      break;
-
-    default:
-      snprintf(topic, topicsize, "%s/notsupported/%s/config", HA_TOPIC_DISCOVERY, sensorName);
-      break;
+static void getSensorDiscoveryTopic(char *destbuf, size_t destbufsize, baseSensor_t thisSensor) {   
+  memset(destbuf, '\0', destbufsize);
 
+  if(thisSensor.type == reserved) return;
+  PGM_P component = sensorComponent(thisSensor.type);
+  if(! component) {
+    strlcpy_P(destbuf, PSTR(HA_TOPIC_DISCOVERY "/notsupported/"), destbufsize);
+  } else {
+    strlcpy_P(destbuf, PSTR(HA_TOPIC_DISCOVERY "/"), destbufsize);
+    strlcat_P(destbuf, component, destbufsize);
+    strlcat_P(destbuf, PSTR("/"), destbufsize);
   }
-
-  return topic;  
+  strlcat(destbuf, getSensorName(thisSensor), destbufsize);
+  strlcat_P(destbuf, PSTR("/config"), destbufsize);
 }
 
 
 
-
 /**
  *
  * Examples:
@@ -203,69 +499,57 @@ static char *getSensorDiscoveryTopic(baseSensor_t thisSensor) {
  * aha/sensor/sensorBedroom/state
  * aha/switch/switch_NN/state/sw
  */
+const char *getSensorStateTopic(baseSensor_t thisSensor) {
+  return thisSensor.stateTopic;
+}
 
-char *getSensorStateTopic(baseSensor_t thisSensor) {
-
-  char deviceName[32];
-  getDeviceName(deviceName, sizeof(deviceName));
-
-  char sensorName[48];
-  getSensorName(sensorName, sizeof(sensorName), thisSensor);
-
-
-  size_t topicsize = 0;
-  topicsize += strlen(HA_TOPIC_DATA);
-  topicsize += strlen("/sensororswitch/");
-  topicsize += strlen(deviceName);
-  topicsize += strlen("/");
-  topicsize += strlen(sensorName);
-  topicsize += strlen("/state");
-  topicsize += 4; // Safety margin.
-
-  char *topic = (char *) calloc(topicsize, sizeof(char));
-  if(topic) {
-    memset(topic, '\0', topicsize);
-    switch(thisSensor.type) {
-      case switch1:
-      case switch1_radiator:
-      case switch1_fan:
-      case switch1_fire:
-      case switch1_alarmlight:
-        snprintf(topic, topicsize - 1, "%s/switch/%s/%s/state", HA_TOPIC_DATA, deviceName, sensorName);
-        break;
-      default:
-        snprintf(topic, topicsize - 1, "%s/sensor/%s/%s/state", HA_TOPIC_DATA, deviceName, sensorName);
-        break;
-      
-    }
-  }
 
-  return topic;
+/**
+ * AGGREGATE_STATE: every sensor's state, in one JSON document.
+ * aha/sensor/deviceNameHere/state
+ */
+const char *getDeviceStateTopic(void) {
+  return deviceStateTopic;
 }
 
 
 /**
- * Used for switches. 
- * This is the topic which HA will publish to, and our switch should listen to, for "on/off" commands.
- * https://www.home-assistant.io/integrations/switch.mqtt#command_topic
- *
+ * "online" (retained) while we're connected; the broker publishes our last will, "offline", when we're not.
+ * Every entity we discover references it.
+ * aha/sensor/deviceNameHere/availability
+ * https://www.home-assistant.io/integrations/sensor.mqtt/#availability_topic
  */
-char *getDeviceCommandTopic(void) {
+const char *getDeviceAvailabilityTopic(void) {
+  return deviceAvailabilityTopic;
+}
 
-  char deviceName[24];
-  getDeviceName(deviceName, sizeof(deviceName));
 
-  size_t topicsize = 0;
-  topicsize += strlen(HA_TOPIC_DATA);
-  topicsize += strlen("/switch/");
-  topicsize += strlen(deviceName);
-  topicsize += strlen("/cmd");
-  topicsize += 4; // Safety margin.
+/**
+ * Sensor transitions we missed sending while offline, replayed from the SD card journal (JOURNAL_ENABLE).
+ * aha/sensor/deviceNameHere/journal
+ */
+const char *getDeviceJournalTopic(void) {
+  return deviceJournalTopic;
+}
 
-  char *topic = (char *) calloc(topicsize, sizeof(char));
-  snprintf(topic, topicsize - 1, "%s/switch/%s/cmd", HA_TOPIC_DATA, deviceName);
 
-  return topic;
+/**
+ * How the board itself is doing, one JSON document for every diagnostic entity. See diagnostics.cpp.
+ * aha/sensor/deviceNameHere/diagnostics
+ */
+const char *getDeviceDiagnosticsTopic(void) {
+  return deviceDiagnosticsTopic;
+}
+
+
+/**
+ * Used for switches. 
+ * This is the topic which HA will publish to, and our switch should listen to, for "on/off" commands.
+ * https://www.home-assistant.io/integrations/switch.mqtt#command_topic
+ *
+ */
+const char *getDeviceCommandTopic(void) {
+  return deviceCommandTopic;
 }
 
 
@@ -274,10 +558,7 @@ char *getDeviceCommandTopic(void) {
 /*
  * Sends an HA specific MQTT "Discovery" packet for the given sensor. This is used by HA to "auto-learn" about this particular sensor.
  * 
- * This function calls itself recursively!
- * The first call (what you should do), paramSize=0, thus meaning "just calculate how many bytes you'll send."
- * The second call, "paramSize" is the number of bytes calculated above, in which case, we'll pubsubClient.write() as we go.
- * This recursive nature is done to optimize for minimal memory usage.
+ * The document is laid out once as a list of pieces (see jsonWriter.cpp), then sized and sent in one pass.
  * https://www.home-assistant.io/integrations/mqtt/#mqtt-discovery
  * https://www.home-assistant.io/integrations/sensor.mqtt/
  * https://community.home-assistant.io/t/mqtt-auto-discovery-and-json-payload/409459
@@ -285,280 +566,140 @@ char *getDeviceCommandTopic(void) {
  * Example Payload sent:
  * {"device_class": "temperature", "name": "Temperature", "state_topic": "homeassistant/sensor/sensorBedroom/state", "unit_of_measurement": "°C", "value_template": "{{ value_json.temperature}}","unique_id": "temp01ae", "device": {"identifiers": ["bedroom01ae"], "name": "Bedroom" }}
  */
-static size_t mqttSensorDiscovery(baseSensor_t thisSensor, uint64_t pinReadings, size_t paramSize = 0) {
-  char buffer[64];
-  size_t payloadsize = 0;
-  const bool shouldSend = (paramSize > 0);
-
+static size_t mqttSensorDiscovery(baseSensor_t thisSensor, const pinBitset_t *pinReadings) {
+  CYCLE_MARK(CYCLE_DISCOVERY);
+  char sensorDiscoveryTopic[96];
+  char plainName[64];
+  jsonWriter_t writer;
 
   // Do NOT send discovery (at all) if there is "no power" on this particular sensor.
+  if(! sensorStateReportable(thisSensor, pinReadings)) return 0;
   sensorStates thisState = getSensorStateEnum(thisSensor, pinReadings);
-  if(thisState == unknown) return 0;
-  if(thisState == door2_offline) return 0;
-  if(thisState == garagedoor2_offline) return 0;
-  if(thisState == window2_offline) return 0;
-  if(thisState == motion2_offline) return 0;
-
 
-  Serial.println("");
-  Serial.print("mqttSensorDiscovery paramSize=");
-  Serial.print(paramSize);
-  Serial.print(" thisState=");
-  Serial.print(thisState);
-  Serial.print("  ");
+  getSensorDiscoveryTopic(sensorDiscoveryTopic, sizeof(sensorDiscoveryTopic), thisSensor);
+  if(strlen(sensorDiscoveryTopic) == 0) return 0;
 
-  
-  if(paramSize > 0) { 
-    // Tell MQTT how many bytes are about to come for this discovery topic.
-    char *sensorDiscoveryTopic = getSensorDiscoveryTopic(thisSensor);
-    if(! sensorDiscoveryTopic) return 0;
-    pubsubClient.beginPublish(sensorDiscoveryTopic, paramSize, false); //Must send pre-computed "paramsize"here.
-    free(sensorDiscoveryTopic);
-    sensorDiscoveryTopic = NULL;
-  }
-  
-  char deviceName[24];
-  getDeviceName(deviceName, sizeof(deviceName));
-
-  char sensorName[48];
-  getSensorName(sensorName, sizeof(sensorName), thisSensor);
-
-
-  // Opening parenthesis
-  payloadsize += mqttsend(shouldSend, "{");
-  
+  const char *deviceName = getDeviceName();
+  const char *sensorName = getSensorName(thisSensor);
+#if AGGREGATE_STATE
+  const char *sensorStateTopic = getDeviceStateTopic(); // Shared by every sensor; see publishDeviceState().
+#else
+  const char *sensorStateTopic = getSensorStateTopic(thisSensor);
+#endif
+  bool isSwitch = sensorIsSwitch(thisSensor.type);
 
   // https://www.home-assistant.io/integrations/sensor.mqtt/#name
-  // No leading comma on first key:value pair
-  // Plain english name.
-  memset(buffer, '\0', sizeof(buffer));
-  switch(thisSensor.type) {
-    case door2:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s Door NOPin:%02d NCPin:%02d\"", deviceName, thisSensor.pin1, thisSensor.pin2);
-      break;
-    case garagedoor2:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s GarageDoor NOPin:%02d NCPin:%02d\"", deviceName, thisSensor.pin1, thisSensor.pin2);
-      break;      
-    case window2:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s Window NOPin:%02d NCPin:%02d\"", deviceName, thisSensor.pin1, thisSensor.pin2);
-      break;
-    case motion2:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s Motion Pin:%02d PwrSns:%02d\"", deviceName, thisSensor.pin1, thisSensor.pin2);
-      break;    
-    case motion2_laser:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s Laser Pin:%02d PwrSns:%02d\"", deviceName, thisSensor.pin1, thisSensor.pin2);
-      break;
-
-    case switch1:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s Switch Pin:%02d\"", deviceName, thisSensor.pin1);
-      break;
-    case switch1_radiator:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s RadiatorSwitch Pin:%02d\"", deviceName, thisSensor.pin1);
-      break;
-    case switch1_fan:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s FanSwitch Pin:%02d\"", deviceName, thisSensor.pin1);
-      break;
-    case switch1_fire:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s FireSwitch Pin:%02d\"", deviceName, thisSensor.pin1);
-      break;
-    case switch1_alarmlight:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s AlarmSwitch Pin:%02d\"", deviceName, thisSensor.pin1);
-      break;
-
-    default:
-      snprintf(buffer, sizeof(buffer) - 1, "\"name\":\"%s Sensor Pin1:%02d Pin2:%02d\"", deviceName, thisSensor.pin1, thisSensor.pin2);
-      break;
-  }  
-  payloadsize += mqttsend(shouldSend, buffer);
+  // Plain english name, e.g. "Mega_CC1578 Door NOPin:22 NCPin:23". Switch formats ignore pin2.
+  snprintf_P(plainName, sizeof(plainName), sensorDiscoveryNameFormat(thisSensor.type), deviceName, thisSensor.pin1, thisSensor.pin2);
 
+  jsonBegin(&writer);
+  jsonLiteral_P(&writer, PSTR("{\"name\":\""));
+  jsonString(&writer, plainName);
   
   // https://www.home-assistant.io/integrations/sensor.mqtt/#unique_id
-  payloadsize += mqttsend(shouldSend, ",");
-  payloadsize += mqttsend(shouldSend, "\"unique_id\":\"");
-  payloadsize += mqttsend(shouldSend, deviceName);
-  payloadsize += mqttsend(shouldSend, "_");
-  payloadsize += mqttsend(shouldSend, sensorName);
-  payloadsize += mqttsend(shouldSend, "\"");
+  jsonLiteral_P(&writer, PSTR("\",\"unique_id\":\""));
+  jsonString(&writer, deviceName);
+  jsonLiteral_P(&writer, PSTR("_"));
+  jsonString(&writer, sensorName);
 
   // https://www.home-assistant.io/integrations/sensor.mqtt/#object_id
-  payloadsize += mqttsend(shouldSend, ",");
-  payloadsize += mqttsend(shouldSend, "\"object_id\":\"");
-  payloadsize += mqttsend(shouldSend, deviceName);
-  payloadsize += mqttsend(shouldSend, "_");
-  payloadsize += mqttsend(shouldSend, sensorName);
-  payloadsize += mqttsend(shouldSend, "\"");
-  
+  jsonLiteral_P(&writer, PSTR("\",\"object_id\":\""));
+  jsonString(&writer, deviceName);
+  jsonLiteral_P(&writer, PSTR("_"));
+  jsonString(&writer, sensorName);
+  jsonLiteral_P(&writer, PSTR("\""));
   
   // https://www.home-assistant.io/integrations/sensor.mqtt/#state_topic
-  char *sensorStateTopic = getSensorStateTopic(thisSensor);
   if(sensorStateTopic) {
-    payloadsize += mqttsend(shouldSend, ",");
-    payloadsize += mqttsend(shouldSend, "\"state_topic\":\"");
-    payloadsize += mqttsend(shouldSend, sensorStateTopic);
-    payloadsize += mqttsend(shouldSend, "\"");
-
-    free(sensorStateTopic);
-    sensorStateTopic = NULL;
+    jsonLiteral_P(&writer, PSTR(",\"state_topic\":\""));
+    jsonString(&writer, sensorStateTopic);
+    jsonLiteral_P(&writer, PSTR("\""));
   }
 
-  // https://www.home-assistant.io/integrations/switch.mqtt#command_topic
   // Switches only
-  switch(thisSensor.type) {
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      char *deviceCommandTopic = getDeviceCommandTopic();
-      if(deviceCommandTopic) {
-        payloadsize += mqttsend(shouldSend, ",");
-        payloadsize += mqttsend(shouldSend, "\"command_topic\":\"");
-        payloadsize += mqttsend(shouldSend, deviceCommandTopic);
-        payloadsize += mqttsend(shouldSend, "\"");      
-        free(deviceCommandTopic);
-        deviceCommandTopic = NULL;
-      }
-      break;
-    default:
-      break;
-  }
-
+  // https://www.home-assistant.io/integrations/switch.mqtt#command_topic
   // https://www.home-assistant.io/integrations/switch.mqtt#optimistic
-  // Switches only
-  switch(thisSensor.type) {
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      payloadsize += mqttsend(shouldSend, ",");
-      payloadsize += mqttsend(shouldSend, "\"optimistic\":false");
-      break;
-    default:
-      break;
-  }
-
   // https://www.home-assistant.io/integrations/switch.mqtt#payload_off
-  // Switches Only
-  switch(thisSensor.type) {
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      payloadsize += mqttsend(shouldSend, ",");
-      payloadsize += mqttsend(shouldSend, "\"payload_off\":\"");
-      payloadsize += mqttsend(shouldSend, switchValueOFF(thisSensor));
-      payloadsize += mqttsend(shouldSend, "\"");
-      break;
-    default:
-      break;
-  }
-
-
   // https://www.home-assistant.io/integrations/switch.mqtt#payload_on
-  // Switches Only
-  switch(thisSensor.type) {
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      payloadsize += mqttsend(shouldSend, ",");
-      payloadsize += mqttsend(shouldSend, "\"payload_on\":\"");
-      payloadsize += mqttsend(shouldSend, switchValueON(thisSensor));
-      payloadsize += mqttsend(shouldSend, "\"");
-      break;
-    default:
-      break;
-  }
-
-
   // https://www.home-assistant.io/integrations/switch.mqtt#state_off
-  // Switches Only
-  switch(thisSensor.type) {
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      payloadsize += mqttsend(shouldSend, ",");
-      payloadsize += mqttsend(shouldSend, "\"state_off\":\"OFF\"");
-      break;
-    default:
-      break;
-  }
-
   // https://www.home-assistant.io/integrations/switch.mqtt#state_on
-  // Switches Only
-  switch(thisSensor.type) {
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      payloadsize += mqttsend(shouldSend, ",");
-      payloadsize += mqttsend(shouldSend, "\"state_on\":\"ON\"");
-      break;
-    default:
-      break;
+  if(isSwitch) {
+    jsonLiteral_P(&writer, PSTR(",\"command_topic\":\""));
+    jsonString(&writer, getDeviceCommandTopic());
+    jsonLiteral_P(&writer, PSTR("\",\"optimistic\":false,\"payload_off\":\""));
+    jsonString(&writer, switchValueOFF(thisSensor));
+    jsonLiteral_P(&writer, PSTR("\",\"payload_on\":\""));
+    jsonString(&writer, switchValueON(thisSensor));
+    jsonLiteral_P(&writer, PSTR("\",\"state_off\":\"OFF\",\"state_on\":\"ON\""));
   }
 
   // https://www.home-assistant.io/integrations/sensor.mqtt/#device_class
   // Always 'null' unless needed otherwise.
-  switch(thisSensor.type) {
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      payloadsize += mqttsend(shouldSend, ",");
-      payloadsize += mqttsend(shouldSend, "\"device_class\":\"switch\"");
-      break;
-    default:
-      payloadsize += mqttsend(shouldSend, ",");
-      payloadsize += mqttsend(shouldSend, "\"device_class\":null");
-      break;
+  if(isSwitch) {
+    jsonLiteral_P(&writer, PSTR(",\"device_class\":\"switch\""));
+  } else {
+    jsonLiteral_P(&writer, PSTR(",\"device_class\":null"));
   }
   
+  // https://www.home-assistant.io/integrations/sensor.mqtt/#availability_topic
+  // Replaces expire_after: the broker tells HA when we're gone, so we needn't keep re-publishing to stay "available".
+  // A sensor which loses power publishes its "offline" state instead (queueSensorMQTT()).
+  jsonLiteral_P(&writer, PSTR(",\"availability_topic\":\""));
+  jsonString(&writer, getDeviceAvailabilityTopic());
+  jsonLiteral_P(&writer, PSTR("\""));
   
-  // https://www.home-assistant.io/integrations/sensor.mqtt/#expire_after  
-  payloadsize += mqttsend(shouldSend, ",");
-  payloadsize += mqttsend(shouldSend, "\"expire_after\":60");
-  
-  
-  // Icon
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, "\"icon\":\"%s\"", getSensorStateIcon(thisSensor, pinReadings));  
-  if(strlen(buffer) > 0) {
-    payloadsize += mqttsend(shouldSend, ",");
-    payloadsize += mqttsend(shouldSend, buffer);    
+#if AGGREGATE_STATE
+  // Our state is this sensor's entry in the device state document: ["open","mdi:door-open"], or missing if offline.
+  // https://www.home-assistant.io/integrations/sensor.mqtt/#json_attributes_template
+  jsonLiteral_P(&writer, PSTR(",\"value_template\":\"{{ value_json."));
+  jsonString(&writer, sensorName);
+  jsonLiteral_P(&writer, PSTR("[0] if value_json."));
+  jsonString(&writer, sensorName);
+  jsonLiteral_P(&writer, PSTR(" is defined else 'offline' }}\",\"json_attributes_topic\":\""));
+  jsonString(&writer, sensorStateTopic);
+  jsonLiteral_P(&writer, PSTR("\",\"json_attributes_template\":\"{{ {'icon': value_json."));
+  jsonString(&writer, sensorName);
+  jsonLiteral_P(&writer, PSTR("[1]} | tojson if value_json."));
+  jsonString(&writer, sensorName);
+  jsonLiteral_P(&writer, PSTR(" is defined else '{}' }}\""));
+#elif DISCOVERY_ONCE
+  // State is JSON; the icon rides along as a state attribute rather than in a fresh discovery.
+  // https://www.home-assistant.io/integrations/sensor.mqtt/#value_template
+  // https://www.home-assistant.io/integrations/sensor.mqtt/#json_attributes_topic
+  jsonLiteral_P(&writer, PSTR(",\"value_template\":\"{{ value_json.state }}\""));
+  if(sensorStateTopic) {
+    jsonLiteral_P(&writer, PSTR(",\"json_attributes_topic\":\""));
+    jsonString(&writer, sensorStateTopic);
+    jsonLiteral_P(&writer, PSTR("\""));
   }
+#else
+  // Icon
+  jsonLiteral_P(&writer, PSTR(",\"icon\":\""));
+  jsonString_P(&writer, getSensorStateIcon(thisSensor, pinReadings));
+  jsonLiteral_P(&writer, PSTR("\""));
+#endif
 
   // Device
-  char *devicePayload = getDeviceDiscoveryPayload();
-  if(devicePayload) {
-    payloadsize += mqttsend(shouldSend, ",");
-    payloadsize += mqttsend(shouldSend, "\"device\":");
-    payloadsize += mqttsend(shouldSend, devicePayload);  
-    
-    free(devicePayload);
-    devicePayload = NULL;
-  }
+  jsonLiteral_P(&writer, PSTR(",\"device\":"));
+  jsonDeviceDiscovery(&writer);
   
   // Ending Bracket
-  payloadsize += mqttsend(shouldSend, "}");
-
-
-  if(paramSize == 0) {
-    // Now that we know our total payload size, call ourselves again with that size.
-    // That second "go-around", we'll actually talk to MQTT.
-    return mqttSensorDiscovery(thisSensor, pinReadings, payloadsize);
-  } else {
-    pubsubClient.endPublish();
-    Serial.println("");
+  jsonLiteral_P(&writer, PSTR("}"));
+
+  size_t payloadsize = jsonLength(&writer);
+  if(LOG_ENABLED(LOG_DEBUG)) {
+    Log.print(F("mqttSensorDiscovery payloadsize="));
+    Log.print(payloadsize);
+    Log.print(F(" thisState="));
+    Log.print(thisState);
+    if(LOG_ENABLED(LOG_VERBOSE)) {
+      Log.print(F("  "));
+      jsonWrite(&writer, Log);
+    }
+    Log.println();
   }
-  
+
+  if(! jsonPublish(&writer, sensorDiscoveryTopic, DISCOVERY_ONCE)) return 0;
   return payloadsize;
 }
 
@@ -569,115 +710,43 @@ static size_t mqttSensorDiscovery(baseSensor_t thisSensor, uint64_t pinReadings,
 /*
  * https://www.home-assistant.io/integrations/mqtt/#mqtt-discovery
  * Supported Abbreviations for device registry configuration
+ * Adds the device JSON object to "writer". The pieces point at our cached device strings.
  *
  * Examples:
  * {"identifiers": ["bedroom01ae"], "name": "Bedroom" }
  * {"identifiers": ["bedroom01ae"], "name": "Bedroom" }
  * {"identifiers": ["garden01ad"], "name": "Garden" }
  */
-char *getDeviceDiscoveryPayload(void) {
-  char buffer[80]; // "Connections" is our longest string to fit here.
+void jsonDeviceDiscovery(jsonWriter_t *writer) {
+  // Our IP only changes with a new DHCP lease, so only re-format it then.
   IPAddress myIP = Ethernet.localIP();
-  size_t jsonsize = 8;
-  char *json = (char *) calloc(jsonsize,  sizeof(char));
-  memset(json, '\0', jsonsize);
-
-
-  char deviceName[32];
-  getDeviceName(deviceName, sizeof(deviceName));
-  // TODO: MAC Address Here.
-
-
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, "{");
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
-
+  if((deviceIPString[0] == '\0') || !(myIP == deviceIP)) {
+    deviceIP = myIP;
+    snprintf_P(deviceIPString, sizeof(deviceIPString), PSTR("%d.%d.%d.%d"), myIP[0], myIP[1], myIP[2], myIP[3]);
+  }
 
   // NO LEADING comma, on our FIRST key/value pair.
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, "\"identifiers\":[\"%s\"]", deviceName); // TODO Incorporate MAC Address
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
-
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, ", \"name\":\"%s\"", deviceName);
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
+  jsonLiteral_P(writer, PSTR("{\"identifiers\":[\"")); // TODO Incorporate MAC Address
+  jsonString(writer, deviceName);
+  jsonLiteral_P(writer, PSTR("\"], \"name\":\""));
+  jsonString(writer, deviceName);
 
   //https://www.home-assistant.io/integrations/sensor.mqtt/#model
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, ", \"model\":\"%d.%d.%d.%d\"", myIP[0], myIP[1], myIP[2], myIP[3]);
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
+  jsonLiteral_P(writer, PSTR("\", \"model\":\""));
+  jsonString(writer, deviceIPString);
   
   //https://www.home-assistant.io/integrations/sensor.mqtt/#hw_version
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, ", \"hw_version\":\"%s\"", BoardIdentify::model);
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
+  jsonLiteral_P(writer, PSTR("\", \"hw_version\":\""));
+  jsonString(writer, BoardIdentify::model);
   
   //https://www.home-assistant.io/integrations/sensor.mqtt/#manufacturer
-  memset(buffer, '\0', sizeof(buffer));
-  //snprintf(buffer, sizeof(buffer) - 1, ", \"hw_version\":\"%s\"", BoardIdentify::mcu);
-  //snprintf(buffer, sizeof(buffer) - 1, ", \"manufacturer\":\"%s\"", BoardIdentify::make);
-  snprintf(buffer, sizeof(buffer) - 1, ", \"manufacturer\":\"%s\"", GUARDUINO_URL);
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
-
-  
   //https://www.home-assistant.io/integrations/sensor.mqtt/#sw_version
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, ", \"sw_version\":\"%s\"", SOFTWARE_VERSION);
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
-
-
   //https://www.home-assistant.io/integrations/sensor.mqtt/#connections
-  memset(buffer, '\0', sizeof(buffer));
-  byte macBytes[6];
-  Ethernet.MACAddress(macBytes); // https://www.arduino.cc/reference/en/libraries/ethernet/ethernet.macaddress/  
-  snprintf(buffer, sizeof(buffer) - 1, ", \"connections\":[[\"mac\",\"%02X:%02X:%02X:%02X:%02X:%02X\"],[\"ip\", \"%d.%d.%d.%d\"]]", macBytes[0], macBytes[1], macBytes[2], macBytes[3], macBytes[4], macBytes[5], myIP[0], myIP[1], myIP[2], myIP[3]);
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
-
-
-  // Closing JSON bracket.
-  memset(buffer, '\0', sizeof(buffer));
-  snprintf(buffer, sizeof(buffer) - 1, "}");
-  jsonsize += strlen(buffer);
-  json = (char*) realloc(json, jsonsize);
-  strlcat(json, buffer, jsonsize);
-
-
-  return json;
-}
-
-
-
-/**
- *  If "shouldSend" is true, mqtt sends "nulltermstring"
- *  In any case, returns the number of bytes we did/would send.
- *  This one function is handy for both determining "length to ultimately send" as well as actually sending.
- */
-size_t mqttsend(const bool shouldSend, const char *nulltermstring) {
-  if(! nulltermstring) return 0;
-  
-  size_t len = strlen(nulltermstring);
-  if(shouldSend) {
-    pubsubClient.write( (uint8_t *) nulltermstring, len);
-    Serial.print(nulltermstring);
-  }
-  
-  return len;
+  jsonLiteral_P(writer, PSTR("\", \"manufacturer\":\"" GUARDUINO_URL "\", \"sw_version\":\"" SOFTWARE_VERSION "\", \"connections\":[[\"mac\",\""));
+  jsonString(writer, deviceMacString);
+  jsonLiteral_P(writer, PSTR("\"],[\"ip\", \""));
+  jsonString(writer, deviceIPString);
+  jsonLiteral_P(writer, PSTR("\"]]}"));
 }
 
 
@@ -691,8 +760,6 @@ size_t mqttsend(const bool shouldSend, const char *nulltermstring) {
 void setupSensors(baseSensor_t *sensors, size_t sensorsSize) 
 {
   int sensorCount = sensorsSize / sizeof(baseSensor_t);
-  char sensorName[48];
-  char *sensorCommandTopic = NULL;
 
   // Onboard LED.
   pinMode(LED_BUILTIN, OUTPUT);
@@ -701,340 +768,106 @@ void setupSensors(baseSensor_t *sensors, size_t sensorsSize)
   // Our configured pins.
   for(int i = 0; i < sensorCount; i++) {
     baseSensor_t *thisSensor = &sensors[i];
-    switch(thisSensor->type) {
-      case door2:
-      case garagedoor2:
-      case window2:      
-      case motion2:
-      case motion2_laser:
-        getSensorName(sensorName, sizeof(sensorName), *thisSensor);
-        Serial.print("Setup_x(");
-        Serial.print(i);
-        Serial.print(") ");        
-        Serial.println(sensorName);
-        pinMode(thisSensor->pin1, INPUT);
-        pinMode(thisSensor->pin2, INPUT);
-        break;
-        
-      case switch1:
-      case switch1_radiator:
-      case switch1_fan:
-      case switch1_fire:
-      case switch1_alarmlight:
-        getSensorName(sensorName, sizeof(sensorName), *thisSensor);
-        Serial.print("Setup_y(");
-        Serial.print(i);
-        Serial.print(") ");        
-        Serial.println(sensorName);
-        pinMode(thisSensor->pin1, OUTPUT);
-        digitalWrite(thisSensor->pin1, LOW);
-
-        sensorCommandTopic = getDeviceCommandTopic();
-        if(sensorCommandTopic) {
-          Serial.print("SUBSCRIBE(");
-          Serial.print(i);
-          Serial.print(") ");          
-          Serial.print(sensorCommandTopic);
-          Serial.println("");
-          pubsubClient.subscribe(sensorCommandTopic);
-          free(sensorCommandTopic);
-          sensorCommandTopic = NULL;
-        }
-        break;
-        
-      default:
-        break;          
+    if(sensorPinCount(thisSensor->type) == 0) continue;
+
+    if(sensorPinDirection(thisSensor->type) == INPUT) {
+      Serial.print(F("Setup_x("));
+      Serial.print(i);
+      Serial.print(F(") "));        
+      Serial.println(getSensorName(*thisSensor));
+      pinMode(thisSensor->pin1, INPUT);
+      if(sensorPinCount(thisSensor->type) == 2) pinMode(thisSensor->pin2, INPUT);
+      continue;
     }
-  }
+
+    Serial.print(F("Setup_y("));
+    Serial.print(i);
+    Serial.print(F(") "));        
+    Serial.println(getSensorName(*thisSensor));
+    pinMode(thisSensor->pin1, OUTPUT);
+    digitalWrite(thisSensor->pin1, LOW);
+  }
+
+  // Now that pin modes are set, build the port snapshot table readSensors() uses.
+  setupPinScanner(sensors, sensorsSize);
+  setupDebounce(sensors, sensorsSize);
+  setupSensorIndex(sensors, sensorsSize);
+#if PINCAPTURE_PCINT
+  setupPinCapture(sensors, sensorsSize);
+#endif
 }
 
 
 
-/**
- * Given a sensor, and a set of all readings, return the enumerated "state" of the sensor.
+/*
+ * Read the pins of every sensor setupSensors() was given into "pinReadings", which should hold what was last
+ * reported. Pins are read by the port snapshot scanner (pinScanner.cpp), then debounced (debounce.cpp), both of
+ * which setupSensors() built from its sensors.
  */
-sensorStates getSensorStateEnum(baseSensor_t sensor, uint64_t pinReadings) {
-  bool pin1data = false;
-  bool pin2data = false;
-  sensorStates theState = unknown;
-  
-  switch(sensor.type) {
-    
-    // Door2 and Window2: "pin1" is "no" aka "normally open", "pin2" is "nc" aka "normally closed"
-    case door2:
-      pin1data = getBit(pinReadings, sensor.pin1);
-      pin2data = getBit(pinReadings, sensor.pin2);
-      if( (pin1data==true) && (pin2data == true)) theState = door2_fault;
-      if( (pin1data==true) && (pin2data == false)) theState = door2_open;
-      if( (pin1data==false) && (pin2data == true)) theState = door2_closed;
-      if( (pin1data==false) && (pin2data == false)) theState = door2_offline;
-      break;
-
-    case garagedoor2:
-      pin1data = getBit(pinReadings, sensor.pin1);
-      pin2data = getBit(pinReadings, sensor.pin2);
-      if( (pin1data==true) && (pin2data == true)) theState = garagedoor2_fault;
-      if( (pin1data==true) && (pin2data == false)) theState = garagedoor2_open;
-      if( (pin1data==false) && (pin2data == true)) theState = garagedoor2_closed;
-      if( (pin1data==false) && (pin2data == false)) theState = garagedoor2_offline;
-      break;
-
-    case window2:
-      pin1data = getBit(pinReadings, sensor.pin1);
-      pin2data = getBit(pinReadings, sensor.pin2);
-      if( (pin1data==true) && (pin2data == true)) theState = window2_fault;
-      if( (pin1data==true) && (pin2data == false)) theState = window2_open;
-      if( (pin1data==false) && (pin2data == true)) theState = window2_closed;
-      if( (pin1data==false) && (pin2data == false)) theState = window2_offline;
-      break;
-
-    case motion2:
-    case motion2_laser:
-      // Motion2: "pin1" is "data", pin2 is "power sense"
-      pin1data = getBit(pinReadings, sensor.pin1);
-      pin2data = getBit(pinReadings, sensor.pin2);
-      if( (pin1data==true) && (pin2data == true)) theState = motion2_motion;
-      if( (pin1data==true) && (pin2data == false)) theState = motion2_fault;
-      if( (pin1data==false) && (pin2data == true)) theState = motion2_quiet;
-      if( (pin1data==false) && (pin2data == false)) theState = motion2_offline;
-      break;
-
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      // Switch1: "pin1" is "switch status", "pin2" is unused.
-      pin1data = getBit(pinReadings, sensor.pin1);      
-      if( (pin1data == HIGH) ) theState = switch1_on;
-      if( (pin1data == LOW) ) theState = switch1_off;
-      break;      
-  }
-
-  return theState;
+void readSensors(pinBitset_t *pinReadings)
+{
+  CYCLE_MARK(CYCLE_READ_SENSORS);
+  debounceRead(pinReadings);
 }
 
 
 /**
- * Returns a const char* of the MDI icon to use for this sensor which has it's current state.
- * This function, when "Send Discovery" is called with every state change,  allows HA to 
- * display a dynamically different icon for this sensor based on the current state of the sensor.
- * https://pictogrammers.com/library/mdi/
+ * Reads digital "pin", and puts results into "bitarray".
  */
-const char *getSensorStateIcon(baseSensor_t sensor, uint64_t pinReadings) {
-  sensorStates theState = getSensorStateEnum(sensor, pinReadings);
-  static const char *icon_unknown = "mdi:help-circle"; 
-  static const char *icon_alert = "mdi:alert-circle-outline";
-  static const char *icon_nopower = "mdi:power-plug-off";
-
-  static const char *icon_door2_open = "mdi:door-open";
-  static const char *icon_door2_closed = "mdi:door-closed";
-  if(sensor.type == door2) {
-    if(theState == door2_open) return icon_door2_open;
-    if(theState == door2_closed) return icon_door2_closed;
-    if(theState == door2_fault) return icon_alert;
-    if(theState == door2_offline) return icon_nopower;
-  }
-
-  static const char *icon_garagedoor2_open = "mdi:garage-open";
-  static const char *icon_garagedoor2_closed = "mdi:garage";
-  if(sensor.type == garagedoor2) {
-    if(theState == garagedoor2_open) return icon_garagedoor2_open;
-    if(theState == garagedoor2_closed) return icon_garagedoor2_closed;
-    if(theState == garagedoor2_fault) return icon_alert;
-    if(theState == garagedoor2_offline) return icon_nopower;
-  }
-
-  static const char *icon_window2_open = "mdi:window-open";
-  static const char *icon_window2_closed = "mdi:window-closed";
-  if(sensor.type == window2) {
-    if(theState == window2_open) return icon_window2_open;
-    if(theState == window2_closed) return icon_window2_closed;
-    if(theState == window2_fault) return icon_alert;
-    if(theState == window2_offline) return icon_nopower;
-  }
-
-  static const char *icon_motion2_motion = "mdi:motion-sensor";
-  static const char *icon_motion2_quiet = "mdi:meditation";
-  if(sensor.type == motion2) {
-    if(theState == motion2_motion) return icon_motion2_motion;
-    if(theState == motion2_quiet) return icon_motion2_quiet;
-    if(theState == motion2_fault) return icon_alert;
-    if(theState == motion2_offline) return icon_nopower;
-  }
-
-  static const char *icon_motion2_laser_motion = "mdi:motion-sensor";
-  static const char *icon_motion2_laser_quiet = "mdi:laser-pointer";
-  if(sensor.type == motion2_laser) {
-    if(theState == motion2_motion) return icon_motion2_laser_motion;
-    if(theState == motion2_quiet) return icon_motion2_laser_quiet;
-    if(theState == motion2_fault) return icon_alert;
-    if(theState == motion2_offline) return icon_nopower;
-  }
-
-  static const char *icon_switch1_on = "mdi:light-switch";
-  static const char *icon_switch1_off = "mdi:light-switch-off";
-  if(sensor.type == switch1) {
-    if(theState == switch1_on) return icon_switch1_on;
-    if(theState == switch1_off) return icon_switch1_off;
-  }
-
-  static const char *icon_switch1_radiator_on = "mdi:radiator";
-  static const char *icon_switch1_radiator_off = "mdi:radiator-off";
-  if(sensor.type == switch1_radiator) {
-    if(theState == switch1_on) return icon_switch1_radiator_on;
-    if(theState == switch1_off) return icon_switch1_radiator_off;
-  }
-
-  static const char *icon_switch1_fan_on = "mdi:fan";
-  static const char *icon_switch1_fan_off = "mdi:fan-off";
-  if(sensor.type == switch1_fan) {
-    if(theState == switch1_on) return icon_switch1_fan_on;
-    if(theState == switch1_off) return icon_switch1_fan_off;
-  }
-
-  static const char *icon_switch1_fire_on = "mdi:fire";
-  static const char *icon_switch1_fire_off = "mdi:fire-off";
-  if(sensor.type == switch1_fire) {
-    if(theState == switch1_on) return icon_switch1_fire_on;
-    if(theState == switch1_off) return icon_switch1_fire_off;
-  }
+void readBit(pinBitset_t *bitarray, int8_t pin)
+{
+  if((pin < 0) || (pin >= NUM_DIGITAL_PINS)) return;
+  uint8_t port = digitalPinToPort(pin);
+  if((port == NOT_A_PORT) || (port > PINBITSET_PORTS)) return;
 
-  static const char *icon_switch1_alarmlight_on = "mdi:alarm-light-outline";
-  static const char *icon_switch1_alarmlight_off = "mdi:alarm-light-off";
-  if(sensor.type == switch1_alarmlight) {
-    if(theState == switch1_on) return icon_switch1_alarmlight_on;
-    if(theState == switch1_off) return icon_switch1_alarmlight_off;
+  uint8_t mask = digitalPinToBitMask(pin);
+  if(digitalRead(pin) == HIGH) {
+    bitarray->ports[port - 1] |= mask;
+  } else {
+    bitarray->ports[port - 1] &= ~mask;
   }
-  
-  return icon_unknown;
 }
 
 
+
 /**
- * This is the value which HA displays for this "entity". This value is returned based on status computed in pinReadings for this sensor.
+ * Returns binary value of "pin" from "bitarray".
+ * Bits are kept where the hardware keeps them: byte (port - 1), bit digitalPinToBitMask(pin). So pins 0-69 all fit,
+ * and a whole port's worth of readings is one byte.
  */
-const char *getSensorStateName(baseSensor_t sensor, uint64_t pinReadings) {
-  static const char *name_unknown = "unknown";   
-  static const char *name_open = "open";
-  static const char *name_closed = "closed";
-  static const char *name_off = "OFF";
-  static const char *name_on = "ON";
-  static const char *name_offline = "offline"; // https://www.home-assistant.io/integrations/sensor.mqtt/#payload_not_available
-  static const char *name_fault = "wiringfault";   
-  static const char *name_motion = "motion";
-  static const char *name_quiet = "quiet";
-  static const char *name_motion_nopower = "motion-fault";
-  sensorStates theState;
-
-  switch(sensor.type) {
-    case door2:
-    case garagedoor2:
-    case window2:
-    case motion2:
-      theState = getSensorStateEnum(sensor, pinReadings);
-      if(theState == door2_open) return name_open;  
-      if(theState == door2_closed) return name_closed;
-      if(theState == door2_fault) return name_fault;
-      if(theState == door2_offline) return name_offline;
-      if(theState == garagedoor2_open) return name_open;  
-      if(theState == garagedoor2_closed) return name_closed;  
-      if(theState == garagedoor2_fault) return name_fault;
-      if(theState == garagedoor2_offline) return name_offline;
-      
-      if(theState == window2_open) return name_open;
-      if(theState == window2_closed) return name_closed;
-      if(theState == window2_fault) return name_fault;
-      if(theState == window2_offline) return name_offline;
-
-      if(theState == motion2_motion) return name_motion;
-      if(theState == motion2_quiet) return name_quiet;
-      if(theState == motion2_fault) return name_motion_nopower;
-      if(theState == motion2_offline) return name_offline;
-      break;
-
-    case switch1:
-    case switch1_radiator:
-    case switch1_fan:
-    case switch1_fire:
-    case switch1_alarmlight:
-      theState = getSensorStateEnum(sensor, pinReadings);
-      if(theState == switch1_on) return name_on;
-      if(theState == switch1_off) return name_off;
-      break;      
-
-
-    default:
-      break;
-  }
-
-  return name_unknown;
+bool getBit(const pinBitset_t *bitarray, int8_t pin)
+{
+  if((pin < 0) || (pin >= NUM_DIGITAL_PINS)) return false;
+  uint8_t port = digitalPinToPort(pin);
+  if((port == NOT_A_PORT) || (port > PINBITSET_PORTS)) return false;
+  return (bitarray->ports[port - 1] & digitalPinToBitMask(pin)) != 0;
 }
 
 
-/*
- * Look through each baseSensor in "sensors", and read pins for each "readable" sensor.
- * Ultimately, returns a 64 bit integer, starting with "oldbits", with appropriate sensor bits 
- * modified (and all other bits left in-place.)
- */
-uint64_t readSensors(uint64_t oldBits, baseSensor_t *sensors, size_t sensorsSize)
+void pinBitsetClear(pinBitset_t *bitarray)
 {
-  uint64_t newBits = oldBits;
-  
-  for(int i = 0; i < (sensorsSize / sizeof(baseSensor_t)); i++) {
-    baseSensor_t thisSensor = sensors[i];
-    switch(thisSensor.type) {
-      case door2:
-      case garagedoor2:
-      case window2:
-      case motion2:
-      case motion2_laser:
-        newBits = readBit(newBits, thisSensor.pin1);
-        newBits = readBit(newBits, thisSensor.pin2);
-        break;
-      case switch1:
-      case switch1_radiator:
-      case switch1_fan:
-      case switch1_fire:
-      case switch1_alarmlight:
-        newBits = readBit(newBits, thisSensor.pin1);
-        break;
-
-      default:
-        break;
-    }
-  }
-  
-  return newBits;
+  memset(bitarray, '\0', sizeof(pinBitset_t));
 }
 
 
 /**
- * Reads digital "pin", and puts results into "bitarray", returning modified "bitarray"
+ * Copy "pin"'s bit from "from" to "to".
  */
-// https://www.geeksforgeeks.org/set-clear-and-toggle-a-given-bit-of-a-number-in-c/
-uint64_t readBit(uint64_t bitarray, int8_t pin)
+void pinBitsetCopyPin(pinBitset_t *to, const pinBitset_t *from, int8_t pin)
 {
-  if(pin < 0) { return bitarray; } 
-  
-  uint8_t bitvalue = digitalRead(pin);
-  if(bitvalue == HIGH) {    
-    bitarray |= ((uint64_t) 1 << pin);    
-  } else {
-    bitarray &= ~((uint64_t) 1 << pin);    
-  }
+  if((pin < 0) || (pin >= NUM_DIGITAL_PINS)) return;
+  uint8_t port = digitalPinToPort(pin);
+  if((port == NOT_A_PORT) || (port > PINBITSET_PORTS)) return;
 
-  
-  return bitarray;
+  uint8_t mask = digitalPinToBitMask(pin);
+  to->ports[port - 1] = (to->ports[port - 1] & ~mask) | (from->ports[port - 1] & mask);
 }
 
 
-
 /**
- * Returns binary value of "pin" from "bitarray".
+ * True if no pin differs between "a" and "b". A dozen byte compares.
  */
-bool getBit(uint64_t bitarray, int8_t pin)
+bool pinBitsetEqual(const pinBitset_t *a, const pinBitset_t *b)
 {
-    int bitValue = ((uint64_t) (bitarray >> pin) & 1);
-    return (bitValue == 1);
+  return memcmp(a, b, sizeof(pinBitset_t)) == 0;
 }
@@ -0,0 +1,230 @@
+#include "guarduino.h"
+
+
+/**
+ * Debounce and glitch filter for sensor input pins.
+ *
+ * Every DEBOUNCE_TICK_MS we take one sample of each port, and each pin counts how many samples in a row
+ * it has disagreed with its debounced value. Once that count reaches the pin's threshold (its sensor's
+ * debounce_ms, in ticks), the debounced value flips; one agreeing sample in between starts it over.
+ * The counters are "vertical": bit N of counterPlanes[k][port] is bit k of pin N's count, so one pass of
+ * byte-wide ANDs/XORs steps all eight pins of a port at once. Thresholds are kept the same way, so each
+ * pin can have its own.
+ *
+ * Pins with no debounce (switch outputs, debounce_ms = 0) bypass all of this and are copied straight through.
+ *
+ * Ticks are on their own micros() clock, and each one samples the pins as they stood at that tick: every
+ * reading we're given (a scan, or a port captured by pinCapture.cpp's ISR) is timestamped, and before it is
+ * taken in, the ticks due up to its timestamp are run on the readings before it. So a pulse which came and
+ * went while loop() was busy is still seen for as long as it lasted, and a replayed capture never counts as
+ * a sample of "now".
+ *
+ * On top of that, a two-pin sensor only reports a fault or offline state once it has held for
+ * DEBOUNCE_FAULT_SAMPLES ticks. A door swinging open passes through "both contacts open" for a moment,
+ * and that's not worth telling anyone about.
+ */
+#define DEBOUNCE_PLANES 5 // Counter bits per pin. Thresholds up to (1 << DEBOUNCE_PLANES) - 1 ticks.
+#define DEBOUNCE_MAX_TICKS ((1 << DEBOUNCE_PLANES) - 1)
+#define DEBOUNCE_TICK_US (DEBOUNCE_TICK_MS * 1000UL)
+
+static pinBitset_t rawReadings;   // Latest readings, scanned or captured.
+static pinBitset_t stableReadings; // Debounced.
+static uint8_t debounceMask[PINBITSET_PORTS]; // Pins being debounced. Everything else is copied as-is.
+static uint8_t counterPlanes[DEBOUNCE_PLANES][PINBITSET_PORTS];
+static uint8_t thresholdPlanes[DEBOUNCE_PLANES][PINBITSET_PORTS];
+static unsigned long lastTickAt = 0; // micros() of the last tick.
+
+static baseSensor_t *debounceSensors = NULL;
+static int debounceSensorCount = 0;
+
+
+/**
+ * Adds "pin" to the debounced set, with a threshold of "ticks" samples. A pin shared by two sensors keeps the longer one.
+ */
+static void debounceAddPin(int8_t pin, uint8_t ticks)
+{
+  if((pin < 0) || (pin >= NUM_DIGITAL_PINS)) return;
+  uint8_t port = digitalPinToPort(pin);
+  if((port == NOT_A_PORT) || (port > PINBITSET_PORTS)) return;
+  uint8_t slot = port - 1;
+  uint8_t mask = digitalPinToBitMask(pin);
+
+  uint8_t oldTicks = 0;
+  for(uint8_t k = 0; k < DEBOUNCE_PLANES; k++) {
+    if(thresholdPlanes[k][slot] & mask) oldTicks |= (1 << k);
+  }
+  if(ticks < oldTicks) ticks = oldTicks;
+
+  debounceMask[slot] |= mask;
+  for(uint8_t k = 0; k < DEBOUNCE_PLANES; k++) {
+    if(ticks & (1 << k)) thresholdPlanes[k][slot] |= mask;
+    else thresholdPlanes[k][slot] &= ~mask;
+  }
+}
+
+
+/**
+ * Build thresholds from each sensor's debounceMs, and start every pin out debounced at what it reads now.
+ * Call from setupSensors(), after setupPinScanner(). "sensors" must outlive us; it's allSensors.
+ */
+void setupDebounce(baseSensor_t *sensors, size_t sensorsSize)
+{
+  debounceSensors = sensors;
+  debounceSensorCount = sensorsSize / sizeof(baseSensor_t);
+  memset(debounceMask, '\0', sizeof(debounceMask));
+  memset(counterPlanes, '\0', sizeof(counterPlanes));
+  memset(thresholdPlanes, '\0', sizeof(thresholdPlanes));
+
+  int debouncedSensors = 0;
+  for(int i = 0; i < debounceSensorCount; i++) {
+    baseSensor_t *thisSensor = &sensors[i];
+    thisSensor->faultSamples = 0;
+    if(sensorPinDirection(thisSensor->type) != INPUT) continue;
+    if(thisSensor->debounceMs == 0) continue;
+
+    unsigned int ticks = (thisSensor->debounceMs + DEBOUNCE_TICK_MS - 1) / DEBOUNCE_TICK_MS;
+    if(ticks > DEBOUNCE_MAX_TICKS) {
+      Serial.print(F("debounce_ms "));
+      Serial.print(thisSensor->debounceMs);
+      Serial.print(F(" too long for "));
+      Serial.print(getSensorName(*thisSensor));
+      Serial.print(F(", using "));
+      Serial.println(DEBOUNCE_MAX_TICKS * DEBOUNCE_TICK_MS);
+      ticks = DEBOUNCE_MAX_TICKS;
+    }
+
+    uint8_t pinCount = sensorPinCount(thisSensor->type);
+    if(pinCount >= 1) debounceAddPin(thisSensor->pin1, ticks);
+    if(pinCount >= 2) debounceAddPin(thisSensor->pin2, ticks);
+    debouncedSensors++;
+  }
+
+  pinBitsetClear(&rawReadings);
+  pinScannerRead(&rawReadings);
+  stableReadings = rawReadings;
+  lastTickAt = micros();
+
+  Serial.print(F("Debounce: "));
+  Serial.print(debouncedSensors);
+  Serial.print(F(" sensors, "));
+  Serial.print(DEBOUNCE_TICK_MS);
+  Serial.println(F("ms ticks."));
+}
+
+
+/**
+ * One sample: step every debounced pin's counter, and flip the pins which have reached their threshold.
+ */
+static void debounceTick(void)
+{
+  for(uint8_t slot = 0; slot < PINBITSET_PORTS; slot++) {
+    uint8_t mask = debounceMask[slot];
+    if(! mask) continue;
+
+    // Count up where the sample disagrees with the debounced value; back to zero where it agrees.
+    uint8_t differs = (rawReadings.ports[slot] ^ stableReadings.ports[slot]) & mask;
+    uint8_t carry = differs;
+    uint8_t reached = 0xFF;
+    for(uint8_t k = 0; k < DEBOUNCE_PLANES; k++) {
+      uint8_t plane = counterPlanes[k][slot];
+      uint8_t sum = plane ^ carry;
+      carry &= plane;
+      counterPlanes[k][slot] = sum & differs;
+      reached &= ~(counterPlanes[k][slot] ^ thresholdPlanes[k][slot]);
+    }
+
+    uint8_t flips = differs & reached;
+    if(! flips) continue;
+    stableReadings.ports[slot] ^= flips;
+    for(uint8_t k = 0; k < DEBOUNCE_PLANES; k++) counterPlanes[k][slot] &= ~flips;
+  }
+}
+
+
+/**
+ * Run the ticks due up to "at" (micros()), each on rawReadings as they are now, i.e. as they were up to "at".
+ * Returns how many were due, at most 255. Nothing is due for a reading from before the last tick.
+ * Once every counter has settled, more ticks on the same readings change nothing, so after a long gap
+ * only the first DEBOUNCE_MAX_TICKS + 1 are actually run.
+ */
+static uint8_t debounceAdvance(unsigned long at)
+{
+  unsigned long elapsed = at - lastTickAt;
+  if((long) elapsed < (long) DEBOUNCE_TICK_US) return 0;
+
+  unsigned long due = elapsed / DEBOUNCE_TICK_US;
+  lastTickAt += due * DEBOUNCE_TICK_US;
+  uint8_t run = (due > (DEBOUNCE_MAX_TICKS + 1)) ? (DEBOUNCE_MAX_TICKS + 1) : due;
+  for(uint8_t tick = 0; tick < run; tick++) debounceTick();
+  return (due > 255) ? 255 : due;
+}
+
+
+/**
+ * Hold a two-pin sensor at its last reported pins while a fault/offline state hasn't yet lasted DEBOUNCE_FAULT_SAMPLES ticks.
+ */
+static void debounceHoldFaults(const pinBitset_t *reported, pinBitset_t *pinReadings, uint8_t ticks)
+{
+  for(int i = 0; i < debounceSensorCount; i++) {
+    baseSensor_t *thisSensor = &debounceSensors[i];
+    if(thisSensor->debounceMs == 0) continue;
+    if(sensorPinCount(thisSensor->type) != 2) continue;
+
+    bool needsConfirming = sensorStateNeedsConfirming(*thisSensor, pinReadings);
+    if(! needsConfirming || (sensorReadingIndex(*thisSensor, pinReadings) == sensorReadingIndex(*thisSensor, reported))) {
+      thisSensor->faultSamples = 0;
+      continue;
+    }
+
+    if((DEBOUNCE_FAULT_SAMPLES - thisSensor->faultSamples) > ticks) thisSensor->faultSamples += ticks;
+    else thisSensor->faultSamples = DEBOUNCE_FAULT_SAMPLES;
+    if(thisSensor->faultSamples >= DEBOUNCE_FAULT_SAMPLES) {
+      thisSensor->faultSamples = 0;
+      continue; // Held long enough; report it.
+    }
+
+    // Not yet. Keep reporting what we last reported.
+    pinBitsetCopyPin(pinReadings, reported, thisSensor->pin1);
+    pinBitsetCopyPin(pinReadings, reported, thisSensor->pin2);
+  }
+}
+
+
+/**
+ * Fold rawReadings into "pinReadings" (which holds what was last reported), after "ticks" ticks:
+ * bypassed pins are copied as read, debounced pins as debounced.
+ */
+static void debounceApply(pinBitset_t *pinReadings, uint8_t ticks)
+{
+  pinBitset_t reported = *pinReadings;
+
+  for(uint8_t slot = 0; slot < PINBITSET_PORTS; slot++) {
+    uint8_t mask = debounceMask[slot];
+    pinReadings->ports[slot] = (rawReadings.ports[slot] & ~mask) | (stableReadings.ports[slot] & mask);
+  }
+
+  debounceHoldFaults(&reported, pinReadings, ticks);
+}
+
+
+/**
+ * Scan the pins, and update "pinReadings" (what was last reported) from them. See readSensors().
+ */
+void debounceRead(pinBitset_t *pinReadings)
+{
+  uint8_t ticks = debounceAdvance(micros());
+  pinScannerRead(&rawReadings);
+  debounceApply(pinReadings, ticks);
+}
+
+
+/**
+ * As debounceRead(), for one port value captured elsewhere at micros() "at" (e.g. in a pin change ISR).
+ * Captures must come in the order they were taken.
+ */
+void debounceApplyPort(pinBitset_t *pinReadings, uint8_t port, uint8_t portValue, unsigned long at)
+{
+  uint8_t ticks = debounceAdvance(at);
+  pinScannerApplyPort(&rawReadings, port, portValue);
+  debounceApply(pinReadings, ticks);
+}
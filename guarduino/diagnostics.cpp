@@ -0,0 +1,305 @@
+#include <avr/pgmspace.h>
+#include <PubSubClient.h> // https://github.com/knolleary/pubsubclient/tree/master
+#include "guarduino.h"
+
+
+/**
+ * Diagnostic entities: how the board itself is doing, as HA sensors with entity_category "diagnostic".
+ *
+ * Each row below is one entity: edge-to-publish latency (latency.cpp), heap and stack (memory.cpp), log bytes
+ * dropped (log.cpp) and, with PROFILE_STAGES, the loop rate and each stage's (scheduler task's) average and
+ * worst run. All of them share one JSON state document on
+ * getDeviceDiagnosticsTopic(), e.g. {"latency_p50":0.512,"latency_p99":4.096,...}, and each one's discovery
+ * picks its value out by "key".
+ * diagnosticsRun() closes each measurement window (DIAGNOSTICS_PERIOD) and queues the document; discovery
+ * goes once per MQTT session. Both go through mqttQueue.cpp, behind everything else.
+ * Adding an entity means adding a row here, and a function returning its value.
+ */
+#define DIAGNOSTIC_FORMAT_MS 0    // Value is in microseconds, published in ms (3 decimals), device_class duration.
+#define DIAGNOSTIC_FORMAT_COUNT 1 // Value is published as is.
+#define DIAGNOSTIC_FORMAT_BYTES 2 // Value is published as is, device_class data_size.
+
+typedef struct diagnostic_t
+{
+    PGM_P key;   // In the state document, the unique_id and the discovery topic.
+    PGM_P name;  // HA "name", after the device name.
+    PGM_P unit;  // unit_of_measurement, or NULL.
+    uint8_t format;
+    unsigned long (*value)(PGM_P task);
+    PGM_P task;  // PROFILE_STAGES rows: the scheduler task (stage) timed. Otherwise NULL.
+} diagnostic_t;
+
+static unsigned long diagnosticLatencyP50(PGM_P) { return latencyLastWindow()->p50Us; }
+static unsigned long diagnosticLatencyP99(PGM_P) { return latencyLastWindow()->p99Us; }
+static unsigned long diagnosticLatencyMax(PGM_P) { return latencyLastWindow()->maxUs; }
+static unsigned long diagnosticLatencyCount(PGM_P) { return latencyLastWindow()->count; }
+static unsigned long diagnosticMemoryFreeMin(PGM_P) { return memoryLastWindow()->freeMin; }
+static unsigned long diagnosticMemoryLargestFree(PGM_P) { return memoryLastWindow()->largestFree; }
+static unsigned long diagnosticMemoryFragmentation(PGM_P) { return memoryLastWindow()->fragmentation; }
+static unsigned long diagnosticMemoryHeapPeak(PGM_P) { return memoryLastWindow()->heapPeak; }
+static unsigned long diagnosticMemoryBlocks(PGM_P) { return memoryLastWindow()->blocks; }
+static unsigned long diagnosticMemoryFailures(PGM_P) { return memoryLastWindow()->failures; }
+static unsigned long diagnosticLogDropped(PGM_P) { return logLastWindowDroppedBytes(); }
+#if PROFILE_STAGES
+static unsigned long diagnosticPassRate(PGM_P) { return schedulerPassRate(); }
+static unsigned long diagnosticStageAvg(PGM_P task)
+{
+  unsigned long avgUs, worstUs;
+  schedulerStageWindow(task, &avgUs, &worstUs);
+  return avgUs;
+}
+static unsigned long diagnosticStageMax(PGM_P task)
+{
+  unsigned long avgUs, worstUs;
+  schedulerStageWindow(task, &avgUs, &worstUs);
+  return worstUs;
+}
+#endif
+
+static const char key_latency_p50[] PROGMEM = "latency_p50";
+static const char key_latency_p99[] PROGMEM = "latency_p99";
+static const char key_latency_max[] PROGMEM = "latency_max";
+static const char key_latency_count[] PROGMEM = "latency_count";
+
+static const char name_latency_p50[] PROGMEM = "Publish Latency p50";
+static const char name_latency_p99[] PROGMEM = "Publish Latency p99";
+static const char name_latency_max[] PROGMEM = "Publish Latency Max";
+static const char name_latency_count[] PROGMEM = "Transitions Published";
+
+static const char key_memory_free_min[] PROGMEM = "memory_free_min";
+static const char key_memory_largest_free[] PROGMEM = "memory_largest_free";
+static const char key_memory_fragmentation[] PROGMEM = "memory_fragmentation";
+static const char key_memory_heap_peak[] PROGMEM = "memory_heap_peak";
+static const char key_memory_blocks[] PROGMEM = "memory_blocks";
+static const char key_memory_failures[] PROGMEM = "memory_failures";
+
+static const char name_memory_free_min[] PROGMEM = "Free RAM Low Water";
+static const char name_memory_largest_free[] PROGMEM = "Largest Free Block";
+static const char name_memory_fragmentation[] PROGMEM = "Heap Fragmentation";
+static const char name_memory_heap_peak[] PROGMEM = "Heap Peak";
+static const char name_memory_blocks[] PROGMEM = "Heap Blocks";
+static const char name_memory_failures[] PROGMEM = "Failed Allocations";
+
+static const char key_log_dropped[] PROGMEM = "log_dropped";
+static const char name_log_dropped[] PROGMEM = "Log Bytes Dropped";
+
+#if PROFILE_STAGES
+// Stages are scheduler tasks, by the names guarduino.ino gives them.
+static const char task_pins[] PROGMEM = "pins";
+static const char task_mqtt[] PROGMEM = "mqtt";
+static const char task_publish[] PROGMEM = "publish";
+static const char task_temperature[] PROGMEM = "temperature";
+static const char task_network[] PROGMEM = "network";
+
+static const char key_loop_rate[] PROGMEM = "loop_rate";
+static const char key_pins_avg[] PROGMEM = "stage_pins_avg";
+static const char key_pins_max[] PROGMEM = "stage_pins_max";
+static const char key_mqtt_avg[] PROGMEM = "stage_mqtt_avg";
+static const char key_mqtt_max[] PROGMEM = "stage_mqtt_max";
+static const char key_publish_avg[] PROGMEM = "stage_publish_avg";
+static const char key_publish_max[] PROGMEM = "stage_publish_max";
+static const char key_temperature_avg[] PROGMEM = "stage_temperature_avg";
+static const char key_temperature_max[] PROGMEM = "stage_temperature_max";
+static const char key_network_avg[] PROGMEM = "stage_network_avg";
+static const char key_network_max[] PROGMEM = "stage_network_max";
+
+static const char name_loop_rate[] PROGMEM = "Loop Rate";
+static const char name_pins_avg[] PROGMEM = "Pin Scan Avg";
+static const char name_pins_max[] PROGMEM = "Pin Scan Max";
+static const char name_mqtt_avg[] PROGMEM = "MQTT Loop Avg";
+static const char name_mqtt_max[] PROGMEM = "MQTT Loop Max";
+static const char name_publish_avg[] PROGMEM = "Publish Avg";
+static const char name_publish_max[] PROGMEM = "Publish Max";
+static const char name_temperature_avg[] PROGMEM = "DS18x Read Avg";
+static const char name_temperature_max[] PROGMEM = "DS18x Read Max";
+static const char name_network_avg[] PROGMEM = "Reconnect Avg";
+static const char name_network_max[] PROGMEM = "Reconnect Max";
+
+static const char unit_rate[] PROGMEM = "passes/s";
+#endif
+
+static const char unit_ms[] PROGMEM = "ms";
+static const char unit_bytes[] PROGMEM = "B";
+static const char unit_percent[] PROGMEM = "%";
+
+static const diagnostic_t diagnostics[] PROGMEM = {
+    { key_latency_p50,          name_latency_p50,          unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticLatencyP50,          NULL },
+    { key_latency_p99,          name_latency_p99,          unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticLatencyP99,          NULL },
+    { key_latency_max,          name_latency_max,          unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticLatencyMax,          NULL },
+    { key_latency_count,        name_latency_count,        NULL,         DIAGNOSTIC_FORMAT_COUNT, diagnosticLatencyCount,        NULL },
+    { key_memory_free_min,      name_memory_free_min,      unit_bytes,   DIAGNOSTIC_FORMAT_BYTES, diagnosticMemoryFreeMin,       NULL },
+    { key_memory_largest_free,  name_memory_largest_free,  unit_bytes,   DIAGNOSTIC_FORMAT_BYTES, diagnosticMemoryLargestFree,   NULL },
+    { key_memory_fragmentation, name_memory_fragmentation, unit_percent, DIAGNOSTIC_FORMAT_COUNT, diagnosticMemoryFragmentation, NULL },
+    { key_memory_heap_peak,     name_memory_heap_peak,     unit_bytes,   DIAGNOSTIC_FORMAT_BYTES, diagnosticMemoryHeapPeak,      NULL },
+    { key_memory_blocks,        name_memory_blocks,        NULL,         DIAGNOSTIC_FORMAT_COUNT, diagnosticMemoryBlocks,        NULL },
+    { key_memory_failures,      name_memory_failures,      NULL,         DIAGNOSTIC_FORMAT_COUNT, diagnosticMemoryFailures,      NULL },
+    { key_log_dropped,          name_log_dropped,          unit_bytes,   DIAGNOSTIC_FORMAT_COUNT, diagnosticLogDropped,          NULL },
+#if PROFILE_STAGES
+    { key_loop_rate,            name_loop_rate,            unit_rate,    DIAGNOSTIC_FORMAT_COUNT, diagnosticPassRate,            NULL },
+    { key_pins_avg,             name_pins_avg,             unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageAvg,            task_pins },
+    { key_pins_max,             name_pins_max,             unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageMax,            task_pins },
+    { key_mqtt_avg,             name_mqtt_avg,             unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageAvg,            task_mqtt },
+    { key_mqtt_max,             name_mqtt_max,             unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageMax,            task_mqtt },
+    { key_publish_avg,          name_publish_avg,          unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageAvg,            task_publish },
+    { key_publish_max,          name_publish_max,          unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageMax,            task_publish },
+    { key_temperature_avg,      name_temperature_avg,      unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageAvg,            task_temperature },
+    { key_temperature_max,      name_temperature_max,      unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageMax,            task_temperature },
+    { key_network_avg,          name_network_avg,          unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageAvg,            task_network },
+    { key_network_max,          name_network_max,          unit_ms,      DIAGNOSTIC_FORMAT_MS,    diagnosticStageMax,            task_network },
+#endif
+};
+#define DIAGNOSTICS_COUNT (sizeof(diagnostics) / sizeof(diagnostics[0]))
+static_assert(DIAGNOSTICS_COUNT <= 32, "diagnosticsDiscovered has a bit per diagnostic");
+
+static uint32_t diagnosticsDiscovered = 0; // Bit N: diagnostics[N]'s discovery sent this MQTT session.
+
+
+/**
+ * End the measurement window, and queue the results. Call every DIAGNOSTICS_PERIOD.
+ */
+void diagnosticsRun(void)
+{
+  latencyEndWindow();
+  memoryEndWindow();
+  logEndWindow();
+#if PROFILE_STAGES
+  schedulerEndWindow();
+#endif
+  if(! pubsubClient.connected()) return;
+  mqttQueuePut(queuedDiagnosticsState, 0);
+}
+
+
+/**
+ * New MQTT session: queue every diagnostic's (retained) discovery, each followed by the state document.
+ */
+void resetDiagnosticsDiscovery(void)
+{
+  diagnosticsDiscovered = 0;
+  for(uint8_t i = 0; i < DIAGNOSTICS_COUNT; i++) mqttQueuePut(queuedDiagnosticsDiscovery, i);
+}
+
+
+/**
+ * diagnostics[i]'s value as text, e.g. "4.096" (DIAGNOSTIC_FORMAT_MS) or "12".
+ */
+static void diagnosticFormat(uint8_t i, char *destbuf, size_t destbufsize)
+{
+  unsigned long (*value)(PGM_P task) = (unsigned long (*)(PGM_P)) pgm_read_ptr(&diagnostics[i].value);
+  unsigned long v = value((PGM_P) pgm_read_ptr(&diagnostics[i].task));
+  if(pgm_read_byte(&diagnostics[i].format) == DIAGNOSTIC_FORMAT_MS) {
+    snprintf_P(destbuf, destbufsize, PSTR("%lu.%03lu"), v / 1000, v % 1000);
+  } else {
+    snprintf_P(destbuf, destbufsize, PSTR("%lu"), v);
+  }
+}
+
+
+/**
+ * Sends (or if "out" is NULL, just counts) one piece of the state document.
+ */
+static size_t diagnosticsPut(Print *out, const char *text, bool inFlash) {
+  if(! out) return inFlash ? strlen_P(text) : strlen(text);
+  if(inFlash) return out->print((const __FlashStringHelper *) text);
+  return out->print(text);
+}
+
+
+/**
+ * The state document: one "key":value per diagnostic. Counted first, then streamed. Every value is from a
+ * closed window, so it formats the same both times.
+ */
+static size_t diagnosticsDocument(Print *out)
+{
+  char value[24]; // Room for a 64-bit unsigned long, as on the host build.
+  size_t len = diagnosticsPut(out, PSTR("{"), true);
+  for(uint8_t i = 0; i < DIAGNOSTICS_COUNT; i++) {
+    diagnosticFormat(i, value, sizeof(value));
+    len += diagnosticsPut(out, (i == 0) ? PSTR("\"") : PSTR(",\""), true);
+    len += diagnosticsPut(out, (PGM_P) pgm_read_ptr(&diagnostics[i].key), true);
+    len += diagnosticsPut(out, PSTR("\":"), true);
+    len += diagnosticsPut(out, value, false);
+  }
+  len += diagnosticsPut(out, PSTR("}"), true);
+  return len;
+}
+
+
+/**
+ * mqttQueue's sender for the diagnostics state document.
+ */
+bool publishDiagnosticsState(void)
+{
+  size_t payloadsize = diagnosticsDocument(NULL);
+  if(! pubsubClient.beginPublish(getDeviceDiagnosticsTopic(), payloadsize, false)) return false;
+  diagnosticsDocument(&pubsubClient);
+  return pubsubClient.endPublish();
+}
+
+
+/**
+ * mqttQueue's sender for diagnostics[i]'s (retained) discovery.
+ * homeassistant/sensor/deviceNameHere/latency_p50/config
+ */
+bool publishDiagnosticsDiscovery(uint8_t i)
+{
+  if(i >= DIAGNOSTICS_COUNT) return true;
+  if(diagnosticsDiscovered & (1UL << i)) return true;
+
+  PGM_P key = (PGM_P) pgm_read_ptr(&diagnostics[i].key);
+  PGM_P unit = (PGM_P) pgm_read_ptr(&diagnostics[i].unit);
+  const char *deviceName = getDeviceName();
+  char discoveryTopic[80];
+  char plainName[48];
+  jsonWriter_t writer;
+
+  snprintf_P(discoveryTopic, sizeof(discoveryTopic), PSTR(HA_TOPIC_DISCOVERY "/sensor/%s/"), deviceName);
+  strlcat_P(discoveryTopic, key, sizeof(discoveryTopic));
+  strlcat_P(discoveryTopic, PSTR("/config"), sizeof(discoveryTopic));
+  snprintf_P(plainName, sizeof(plainName), PSTR("%s "), deviceName);
+  strlcat_P(plainName, (PGM_P) pgm_read_ptr(&diagnostics[i].name), sizeof(plainName));
+
+  jsonBegin(&writer);
+  jsonLiteral_P(&writer, PSTR("{\"name\":\""));
+  jsonString(&writer, plainName);
+
+  // https://www.home-assistant.io/integrations/sensor.mqtt/#unique_id
+  jsonLiteral_P(&writer, PSTR("\",\"unique_id\":\""));
+  jsonString(&writer, deviceName);
+  jsonLiteral_P(&writer, PSTR("_"));
+  jsonString_P(&writer, key);
+  jsonLiteral_P(&writer, PSTR("\",\"object_id\":\""));
+  jsonString(&writer, deviceName);
+  jsonLiteral_P(&writer, PSTR("_"));
+  jsonString_P(&writer, key);
+
+  // https://www.home-assistant.io/integrations/sensor.mqtt/#entity_category
+  jsonLiteral_P(&writer, PSTR("\",\"entity_category\":\"diagnostic\",\"state_class\":\"measurement\""));
+  if(pgm_read_byte(&diagnostics[i].format) == DIAGNOSTIC_FORMAT_MS) {
+    jsonLiteral_P(&writer, PSTR(",\"device_class\":\"duration\""));
+  } else if(pgm_read_byte(&diagnostics[i].format) == DIAGNOSTIC_FORMAT_BYTES) {
+    jsonLiteral_P(&writer, PSTR(",\"device_class\":\"data_size\""));
+  }
+  if(unit) {
+    jsonLiteral_P(&writer, PSTR(",\"unit_of_measurement\":\""));
+    jsonString_P(&writer, unit);
+    jsonLiteral_P(&writer, PSTR("\""));
+  }
+
+  jsonLiteral_P(&writer, PSTR(",\"state_topic\":\""));
+  jsonString(&writer, getDeviceDiagnosticsTopic());
+  jsonLiteral_P(&writer, PSTR("\",\"value_template\":\"{{ value_json."));
+  jsonString_P(&writer, key);
+  jsonLiteral_P(&writer, PSTR(" }}\",\"availability_topic\":\""));
+  jsonString(&writer, getDeviceAvailabilityTopic());
+  jsonLiteral_P(&writer, PSTR("\",\"device\":"));
+  jsonDeviceDiscovery(&writer);
+  jsonLiteral_P(&writer, PSTR("}"));
+
+  if(! jsonPublish(&writer, discoveryTopic, true)) return false;
+  diagnosticsDiscovered |= (1UL << i);
+
+  // The state document may have gone before HA had this entity.
+  mqttQueuePut(queuedDiagnosticsState, 0);
+  return true;
+}
@@ -2,11 +2,12 @@
 #include <OneWire.h>           // https://www.pjrc.com/teensy/td_libs_OneWire.html
 #include <DallasTemperature.h> // https://github.com/milesburton/Arduino-Temperature-Control-Library
 
-extern EthernetClient ethClient;
 extern PubSubClient pubsubClient;
-static char *getds18xStateTopic(ds18x_t thisds18x);
-static size_t mqttds18xDiscovery(ds18x_t thisds18x, size_t paramSize);
+static void getds18xStateTopic(char *destbuf, size_t destbufsize, ds18x_t thisds18x);
+static void ds18xName(char *destbuf, size_t destbufsize, ds18x_t thisds18x);
+static size_t mqttds18xDiscovery(ds18x_t thisds18x);
 static bool ds18xHasValidReading(ds18x_t thisds18x);
+static PGM_P ds18xIcon(ds18x_t thisds18x);
 
 /**
  * DS18x "1-Wire" Temperature Sensors
@@ -14,66 +15,195 @@ static bool ds18xHasValidReading(ds18x_t thisds18x);
 extern OneWire oneWire;
 DallasTemperature sensors(&oneWire);
 unsigned char allds18x_count = 0;
-ds18x_t *allds18x = NULL;
+ds18x_t allds18x[DS18X_MAX]; // Fixed table, keyed by ROM address. Entries stay put (with their history) across rescans.
 
 
-void setupDS18Sensors(void)
+/*
+ * readDS18xSensors() is a small state machine, so that no single call blocks for a whole conversion:
+ *   ds18xIdle       - waiting for the next period. Then: rescan (if due), broadcast one Convert T to every probe.
+ *   ds18xRescanning - one 1-Wire ROM search step per call, merging arrivals/departures into allds18x.
+ *   ds18xConverting - waiting (without blocking) for the conversion time of the current resolution.
+ *   ds18xReading    - reading one probe's scratchpad per call, until all are read.
+ */
+enum ds18xPipelineState
 {
-    sensors.begin(); // Dallas One-Wire
-}
+    ds18xIdle = 0,
+    ds18xRescanning,
+    ds18xConverting,
+    ds18xReading
+};
+static ds18xPipelineState ds18xState = ds18xIdle;
+static unsigned long ds18xStartedAt = 0;
+static bool ds18xEverStarted = false;
+static unsigned char ds18xReadIndex = 0;
+static unsigned long ds18xWorstBlockUs = 0; // Longest any one readDS18xSensors() call has held up loop().
+static unsigned long ds18xRescannedAt = 0;
+static uint16_t ds18xSeen = 0; // Bit N set = allds18x[N] answered the rescan in progress.
 
 
-ds18x_t *readDS18xSensors(void)
+/*
+ * Index of "address" in allds18x, or -1.
+ */
+static int ds18xFind(const uint8_t *address)
 {
-    unsigned char newds18x_count;
-    ds18x_t *newds18x = NULL;
+    for (int i = 0; i < allds18x_count; i++)
+    {
+        if (memcmp(allds18x[i].address, address, sizeof(DeviceAddress)) == 0) return i;
+    }
+    return -1;
+}
 
-    newds18x_count = sensors.getDS18Count(); // global variable
-    if (newds18x_count > 0)
+
+/*
+ * One step of a rescan: find the next probe on the bus, adding it to allds18x if it's new.
+ * Returns false once the search has run off the end of the bus. Probes not seen by then have departed,
+ * and are removed (the last entry moves into their slot, and its queued messages with it).
+ */
+static bool ds18xRescanStep(void)
+{
+    DeviceAddress address;
+    if (oneWire.search(address))
     {
-        newds18x = (ds18x_t *) malloc(newds18x_count * sizeof(ds18x_t));
-        memset(newds18x, '\0', newds18x_count);
-        for (int i = 0; i < newds18x_count; i++)
+        if (OneWire::crc8(address, 7) != address[7]) return true;
+        if (!sensors.validFamily(address)) return true;
+
+        int index = ds18xFind(address);
+        if ((index < 0) && (allds18x_count < DS18X_MAX))
         {
-            ds18x_t *thisds18x = &newds18x[i];
+            index = allds18x_count++;
+            ds18x_t *thisds18x = &allds18x[index];
+            memset(thisds18x, '\0', sizeof(ds18x_t));
+            memcpy(thisds18x->address, address, sizeof(DeviceAddress));
+            ds18xName(thisds18x->name, sizeof(thisds18x->name), *thisds18x);
+            thisds18x->pin1 = ONE_WIRE_GPIO;
             thisds18x->temp_f = BOGUS_TEMPERATURE;
             thisds18x->temp_f_old = BOGUS_TEMPERATURE;
             thisds18x->temp_f_oldest = BOGUS_TEMPERATURE;
+            thisds18x->temp_f_sent = BOGUS_TEMPERATURE;
+            LOG(LOG_INFO).print(F("DS18x arrived, now "));
+            LOG(LOG_INFO).println(allds18x_count);
+        }
+        if (index >= 0) ds18xSeen |= (1 << index);
+        return true;
+    }
+
+    // End of the bus. Remove whoever didn't answer; walk backwards so a moved entry has already been checked.
+    for (int i = allds18x_count - 1; i >= 0; i--)
+    {
+        if (ds18xSeen & (1 << i)) continue;
+        allds18x_count--;
+        mqttQueueRemove(queuedds18xState, i);
+        mqttQueueRemove(queuedds18xDiscovery, i);
+        if (i != allds18x_count)
+        {
+            allds18x[i] = allds18x[allds18x_count];
+            if (ds18xSeen & (1 << allds18x_count)) ds18xSeen |= (1 << i);
+            mqttQueueMove(queuedds18xState, allds18x_count, i);
+            mqttQueueMove(queuedds18xDiscovery, allds18x_count, i);
+        }
+        LOG(LOG_INFO).print(F("DS18x departed, now "));
+        LOG(LOG_INFO).println(allds18x_count);
+    }
+    ds18xRescannedAt = millis();
+    return false;
+}
+
+
+static void ds18xRescanBegin(void)
+{
+    oneWire.reset_search();
+    ds18xSeen = 0;
+}
+
+
+/*
+ * Build (or refresh) allds18x with a full, blocking rescan. Existing entries and their history are kept.
+ */
+void setupDS18Sensors(void)
+{
+    sensors.begin(); // Dallas One-Wire
+    sensors.setWaitForConversion(false); // requestTemperatures() returns at once; readDS18xSensors() waits.
+    ds18xRescanBegin();
+    while (ds18xRescanStep());
+    ds18xState = ds18xIdle;
+}
 
-            if (!sensors.getAddress(thisds18x->address, i)) continue;
-            if (!sensors.requestTemperaturesByAddress(thisds18x->address)) continue;
 
+/*
+ * Advance the DS18x pipeline by one non-blocking step. Call often; every scheduler pass is fine.
+ * A new round (enumerate, Convert T, read each probe) starts every "periodMs".
+ * Returns true when the round's last scratchpad has just been read, i.e. allds18x holds a fresh set of readings.
+ */
+bool readDS18xSensors(unsigned long periodMs)
+{
+    bool roundDone = false;
+    unsigned long calledAt = micros();
+
+    switch (ds18xState)
+    {
+    case ds18xIdle:
+        if (ds18xEverStarted && ((millis() - ds18xStartedAt) < periodMs)) break;
+        ds18xStartedAt = millis();
+        ds18xEverStarted = true;
+        if ((millis() - ds18xRescannedAt) >= DS18X_RESCAN_PERIOD)
+        {
+            ds18xRescanBegin();
+            ds18xState = ds18xRescanning;
+            break;
+        }
+        sensors.requestTemperatures(); // One broadcast Convert T for every probe on the bus.
+        ds18xState = ds18xConverting;
+        break;
+
+    case ds18xRescanning:
+        if (ds18xRescanStep()) break;
+        sensors.requestTemperatures();
+        ds18xStartedAt = millis();
+        ds18xState = ds18xConverting;
+        break;
+
+    case ds18xConverting:
+        if ((millis() - ds18xStartedAt) < (unsigned long) sensors.millisToWaitForConversion(sensors.getResolution())) break;
+        ds18xReadIndex = 0;
+        ds18xState = ds18xReading;
+        break;
+
+    case ds18xReading:
+        if (ds18xReadIndex < allds18x_count)
+        {
+            ds18x_t *thisds18x = &allds18x[ds18xReadIndex++];
             float tempF = sensors.getTempF(thisds18x->address);
+            if (tempF == (float) DEVICE_DISCONNECTED_F) tempF = BOGUS_TEMPERATURE;
+            thisds18x->temp_f_oldest = thisds18x->temp_f_old;
+            thisds18x->temp_f_old = thisds18x->temp_f;
             thisds18x->temp_f = tempF;
-            thisds18x->temp_f_old = BOGUS_TEMPERATURE;
-            thisds18x->temp_f_oldest = BOGUS_TEMPERATURE;
-            Serial.print("Read tempF: ");
-            Serial.println(thisds18x->temp_f);
-
-            // What temperature did we last read for this same device?
-            // This is important for filtering out 'noise' readings.
-            
-            for (int j = 0; j < allds18x_count; j++)
-            {
-                ds18x_t *oldds18x = &allds18x[j];
-                if (memcmp(thisds18x->address, oldds18x->address, sizeof(DeviceAddress)) == 0)
-                {
-                    thisds18x->temp_f = tempF;
-                    thisds18x->temp_f_old = oldds18x->temp_f;
-                    thisds18x->temp_f_oldest = oldds18x->temp_f_old;
-                }
-            }
+            LOG(LOG_DEBUG).print(F("Read tempF: "));
+            LOG(LOG_DEBUG).println(thisds18x->temp_f);
         }
+        if (ds18xReadIndex >= allds18x_count)
+        {
+            ds18xState = ds18xIdle;
+            roundDone = true;
+        }
+        break;
     }
 
-    if (allds18x != NULL)
-    { // global variable
-        free(allds18x);
-        allds18x = NULL;
-    }
-    allds18x = newds18x;
-    allds18x_count = newds18x_count;
-    return allds18x;
+    unsigned long blockedUs = micros() - calledAt;
+    if (blockedUs > ds18xWorstBlockUs) ds18xWorstBlockUs = blockedUs;
+    return roundDone;
+}
+
+
+/*
+ * Serial report of the longest time one readDS18xSensors() call has held up loop().
+ */
+void ds18xPrintStats(void)
+{
+    Serial.print(F("DS18x probes="));
+    Serial.print(allds18x_count);
+    Serial.print(F(" worst block="));
+    Serial.print(ds18xWorstBlockUs);
+    Serial.println(F("us"));
 }
 
 /*
@@ -90,72 +220,152 @@ static void ds18xName(char *destbuf, size_t destbufsize, ds18x_t thisds18x)
         memset(thisbyte, '\0', sizeof(thisbyte));
         if (thisds18x.address[i] < 16)
         {
-            strlcat(thisbyte, "00", sizeof(thisbyte));
+            strlcat_P(thisbyte, PSTR("00"), sizeof(thisbyte));
         }
         else
         {
-            sprintf(thisbyte, "%02x", thisds18x.address[i]);
+            sprintf_P(thisbyte, PSTR("%02x"), thisds18x.address[i]);
         }
-        strlcat(destbuf, thisbyte, (destbufsize - 1));
+        strlcat(destbuf, thisbyte, destbufsize);
     }
 }
 
 /*
- * Sends MQTT messages for each ds18x sensor we know about.
- * TODO: Include an attribute sensors.isParasitePowerMode()
+ * Has this probe moved TEMPERATURE_DELTA_F since we last sent it, or been quiet for HEARTBEAT_TEMPERATURE?
+ */
+static bool ds18xSendDue(ds18x_t thisds18x, unsigned long now)
+{
+    if (abs(thisds18x.temp_f - thisds18x.temp_f_sent) >= TEMPERATURE_DELTA_F) return true;
+    return (now - thisds18x.sentAt) >= HEARTBEAT_TEMPERATURE;
+}
+
+/*
+ * Queues MQTT messages (see mqttQueue.cpp) for each ds18x sensor we know about, if it has moved TEMPERATURE_DELTA_F
+ * since we last sent it, or HEARTBEAT_TEMPERATURE has gone by.
  */
 void mqttds18xSendData(ds18x_t *allds18x, unsigned int ds18xcount)
 {
-    Serial.println("mqttds18xSendData()");
+    LOG(LOG_DEBUG).println(F("mqttds18xSendData()"));
 
-    for (int i = 0; i < ds18xcount; i++)
+    unsigned long now = millis();
+    for (unsigned int i = 0; i < ds18xcount; i++)
     {
-        ds18x_t *thisds18x = &allds18x[i];
-
-        if(ds18xHasValidReading(*thisds18x) == false) continue;
-
-        // Arduino's "sprintf()" doesn't handle floats, hence the silliness here.
-        float tempF = thisds18x->temp_f;
-        signed int intval = (signed int) tempF;
-        unsigned int fractionval = abs(int(100 * (tempF - int(tempF)))); // https://forum.arduino.cc/t/sprintf-a-float-number/1013193
-        //unsigned int fractionval = 0;
-        char tempString[8];
-        memset(tempString, '\0', sizeof(tempString));
-        snprintf(tempString, sizeof(tempString) - 1, "%i.%02d", intval, fractionval);
-
-        // Send MQTT DATA here.
-        char *ds18xStateTopic = getds18xStateTopic(*thisds18x);
-        if (ds18xStateTopic)
-        {
-            Serial.print("SEND ");
-            Serial.print(ds18xStateTopic);
-            Serial.print(" ");
-            Serial.print(tempString);
-            Serial.println("\n");
-            pubsubClient.publish(ds18xStateTopic, tempString, false);
-            ethClient.flush();
-            free(ds18xStateTopic);
-            ds18xStateTopic = NULL;
+        if(ds18xHasValidReading(allds18x[i]) == false) continue;
+        if(! ds18xSendDue(allds18x[i], now)) continue;
+        mqttQueuePut(queuedds18xState, i);
+    }
+}
+
+/*
+ * mqttQueue's sender for allds18x[index]'s temperature (DISCOVERY_ONCE 0: discovery, then temperature).
+ * Sends the latest reading, whatever it was when queued.
+ * TODO: Include an attribute sensors.isParasitePowerMode()
+ */
+bool publishds18xState(uint8_t index)
+{
+    if (index >= allds18x_count) return true; // Gone since it was queued.
+    ds18x_t *thisds18x = &allds18x[index];
+    if(ds18xHasValidReading(*thisds18x) == false) return true;
+
+#if ! DISCOVERY_ONCE
+    mqttds18xDiscovery(*thisds18x);
+#endif
+
+    // Arduino's "sprintf()" doesn't handle floats, hence the silliness here.
+    float tempF = thisds18x->temp_f;
+    int16_t intval = (int16_t) tempF;
+    uint8_t fractionval = abs(int(100 * (tempF - int(tempF)))); // https://forum.arduino.cc/t/sprintf-a-float-number/1013193
+    //unsigned int fractionval = 0;
+    char tempString[12]; // "-32768.255" at worst, so a low reading isn't cut short.
+    memset(tempString, '\0', sizeof(tempString));
+    snprintf_P(tempString, sizeof(tempString) - 1, PSTR("%i.%02d"), intval, fractionval);
+#if DISCOVERY_ONCE
+    // e.g. {"temperature":70.50,"icon":"mdi:thermometer"}. Discovery's value_template picks out "temperature".
+    char statePayload[64];
+    snprintf_P(statePayload, sizeof(statePayload), PSTR("{\"temperature\":%s,\"icon\":\""), tempString);
+    strlcat_P(statePayload, ds18xIcon(*thisds18x), sizeof(statePayload));
+    strlcat_P(statePayload, PSTR("\"}"), sizeof(statePayload));
+#else
+    const char *statePayload = tempString;
+#endif
+
+    // Send MQTT DATA here.
+    char ds18xStateTopic[80];
+    getds18xStateTopic(ds18xStateTopic, sizeof(ds18xStateTopic), *thisds18x);
+    if(LOG_ENABLED(LOG_DEBUG)) {
+        Log.print(F("SEND "));
+        Log.print(ds18xStateTopic);
+        if(LOG_ENABLED(LOG_VERBOSE)) {
+            Log.print(F(" "));
+            Log.print(statePayload);
         }
+        Log.println();
     }
+    if(! pubsubClient.publish(ds18xStateTopic, statePayload, false)) return false;
+    thisds18x->temp_f_sent = tempF;
+    thisds18x->sentAt = millis();
+    return true;
 }
 
 /**
  * For each ds18x found on the 1-Wire bus
-  Send Discovery to HomeAssistant MQTT.
+  Queue Discovery for HomeAssistant MQTT. DISCOVERY_ONCE 0 sends it with every temperature instead.
   // https://www.home-assistant.io/integrations/mqtt/#mqtt-discovery
   // https://www.home-assistant.io/integrations/sensor.mqtt/
   // https://community.home-assistant.io/t/mqtt-auto-discovery-and-json-payload/409459
 */
 void mqttds18xSendDiscovery(ds18x_t *allds18x, unsigned int ds18xcount)
 {
-    Serial.println("mqttds18xSendDiscovery()");
+#if DISCOVERY_ONCE
+    LOG(LOG_DEBUG).println(F("mqttds18xSendDiscovery()"));
+
+    for (unsigned int i = 0; i < ds18xcount; i++)
+    {
+        if(allds18x[i].discovered) continue; // Retained; once per MQTT session is enough.
+        if(ds18xHasValidReading(allds18x[i]) == false) continue;
+        mqttQueuePut(queuedds18xDiscovery, i);
+    }
+#endif
+}
+
+/*
+ * mqttQueue's sender for allds18x[index]'s (retained) discovery. DISCOVERY_ONCE only.
+ */
+bool publishds18xDiscovery(uint8_t index)
+{
+    if (index >= allds18x_count) return true;
+    ds18x_t *thisds18x = &allds18x[index];
+    if(thisds18x->discovered) return true;
+    if(ds18xHasValidReading(*thisds18x) == false) return true;
+    if(! mqttds18xDiscovery(*thisds18x)) return false;
+    thisds18x->discovered = true;
+
+    // Temperatures go out ahead of discovery; one sent before HA had the entity went nowhere, so send it again.
+    mqttQueuePut(queuedds18xState, index);
+    return true;
+}
 
-    for (int i = 0; i < ds18xcount; i++)
+
+/**
+ * Forget which probes have had discovery sent. Call on each new MQTT session.
+ */
+void resetds18xDiscovery(ds18x_t *allds18x, unsigned int ds18xcount)
+{
+    for (unsigned int i = 0; i < ds18xcount; i++)
     {
-        ds18x_t *thisds18x = &allds18x[i];
-        if(ds18xHasValidReading(*thisds18x) == false) continue;
-        mqttds18xDiscovery(*thisds18x, 0);
+        allds18x[i].discovered = false;
+    }
+}
+
+
+/**
+ * Send every probe's next valid reading, whether or not it has moved. See resetSensorHeartbeats().
+ */
+void resetds18xHeartbeats(ds18x_t *allds18x, unsigned int ds18xcount)
+{
+    for (unsigned int i = 0; i < ds18xcount; i++)
+    {
+        allds18x[i].temp_f_sent = BOGUS_TEMPERATURE;
     }
 }
 
@@ -179,18 +389,14 @@ bool ds18xHasValidReading(ds18x_t thisds18x)
     if (abs(thisds18x.temp_f - thisds18x.temp_f_oldest) > 20) returnval = false;
     if (abs(thisds18x.temp_f_old - thisds18x.temp_f_oldest) > 20) returnval = false;
 
-    if(returnval == false) {
-        
-        char sensorName[24];
-        ds18xName(sensorName, sizeof(sensorName), thisds18x);
-        Serial.print(sensorName);
-        Serial.print(" Invalid Read: ");
-        Serial.print(thisds18x.temp_f);
-        Serial.print(" ");
-        Serial.print(thisds18x.temp_f_old);
-        Serial.print(" ");
-        Serial.print(thisds18x.temp_f_oldest);
-        Serial.println("");
+    if((returnval == false) && LOG_ENABLED(LOG_WARN)) {
+        Log.print(thisds18x.name);
+        Log.print(F(" Invalid Read: "));
+        Log.print(thisds18x.temp_f);
+        Log.print(F(" "));
+        Log.print(thisds18x.temp_f_old);
+        Log.print(F(" "));
+        Log.println(thisds18x.temp_f_oldest);
     }
 
     return returnval;
@@ -198,36 +404,33 @@ bool ds18xHasValidReading(ds18x_t thisds18x)
 
 
 /*
- * Returns malloc'ed string to the tune of ...
+ * Icon to match this probe's temperature. In flash.
+ * https://pictogrammers.com/library/mdi/
+ */
+static PGM_P ds18xIcon(ds18x_t thisds18x)
+{
+    if (ds18xHasValidReading(thisds18x) == false) return PSTR("mdi:thermometer-alert");
+    if (thisds18x.temp_f <= 0) return PSTR("mdi:thermometer-minus");
+    if (thisds18x.temp_f < 30) return PSTR("mdi:thermometer-low");
+    if (thisds18x.temp_f > 100) return PSTR("mdi:thermometer-plus");
+    if (thisds18x.temp_f > 85) return PSTR("mdi:thermometer-high");
+    return PSTR("mdi:thermometer");
+}
+
+
+/*
+ * Populates destbuf with our state topic, to the tune of ...
  *
  * Examples:
  * aha/sensor/deviceName/ds18xaddressname/state
  */
-static char *getds18xStateTopic(ds18x_t thisds18x)
+static void getds18xStateTopic(char *destbuf, size_t destbufsize, ds18x_t thisds18x)
 {
-    char deviceName[24];
-    getDeviceName(deviceName, sizeof(deviceName));
-
-    char sensorName[24];
-    ds18xName(sensorName, sizeof(sensorName), thisds18x);
-
-    size_t topicsize = 0;
-    topicsize += strlen(HA_TOPIC_DATA);
-    topicsize += strlen("/sensor/");
-    topicsize += strlen(deviceName);
-    topicsize += strlen("/");
-    topicsize += strlen(sensorName);
-    topicsize += strlen("/state");
-    topicsize += 4; // Safety margin.
-
-    char *topic = (char *)malloc(topicsize * sizeof(char));
-    if (topic)
-    {
-        memset(topic, '\0', topicsize);
-        snprintf(topic, topicsize - 1, "%s/sensor/%s/%s/state", HA_TOPIC_DATA, deviceName, sensorName);
-    }
-
-    return topic;
+    strlcpy_P(destbuf, PSTR(HA_TOPIC_DATA "/sensor/"), destbufsize);
+    strlcat(destbuf, getDeviceName(), destbufsize);
+    strlcat_P(destbuf, PSTR("/"), destbufsize);
+    strlcat(destbuf, thisds18x.name, destbufsize);
+    strlcat_P(destbuf, PSTR("/state"), destbufsize);
 }
 
 /**
@@ -238,139 +441,81 @@ static char *getds18xStateTopic(ds18x_t thisds18x)
  * Examples:
  * homeassistant/sensor/ds18xnamehere/config
  */
-static char *getds18xDiscoveryTopic(ds18x_t thisds18x)
+static void getds18xDiscoveryTopic(char *destbuf, size_t destbufsize, ds18x_t thisds18x)
 {
-    char sensorName[24];
-    ds18xName(sensorName, sizeof(sensorName), thisds18x);
-
-    size_t topicsize = 0;
-    topicsize += strlen(HA_TOPIC_DISCOVERY);
-    topicsize += strlen("/sensor/");
-    topicsize += strlen(sensorName);
-    topicsize += strlen("/config");
-    topicsize += 4; // Safety buffer
-    char *topic = (char *)malloc(topicsize * sizeof(char));
-    memset(topic, '\0', topicsize);
-    snprintf(topic, topicsize, "%s/sensor/%s/config", HA_TOPIC_DISCOVERY, sensorName);
-
-    return topic;
+    strlcpy_P(destbuf, PSTR(HA_TOPIC_DISCOVERY "/sensor/"), destbufsize);
+    strlcat(destbuf, thisds18x.name, destbufsize);
+    strlcat_P(destbuf, PSTR("/config"), destbufsize);
 }
 
 /*
  * {"device_class": "temperature", "name": "Temperature", "state_topic": "homeassistant/sensor/sensorBedroom/state", "unit_of_measurement": "°C", "value_template": "{{ value_json.temperature}}","unique_id": "temp01ae", "device": {"identifiers": ["bedroom01ae"], "name": "Bedroom" }}
+ * Laid out once, then sized and sent in one pass; see jsonWriter.cpp.
  */
-static size_t mqttds18xDiscovery(ds18x_t thisds18x, size_t paramSize = 0)
+static size_t mqttds18xDiscovery(ds18x_t thisds18x)
 {
-    char buffer[64];
-    size_t payloadsize = 0;
+    char ds18xDiscoveryTopic[64];
+    char sensorStateTopic[80];
+    jsonWriter_t writer;
 
-    Serial.println("");
-    Serial.print("mqttds18xDiscovery paramSize=");
-    Serial.print(paramSize);
-    Serial.print("  ");
+    getds18xDiscoveryTopic(ds18xDiscoveryTopic, sizeof(ds18xDiscoveryTopic), thisds18x);
+    getds18xStateTopic(sensorStateTopic, sizeof(sensorStateTopic), thisds18x);
 
-    char deviceName[24];
-    getDeviceName(deviceName, sizeof(deviceName));
-
-    char sensorName[32];
-    ds18xName(sensorName, sizeof(sensorName), thisds18x);
-
-    if (paramSize > 0)
-    {
-        // Tell MQTT how many bytes are about to come for this discovery topic.
-        char *ds18xDiscoveryTopic = getds18xDiscoveryTopic(thisds18x);
-        if (!ds18xDiscoveryTopic)
-            return 0;
-        pubsubClient.beginPublish(ds18xDiscoveryTopic, paramSize, false); // Here, we must give our pre-computed "paramsize"
-        free(ds18xDiscoveryTopic);
-        ds18xDiscoveryTopic = NULL;
-    }
-
-    // Opening Bracket
-    payloadsize += mqttsend((paramSize > 0), "{");
+    jsonBegin(&writer);
 
     // (Entity) Name
     // No loading comma on first key:value pair
-    payloadsize += mqttsend((paramSize > 0), "\"name\":\"");
-    payloadsize += mqttsend((paramSize > 0), sensorName);
-    payloadsize += mqttsend((paramSize > 0), "\"");
-
-    // Device Class
-    payloadsize += mqttsend((paramSize > 0), ", \"device_class\":\"temperature\"");
-
-    // Force Update
-    payloadsize += mqttsend((paramSize > 0), ", \"force_update\":true");
-
-    // Display to 2 decimals
-    payloadsize += mqttsend((paramSize > 0), ", \"suggested_display_precision\":2");
+    jsonLiteral_P(&writer, PSTR("{\"name\":\""));
+    jsonString(&writer, thisds18x.name);
 
+    // Device Class, Force Update, Display to 2 decimals, Expire After 5 minutes
     // TODO: unit_of_measurement 
-
-    // Expire After 5 minutes
-    payloadsize += mqttsend((paramSize > 0), ", \"expire_after\":300");
+    jsonLiteral_P(&writer, PSTR("\", \"device_class\":\"temperature\", \"force_update\":true, \"suggested_display_precision\":2, \"expire_after\":300"));
 
     // State Topic
-    char *sensorStateTopic = getds18xStateTopic(thisds18x);
-    if (sensorStateTopic)
-    {
-        payloadsize += mqttsend((paramSize > 0), ",");
-        payloadsize += mqttsend((paramSize > 0), "\"state_topic\":\"");
-        payloadsize += mqttsend((paramSize > 0), sensorStateTopic);
-        payloadsize += mqttsend((paramSize > 0), "\"");
-        free(sensorStateTopic);
-        sensorStateTopic = NULL;
-    }
-
+    jsonLiteral_P(&writer, PSTR(",\"state_topic\":\""));
+    jsonString(&writer, sensorStateTopic);
+    jsonLiteral_P(&writer, PSTR("\""));
+
+    // Availability Topic. Our last will; expire_after still catches a probe which stops answering while we're up.
+    jsonLiteral_P(&writer, PSTR(",\"availability_topic\":\""));
+    jsonString(&writer, getDeviceAvailabilityTopic());
+    jsonLiteral_P(&writer, PSTR("\""));
+
+#if DISCOVERY_ONCE
+    // State is JSON; the icon rides along as a state attribute rather than in a fresh discovery.
+    jsonLiteral_P(&writer, PSTR(", \"value_template\":\"{{ value_json.temperature }}\", \"json_attributes_topic\":\""));
+    jsonString(&writer, sensorStateTopic);
+    jsonLiteral_P(&writer, PSTR("\""));
+#else
     // Icon
-    // https://pictogrammers.com/library/mdi/
-    if(ds18xHasValidReading(thisds18x) == false) {
-    	payloadsize += mqttsend((paramSize > 0), ", \"icon\":\"mdi:thermometer-alert\"");
-    } else {
-        if(thisds18x.temp_f <= 0) {
-            payloadsize += mqttsend((paramSize > 0), ", \"icon\":\"mdi:thermometer-minus\"");
-        } else if(thisds18x.temp_f < 30) {
-            payloadsize += mqttsend((paramSize > 0), ", \"icon\":\"mdi:thermometer-low\"");
-        } else if (thisds18x.temp_f > 100) {
-            payloadsize += mqttsend((paramSize > 0), ", \"icon\":\"mdi:thermometer-plus\"");
-        } else if (thisds18x.temp_f > 85) {
-            payloadsize += mqttsend((paramSize > 0), ", \"icon\":\"mdi:thermometer-high\"");
-        } else {
-            payloadsize += mqttsend((paramSize > 0), ", \"icon\":\"mdi:thermometer\"");
-        }
-    	
-    }
+    jsonLiteral_P(&writer, PSTR(", \"icon\":\""));
+    jsonString_P(&writer, ds18xIcon(thisds18x));
+    jsonLiteral_P(&writer, PSTR("\""));
+#endif
 
     // Unique ID
-    payloadsize += mqttsend((paramSize > 0), ",");
-    payloadsize += mqttsend((paramSize > 0), "\"unique_id\":\"");
-    payloadsize += mqttsend((paramSize > 0), sensorName);
-    payloadsize += mqttsend((paramSize > 0), "\"");
+    jsonLiteral_P(&writer, PSTR(",\"unique_id\":\""));
+    jsonString(&writer, thisds18x.name);
 
     // Device (Json sub-object)
-    char *devicePayload = getDeviceDiscoveryPayload();
-    if (devicePayload)
-    {
-        payloadsize += mqttsend((paramSize > 0), ",");
-        payloadsize += mqttsend((paramSize > 0), "\"device\": ");
-        payloadsize += mqttsend((paramSize > 0), devicePayload);
-        free(devicePayload);
-        devicePayload = NULL;
-    }
+    jsonLiteral_P(&writer, PSTR("\",\"device\": "));
+    jsonDeviceDiscovery(&writer);
 
     // JSON closing paretheses
-    payloadsize += mqttsend((paramSize > 0), "}");
-
-    if (paramSize == 0)
-    {
-        // Now that we know our total payload size, call ourselves again with that size.
-        // That second "go-around", we'll actually talk to MQTT.
-        return mqttds18xDiscovery(thisds18x, payloadsize);
-    }
-    else
-    {
-        pubsubClient.endPublish();
-        Serial.println("");
+    jsonLiteral_P(&writer, PSTR("}"));
+
+    size_t payloadsize = jsonLength(&writer);
+    if(LOG_ENABLED(LOG_DEBUG)) {
+        Log.print(F("mqttds18xDiscovery payloadsize="));
+        Log.print(payloadsize);
+        if(LOG_ENABLED(LOG_VERBOSE)) {
+            Log.print(F("  "));
+            jsonWrite(&writer, Log);
+        }
+        Log.println();
     }
 
+    if (!jsonPublish(&writer, ds18xDiscoveryTopic, DISCOVERY_ONCE)) return 0;
     return payloadsize;
 }
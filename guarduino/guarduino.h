@@ -7,8 +7,58 @@
 
 #define HA_TOPIC_DATA "aha"                // Mosquitto Data topic. You probably don't need to change this.
 #define HA_TOPIC_DISCOVERY "homeassistant" // Mosquitto Discovery topic. You probably don't need to change this.
+#define HA_STATUS_TOPIC HA_TOPIC_DISCOVERY "/status" // HA's birth/last will. https://www.home-assistant.io/integrations/mqtt/#birth-and-last-will-messages
 #define SOFTWARE_VERSION "2025.11.28.2"
 #define ONE_WIRE_GPIO 8 // Don't change this unless you have a good reason.
+#define PINCAPTURE_PCINT 0 // 1 = also capture pin changes by interrupt, so short pulses between loop() passes aren't missed.
+#define PINCAPTURE_RING_SIZE 64 // Captured pin changes waiting for loop(). Must be a power of two.
+#define MQTT_BUFFER_SIZE (MQTT_MAX_PACKET_SIZE + 512) // PubSubClient's buffer, for publish() and incoming messages. Discovery streams and doesn't need it.
+#define DEBOUNCE_TICK_MS 5 // Sensor inputs are sampled for debouncing this often. debounce_ms is rounded up to a whole number of these.
+#define DEBOUNCE_DEFAULT_MS 20 // For input sensors without debounce_ms in CONFIG.INI.
+#define DEBOUNCE_FAULT_SAMPLES 10 // Ticks a fault/offline state must hold before it's reported (debounced sensors only).
+#define DISCOVERY_ONCE 1 // 1 = retained discovery once per MQTT session, icons sent in a JSON state payload. 0 = re-send discovery (with the icon) before every state.
+#define AGGREGATE_STATE 0 // 1 = every sensor's state in one JSON message on the device's state topic, instead of one message per sensor. Needs DISCOVERY_ONCE.
+#if AGGREGATE_STATE && ! DISCOVERY_ONCE
+#error "AGGREGATE_STATE needs DISCOVERY_ONCE"
+#endif
+// Unchanged states are re-published this often, per class of sensor. Whether we're alive at all comes from the
+// availability topic (our MQTT last will), so these only need to catch HA up on anything it missed.
+#define HEARTBEAT_CONTACT (15UL * 60 * 1000)    // Doors, garage doors, windows.
+#define HEARTBEAT_MOTION (15UL * 60 * 1000)     // Motion sensors and lasers.
+#define HEARTBEAT_SWITCH (5UL * 60 * 1000)      // Switches.
+#define HEARTBEAT_TEMPERATURE (2UL * 60 * 1000) // DS18x probes. Keep it under their discovery's expire_after (300s).
+#define NETWORK_BACKOFF_MIN_MS 250 // First retry of a failed DHCP or MQTT connect. Doubles each failure...
+#define NETWORK_BACKOFF_MAX_MS (4UL * 1000) // ...up to this.
+#define NETWORK_LEASE_BACKOFF_MAX_MS (60UL * 1000) // ...or this, for DHCP: each attempt blocks for NETWORK_DHCP_TIMEOUT_MS.
+#define NETWORK_DHCP_TIMEOUT_MS 4000 // Longest one DHCP attempt blocks for.
+#define NETWORK_DHCP_RESPONSE_MS 1000
+#define NETWORK_CONNECT_TIMEOUT_MS 250 // Longest the TCP connect to the broker blocks for.
+#define NETWORK_MQTT_TIMEOUT_S 2 // Longest we wait on the broker's CONNACK (PubSubClient's socket timeout).
+#define NETWORK_MAINTAIN_MS 1000 // How often to let the DHCP lease renew, if it's due.
+#define NETWORK_LINK_POLL_MS 500 // How often to look for the cable coming back.
+#define MQTT_QUEUE_TX_ROOM 1024 // Outbound messages wait in mqttQueue.cpp until the Ethernet socket has this much TX buffer free.
+#define MQTT_QUEUE_BUDGET_US 5000 // Longest one mqttQueueRun() keeps sending for, once it has sent something.
+#define MQTT_QUEUE_MAX_TRIES 3 // A queued message which fails to publish this many times in a row is dropped.
+#define TEMPERATURE_DELTA_F 0.2 // A DS18x reading at least this far from the last one sent is sent straight away.
+#define DIAGNOSTICS_PERIOD (60UL * 1000) // Diagnostic entities (publish latency, ...) are measured over, and published every, this long.
+#define PROFILE_STAGES 1 // 1 = time each scheduler task (stage of loop()), for 't' on Serial and diagnostic entities. 0 = no timing at all.
+#ifndef CYCLE_MARKS
+#define CYCLE_MARKS 0 // 1 = mark entry to and exit from the hot paths on GPIOR0/GPIOR1, for cycle counts under simavr (make simavr-bench sets it).
+#endif
+#define SDCARD_CS_PIN 4 // SD card chip select. Common values are 4 or 10 depending on shield/module.
+#define JOURNAL_ENABLE 0 // 1 = append every sensor transition to JOURNAL_FILE on the SD card, and replay those missed while offline.
+#define JOURNAL_FILE "JOURNAL.BIN" // journalRecord_t, back to back. See tools/journalDecode.py.
+#define JOURNAL_RAM_RECORDS 16 // Transitions waiting for the SD card. Must be a power of two.
+#define JOURNAL_FLUSH_MS 2000 // Longest a transition waits in a part-filled sector before it's flushed to the card.
+#define JOURNAL_REPLAY_MS 200 // Replay at most one journalled transition per this, and only when the MQTT queue is empty.
+#define LOG_ERROR 1
+#define LOG_WARN 2
+#define LOG_INFO 3    // Connects, disconnects, switches commanded, probes coming and going.
+#define LOG_DEBUG 4   // Each discovery and state sent.
+#define LOG_VERBOSE 5 // Each payload sent, in full.
+#define LOG_LEVEL LOG_VERBOSE // Logging above this level isn't compiled in at all.
+#define LOG_LEVEL_DEFAULT LOG_INFO // Logging above this level is skipped until changed on Serial ('1'...'5').
+#define LOG_BUFFER_SIZE 256 // Log lines waiting for Serial. Must be a power of two. Longer lines (most verbose payloads) are dropped. See log.cpp.
 
 enum sensorType
 {
@@ -24,6 +74,28 @@ enum sensorType
     switch1_fan,
     switch1_fire,
     switch1_alarmlight,
+    sensorTypeCount // Not a type. Rows in sensorTraits[] (sensorTraits.cpp).
+};
+
+enum mqttQueued
+{
+    queuedSensorState = 0,  // Index into allSensors[].
+    queuedSensorDiscovery,  // Index into allSensors[].
+    queuedds18xState,       // Index into allds18x[].
+    queuedds18xDiscovery,   // Index into allds18x[].
+    queuedDeviceState,      // AGGREGATE_STATE document. Index 0.
+    queuedDiagnosticsState, // Diagnostics document. Index 0.
+    queuedDiagnosticsDiscovery, // Index into diagnostics[] (diagnostics.cpp).
+    queuedKindCount
+};
+
+enum heartbeatClass
+{
+    heartbeat_none = 0,
+    heartbeat_contact, // HEARTBEAT_CONTACT
+    heartbeat_motion,  // HEARTBEAT_MOTION
+    heartbeat_switch,  // HEARTBEAT_SWITCH
+    heartbeatClassCount
 };
 
 enum sensorStates
@@ -54,18 +126,81 @@ typedef struct baseSensor_t
     sensorType type;
     int8_t pin1;
     int8_t pin2;
-};
+    const char *name;       // Built once by setupSensorStrings(). NULL for unused sensors.
+    const char *stateTopic; // Built once by setupSensorStrings(). NULL for unused sensors.
+    bool discovered;        // DISCOVERY_ONCE: discovery already sent this MQTT session.
+    uint16_t debounceMs;    // CONFIG.INI debounce_ms. 0 = no debouncing.
+    uint8_t faultSamples;   // Debouncer: ticks an unreported fault/offline state has held.
+} baseSensor_t;
 
+#define DS18X_MAX 16 // Most DS18x probes we'll track. Must fit the bits of a uint16_t.
+#define DS18X_RESCAN_PERIOD (60UL * 1000) // How often to look for DS18x probes coming and going.
 typedef struct ds18x_t
 {
     int8_t pin1;
     DeviceAddress address;
+    char name[17]; // Address as text, built once when the probe is first seen.
     float temp_f;
     float temp_f_old;
     float temp_f_oldest;
+    float temp_f_sent; // Last published. BOGUS_TEMPERATURE sends the next valid reading regardless.
+    unsigned long sentAt; // millis() of the last publish.
+    bool discovered; // DISCOVERY_ONCE: discovery already sent this MQTT session.
 } ds18x_t;
+typedef struct journalRecord_t
+{
+    uint32_t at;    // millis() when it happened.
+    uint8_t boot;   // Counts up (and wraps) each time we start, so "at" can be told apart across restarts.
+    uint8_t sensor; // Index into allSensors[], or JOURNAL_SENSOR_BOOT, JOURNAL_SENSOR_REPLAYED.
+    uint8_t state;  // sensorStates.
+    uint8_t flags;  // Reading index (JOURNAL_READING_MASK, see sensorTraits.cpp), JOURNAL_OFFLINE.
+} journalRecord_t;
+#define JOURNAL_SENSOR_BOOT 0xFF     // We started.
+#define JOURNAL_SENSOR_REPLAYED 0xFE // Every JOURNAL_OFFLINE record before this one has been replayed.
+#define JOURNAL_READING_MASK 0x03
+#define JOURNAL_OFFLINE 0x80         // Happened while we had no MQTT session.
+typedef struct latencySummary_t
+{
+    unsigned long p50Us; // Top of the histogram bucket holding the median.
+    unsigned long p99Us;
+    unsigned long maxUs;
+    unsigned long count;
+} latencySummary_t;
+typedef struct memorySummary_t
+{
+    size_t freeMin;        // Least RAM there's ever been between the heap and the stack.
+    size_t heapPeak;
+    size_t largestFree;    // Biggest malloc() which would succeed.
+    uint8_t fragmentation; // Percent of free RAM not in largestFree.
+    unsigned long blocks;  // malloc()ed, not yet free()d.
+    unsigned long failures;
+} memorySummary_t;
+#define JSON_MAX_PIECES 64 // Most literal/string pieces in one JSON document. See jsonWriter.cpp.
+typedef struct jsonPiece_t
+{
+    const char *text;
+    uint8_t kind;
+} jsonPiece_t;
+typedef struct jsonWriter_t
+{
+    jsonPiece_t pieces[JSON_MAX_PIECES];
+    uint8_t count;
+    bool overflow;
+} jsonWriter_t;
+#define PINBITSET_PORTS 12 // PA..PL on the Mega 2560, as numbered by digitalPinToPort().
+typedef struct pinBitset_t
+{
+    uint8_t ports[PINBITSET_PORTS]; // ports[port - 1] mirrors that port's PINx: bit N is PxN. See getBit().
+} pinBitset_t;
+typedef struct pinEvent_t
+{
+    uint8_t port;      // PB, PK, ... as returned by digitalPinToPort()
+    uint8_t portValue; // PINx, as read in the ISR.
+    unsigned long at;  // micros() when captured.
+} pinEvent_t;
+
 extern unsigned char allds18x_count;
-extern ds18x_t *allds18x;
+extern ds18x_t allds18x[DS18X_MAX];
 
 extern byte mac[6];
 extern baseSensor_t allSensors[64];
@@ -76,6 +211,25 @@ extern char mqtt_password[128];
 extern int mqtt_port;
 extern char mqtt_username[64];
 extern void mqttCallback(char *topic, byte *payloadBytes, unsigned int length);
+
+// log
+class logPrint_t : public Print
+{
+  public:
+    size_t write(uint8_t c);
+    using Print::write;
+};
+extern logPrint_t Log;
+extern uint8_t logLevel;
+#define LOG_ENABLED(level) (((level) <= LOG_LEVEL) && ((level) <= logLevel))
+#define LOG(level) if(! LOG_ENABLED(level)) { } else Log // LOG(LOG_INFO).println(F("...")); See log.cpp.
+extern void logBegin(void);
+extern void logRun(void);
+extern void logEndWindow(void);
+extern unsigned long logLastWindowDroppedBytes(void);
+extern void logPrintStats(void);
+extern void logResetStats(void);
+extern bool pubsubReconnect(void);
 extern bool didCallback;
 extern PubSubClient pubsubClient;
 
@@ -83,33 +237,170 @@ extern int allSensorCount(void);
 
 // switch.cpp
 extern void setupSwitchSensors(void);
-extern uint64_t readSwitchPins(uint64_t allPinReadings);
-extern void mqttSwitchSendData(uint64_t pinReadings);
+extern void readSwitchPins(pinBitset_t *allPinReadings);
+extern void mqttSwitchSendData(const pinBitset_t *pinReadings);
 extern void handleCallbackSwitches(const char *callbackValue);
-extern const char *readSwitchSensor(uint64_t pinReadings, baseSensor_t thisSensor);
+extern const char *readSwitchSensor(const pinBitset_t *pinReadings, baseSensor_t thisSensor);
 extern const char *switchValueON(baseSensor_t thisSensor);
 extern const char *switchValueOFF(baseSensor_t thisSensor);
 
 // baseSensor
 extern int allSensorCount(void);
-extern size_t mqttsend(const bool shouldSend, const char *nulltermstring);
-extern uint64_t readSensors(uint64_t currentBits, baseSensor_t *sensors, size_t sensorsSize);
-extern void mqttSensorSendDiscovery(uint64_t pinReadings);
-extern void getDeviceName(char *destbuf, size_t destbufsize);
-extern void getSensorName(char *destbuf, size_t destbufsize, baseSensor_t thisSensor);
-extern char *getSensorStateTopic(baseSensor_t thisSensor);
-extern char *getDeviceCommandTopic(void);
-extern char *getDeviceDiscoveryPayload(void);
-extern uint64_t readBit(uint64_t bitarray, int8_t pin);
-extern bool getBit(uint64_t bitarray, int8_t pin);
+extern void readSensors(pinBitset_t *pinReadings);
+extern void mqttSensorSendDiscovery(const pinBitset_t *pinReadings);
+extern void resetSensorDiscovery(baseSensor_t *sensors, size_t sensorsSize);
+extern void setupSensorStrings(baseSensor_t *sensors, size_t sensorsSize);
+extern const char *getDeviceName(void);
+extern const char *getSensorName(baseSensor_t thisSensor);
+extern const char *getSensorStateTopic(baseSensor_t thisSensor);
+extern const char *getDeviceCommandTopic(void);
+extern const char *getDeviceStateTopic(void);
+extern const char *getDeviceAvailabilityTopic(void);
+extern const char *getDeviceJournalTopic(void);
+extern const char *getDeviceDiagnosticsTopic(void);
+extern void jsonDeviceDiscovery(jsonWriter_t *writer);
+extern void readBit(pinBitset_t *bitarray, int8_t pin);
+extern bool getBit(const pinBitset_t *bitarray, int8_t pin);
+extern void pinBitsetClear(pinBitset_t *bitarray);
+extern void pinBitsetCopyPin(pinBitset_t *to, const pinBitset_t *from, int8_t pin);
+extern bool pinBitsetEqual(const pinBitset_t *a, const pinBitset_t *b);
 extern void setupSensors(baseSensor_t *sensors, size_t sensorsSize);
-extern void sendSensorsMQTT(uint64_t pinReadings, baseSensor_t *allSensors, size_t allSensorsSize);
+extern void sendSensorsMQTT(const pinBitset_t *pinReadings, baseSensor_t *allSensors, size_t allSensorsSize);
+extern void sendHeartbeatsMQTT(const pinBitset_t *pinReadings, baseSensor_t *allSensors, size_t allSensorsSize);
+extern void resetSensorHeartbeats(void);
+extern bool publishSensorState(uint8_t sensor, const pinBitset_t *pinReadings);
+extern bool publishSensorDiscovery(uint8_t sensor, const pinBitset_t *pinReadings);
+extern bool publishDeviceState(const pinBitset_t *pinReadings, baseSensor_t *sensors, size_t sensorsSize);
+extern void setupSensorIndex(baseSensor_t *sensors, size_t sensorsSize);
+extern void sendChangedSensorsMQTT(const pinBitset_t *oldReadings, const pinBitset_t *newReadings, baseSensor_t *allSensors, size_t allSensorsSize, unsigned long changedAt);
+
+// sensorTraits
+extern uint8_t sensorPinCount(sensorType type);
+extern uint8_t sensorPinDirection(sensorType type);
+extern bool sensorIsSwitch(sensorType type);
+extern PGM_P sensorComponent(sensorType type);
+extern PGM_P sensorTypeName(sensorType type);
+extern sensorType sensorTypeFromName(const char *name, size_t maxlen);
+extern PGM_P sensorNamePrefix(sensorType type);
+extern PGM_P sensorDiscoveryNameFormat(sensorType type);
+extern heartbeatClass sensorHeartbeatClass(sensorType type);
+extern unsigned long heartbeatPeriod(heartbeatClass heartbeat);
+extern uint8_t sensorReadingIndex(baseSensor_t sensor, const pinBitset_t *pinReadings);
+extern sensorStates getSensorStateEnum(baseSensor_t sensor, const pinBitset_t *pinReadings);
+extern bool sensorStateReportable(baseSensor_t sensor, const pinBitset_t *pinReadings);
+extern bool sensorStateOffline(baseSensor_t sensor, const pinBitset_t *pinReadings);
+extern bool sensorStateNeedsConfirming(baseSensor_t sensor, const pinBitset_t *pinReadings);
+extern PGM_P getSensorStateName(baseSensor_t sensor, const pinBitset_t *pinReadings);
+extern PGM_P sensorStateNameAt(sensorType type, uint8_t readingIndex);
+extern PGM_P getSensorStateIcon(baseSensor_t sensor, const pinBitset_t *pinReadings);
+
+// pinScanner
+extern void setupPinScanner(baseSensor_t *sensors, size_t sensorsSize);
+extern void pinScannerRead(pinBitset_t *pinReadings);
+extern void pinScannerApplyPort(pinBitset_t *pinReadings, uint8_t port, uint8_t portValue);
+
+// debounce
+extern void setupDebounce(baseSensor_t *sensors, size_t sensorsSize);
+extern void debounceRead(pinBitset_t *pinReadings);
+extern void debounceApplyPort(pinBitset_t *pinReadings, uint8_t port, uint8_t portValue, unsigned long at);
+
+// pinCapture
+extern void setupPinCapture(baseSensor_t *sensors, size_t sensorsSize);
+extern bool pinCaptureNext(pinEvent_t *event);
+extern unsigned long pinCaptureOverflows(void);
+extern void pinCapturePrintStats(void);
+
+// mqttQueue
+extern void mqttQueuePut(mqttQueued kind, uint8_t index);
+extern void mqttQueueRemove(mqttQueued kind, uint8_t index);
+extern void mqttQueueMove(mqttQueued kind, uint8_t from, uint8_t to);
+extern void mqttQueueRun(const pinBitset_t *pinReadings, unsigned long budgetUs);
+extern void mqttQueueClear(void);
+extern uint8_t mqttQueueDepth(void);
+extern unsigned long mqttQueueDrops(void);
+extern void mqttQueuePrintStats(void);
+extern void mqttQueueResetStats(void);
+
+// network
+extern void setupNetwork(void);
+extern bool networkRun(void);
+extern void networkPrintStats(void);
+extern void networkResetStats(void);
+
+// latency
+extern void latencyChanged(uint8_t sensor, unsigned long changedAt);
+extern void latencyPublished(uint8_t sensor);
+extern void latencyPublishedAll(void);
+extern void latencyForget(void);
+extern void latencyEndWindow(void);
+extern const latencySummary_t *latencyLastWindow(void);
+extern void latencyPrintStats(void);
+
+// memory
+extern void memoryEndWindow(void);
+extern const memorySummary_t *memoryLastWindow(void);
+extern void memoryPrintStats(void);
+
+// diagnostics
+extern void diagnosticsRun(void);
+extern void resetDiagnosticsDiscovery(void);
+extern bool publishDiagnosticsState(void);
+extern bool publishDiagnosticsDiscovery(uint8_t i);
+
+// journal
+extern void setupJournal(void);
+extern void journalSensor(uint8_t sensor, const pinBitset_t *pinReadings);
+extern void journalRun(void);
+extern void journalPrintStats(void);
+extern void journalResetStats(void);
+
+// jsonWriter
+extern void jsonBegin(jsonWriter_t *writer);
+extern void jsonLiteral(jsonWriter_t *writer, const char *text);
+extern void jsonLiteral_P(jsonWriter_t *writer, PGM_P text);
+extern void jsonString(jsonWriter_t *writer, const char *value);
+extern void jsonString_P(jsonWriter_t *writer, PGM_P value);
+extern size_t jsonLength(const jsonWriter_t *writer);
+extern size_t jsonWrite(const jsonWriter_t *writer, Print &out);
+extern bool jsonPublish(const jsonWriter_t *writer, const char *topic, bool retained);
+
+// scheduler
+typedef void (*taskFunction_t)(void);
+extern int schedulerAdd(PGM_P name, taskFunction_t run, unsigned long periodMs, unsigned long deadlineUs);
+extern void schedulerRun(void);
+extern void schedulerPrintStats(void);
+extern void schedulerResetStats(void);
+extern void schedulerEndWindow(void);
+extern bool schedulerStageWindow(PGM_P name, unsigned long *avgUs, unsigned long *worstUs);
+extern unsigned long schedulerPassRate(void);
+
+// cycle marks, for tools/simavr/cycles.c. Keep the ids in step with its names.
+#define CYCLE_LOOP 1
+#define CYCLE_READ_SENSORS 2
+#define CYCLE_SENSOR_STATE 3
+#define CYCLE_DISCOVERY 4
+#if CYCLE_MARKS
+struct cycleMark_t
+{
+  uint8_t id;
+  cycleMark_t(uint8_t markId) : id(markId) { GPIOR0 = markId; }
+  ~cycleMark_t() { GPIOR1 = id; }
+};
+#define CYCLE_MARK(id) cycleMark_t cycleMark(id) // From here to the end of the enclosing block, every return included.
+#else
+#define CYCLE_MARK(id)
+#endif
 
 // ds18x
 extern void setupDS18Sensors(void);
-extern ds18x_t *readDS18xSensors(void);
+extern bool readDS18xSensors(unsigned long periodMs);
+extern void ds18xPrintStats(void);
 extern void mqttds18xSendData(ds18x_t *allds18x, unsigned int ds18xcount);
 extern void mqttds18xSendDiscovery(ds18x_t *allds18x, unsigned int ds18xcount);
+extern void resetds18xDiscovery(ds18x_t *allds18x, unsigned int ds18xcount);
+extern void resetds18xHeartbeats(ds18x_t *allds18x, unsigned int ds18xcount);
+extern bool publishds18xState(uint8_t index);
+extern bool publishds18xDiscovery(uint8_t index);
 
 #define BOGUS_TEMPERATURE 222.22
 #endif /* _GUARDUINO_H_ */
@@ -1,6 +1,5 @@
 #include <Ethernet.h> // https://www.arduino.cc/reference/en/libraries/ethernet/
 #include <PubSubClient.h> // https://github.com/knolleary/pubsubclient/tree/master
-#include <MemoryUsage.h> // https://github.com/Locoduino/MemoryUsage/tree/master
 #include <OneWire.h> // https://www.pjrc.com/teensy/td_libs_OneWire.html
 #include <DallasTemperature.h> // https://github.com/milesburton/Arduino-Temperature-Control-Library
 #include "guarduino.h"
@@ -30,156 +29,306 @@ EthernetClient ethClient;
 PubSubClient pubsubClient(ethClient);
 bool didCallback = false;
 
-static uint64_t oldPinReadings = 0; // Here, we're assuming up to 64 pins will be read/tracked.
-static unsigned long lastReadAt = millis();
-#define HEARTBEAT (5 *1000) // If nothing happens, send a message every N milliseconds.
+static pinBitset_t oldPinReadings = { }; // Every digital pin, by port. See getBit().
+#if PINCAPTURE_PCINT
+static unsigned long lastCaptureOverflows = 0;
+#endif
+#define HEARTBEAT_CHECK (10 *1000) // How often to see whether a class of sensor is due its heartbeat (HEARTBEAT_CONTACT, ...).
+#define TEMPERATURE_PERIOD (5 *1000) // Read and send DS18x temperatures every N milliseconds.
+#define TEMPERATURE_POLL 20 // How often to check on a DS18x conversion in progress.
+#define NETWORK_POLL 50 // Step the network state machine every N milliseconds. Retries back off on their own; see network.cpp.
+#define JOURNAL_POLL 50 // Write journalled transitions to the SD card (and replay them) every N milliseconds. See journal.cpp.
+#define LED_PERIOD 100 // LED_BUILTIN is off for one of these, then on for (LED_BLINK_EVERY - 1) of these.
+#define LED_BLINK_EVERY 10
 
 
 void setup() {    
     Serial.begin(115200);
-    Serial.print("Start ");
+    Serial.print(F("Start "));
     Serial.print(GUARDUINO_URL);
-    Serial.print(" version: ");
+    Serial.print(F(" version: "));
     Serial.println(SOFTWARE_VERSION);
 
     // Set these pins for Ethernet and SDCard to cooporate.
-    pinMode(4, OUTPUT);  // SD CS
+    pinMode(SDCARD_CS_PIN, OUTPUT);  // SD CS
     pinMode(10, OUTPUT); // Ethernet CS
 
 
-    digitalWrite(4, HIGH); // SD Off
+    digitalWrite(SDCARD_CS_PIN, HIGH); // SD Off
     digitalWrite(10, HIGH); // Ethernet Off
     if (!readSDConfig("CONFIG.INI")) {
-        Serial.println("CONFIG.INI load error. Rebooting in 10 seconds...");
+        Serial.println(F("CONFIG.INI load error. Rebooting in 10 seconds..."));
         delay(10000);
         asm volatile ("jmp 0");  // Reboot by jumping to address 0
     }
-    digitalWrite(4, HIGH); // SD Off
+    setupSensorStrings(allSensors, sizeof(allSensors));
+    digitalWrite(SDCARD_CS_PIN, HIGH); // SD Off
     digitalWrite(10, HIGH); // Ethernet Off
 
-    pubsubClient.setBufferSize( MQTT_MAX_PACKET_SIZE + 256);
+    pubsubClient.setBufferSize(MQTT_BUFFER_SIZE);
     pubsubClient.setServer(mqtt_address, mqtt_port);
     pubsubClient.setCallback(mqttCallback);
     
-    if (setupEthernet()) {
-      setupSensors(allSensors, sizeof(allSensors));    
-      setupDS18Sensors();
-
-      oldPinReadings = readSensors(0, allSensors, sizeof(allSensors));
-    }
-    FREERAM_PRINT; // https://github.com/Locoduino/MemoryUsage/tree/master    
+    // Sensors don't wait for the network; taskNetwork() brings that up in the background.
+    setupSensors(allSensors, sizeof(allSensors));    
+    setupDS18Sensors();
+    setupNetwork();
+#if JOURNAL_ENABLE
+    setupJournal();
+#endif
+
+    pinBitsetClear(&oldPinReadings);
+    readSensors(&oldPinReadings);
+    memoryPrintStats();
+
+    // Slot order is run order: pins first, then publish, so a change is published in the same pass it's seen.
+    schedulerAdd(PSTR("pins"), taskPins, 0, 1000);
+    schedulerAdd(PSTR("publish"), taskPublish, 0, MQTT_QUEUE_BUDGET_US + 5000);
+    schedulerAdd(PSTR("mqtt"), taskMqtt, 0, 5000);
+    schedulerAdd(PSTR("network"), taskNetwork, NETWORK_POLL, 5000);
+    schedulerAdd(PSTR("heartbeat"), taskHeartbeat, HEARTBEAT_CHECK, 250000);
+    schedulerAdd(PSTR("temperature"), taskTemperature, TEMPERATURE_POLL, 20000);
+#if JOURNAL_ENABLE
+    schedulerAdd(PSTR("journal"), journalRun, JOURNAL_POLL, 20000);
+#endif
+    schedulerAdd(PSTR("diagnostics"), diagnosticsRun, DIAGNOSTICS_PERIOD, 1000);
+    schedulerAdd(PSTR("led"), taskLed, LED_PERIOD, 100);
+    schedulerAdd(PSTR("serial"), taskSerial, 100, 5000);
+    schedulerAdd(PSTR("log"), logRun, 0, 1000);
+    logBegin(); // From here on, LOG() waits in RAM for Serial. See log.cpp.
 }
 
 
 
 void loop() {      
-    
-    digitalWrite(LED_BUILTIN, LOW);
-    delay(100);
-    digitalWrite(LED_BUILTIN, HIGH);
-    FREERAM_PRINT; // https://github.com/Locoduino/MemoryUsage/tree/master    
-    
-
-    // Anything we need to do immediately?
-    //bool pinChange = didPinsChange();
-    bool didTimeout = ((millis() - lastReadAt) > HEARTBEAT);
-    bool mqttConnected = pubsubClient.connected();    
-
-    if(! mqttConnected) {
-        Serial.println("MQTT NOT Connected");
-        if (setupEthernet()) {
-          pubsubReconnect();
-          setupSensors(allSensors, sizeof(allSensors));
-          setupDS18Sensors();
-        }
-        return;
-    }
-    pubsubClient.loop();
-    
-    // Read digital pins.     
-    uint64_t newPinReadings = 0;
-    newPinReadings = readSensors(0, allSensors, sizeof(allSensors));
-    bool didPinsChange = (oldPinReadings != newPinReadings);
-
-
-    if(! mqttConnected) { return; };
-
-    // Check for Timeout BEFORE pinschange
-    if(didTimeout) {
+    CYCLE_MARK(CYCLE_LOOP);
+    schedulerRun();
+}
 
-      // Send Temps only on timeout.
-      allds18x = readDS18xSensors();
-      mqttds18xSendDiscovery(allds18x, allds18x_count);
-      mqttds18xSendData(allds18x, allds18x_count);
 
-      didPinsChange = true; // Assume this to trigger below.
+/**
+ * Read digital pins, and queue the sensors on any which changed (including a switch which was just commanded).
+ * Everything else waits for the heartbeat.
+ * This carries on while MQTT is down, so what we report on reconnect is current (and debounced).
+ */
+static void taskPins(void) {
+#if PINCAPTURE_PCINT
+    // Replay pin changes caught by interrupt since our last pass, oldest first, so each one is published.
+    // Each is sent before the next is applied; only if the broker is backed up do they coalesce in the queue.
+    pinEvent_t pinEvent;
+    while(pinCaptureNext(&pinEvent)) {
+      pinBitset_t eventPinReadings = oldPinReadings;
+      debounceApplyPort(&eventPinReadings, pinEvent.port, pinEvent.portValue, pinEvent.at);
+      if(pinBitsetEqual(&eventPinReadings, &oldPinReadings)) continue;
+      sendChangedSensorsMQTT(&oldPinReadings, &eventPinReadings, allSensors, sizeof(allSensors), pinEvent.at);
+      oldPinReadings = eventPinReadings;
+      mqttQueueRun(&oldPinReadings, MQTT_QUEUE_BUDGET_US);
+    }
+    if(pinCaptureOverflows() != lastCaptureOverflows) {
+      lastCaptureOverflows = pinCaptureOverflows();
+      LOG(LOG_WARN).print(F("PinCapture overflows="));
+      LOG(LOG_WARN).println(lastCaptureOverflows);
     }
+#endif
+
+    unsigned long scannedAt = micros();
+    pinBitset_t newPinReadings = oldPinReadings;
+    readSensors(&newPinReadings);
+    bool didPinsChange = ! pinBitsetEqual(&oldPinReadings, &newPinReadings);
 
-    // Check for callback BEFORE pinsChange
+    // A switch callback changed an output pin; re-read so we publish what the pin really is now.
     if(didCallback) {
-      newPinReadings = readSensors(newPinReadings, allSensors, sizeof(allSensors)); // Avoid race condition with callback.
-      oldPinReadings = newPinReadings;
+      readSensors(&newPinReadings);
       didCallback = false;
-      didPinsChange = true;
+      didPinsChange = ! pinBitsetEqual(&oldPinReadings, &newPinReadings);
     }
 
     if(didPinsChange) {
-      sendSensorsMQTT(newPinReadings, allSensors, sizeof(allSensors));
-      //mqttSwitchSendData(newPinReadings);
-      lastReadAt = millis();
-      oldPinReadings = newPinReadings;      
+      sendChangedSensorsMQTT(&oldPinReadings, &newPinReadings, allSensors, sizeof(allSensors), scannedAt);
+      oldPinReadings = newPinReadings;
     }
+}
+
+
+/**
+ * Send what's waiting in the outbound queue, most urgent first. See mqttQueue.cpp.
+ */
+static void taskPublish(void) {
+    mqttQueueRun(&oldPinReadings, MQTT_QUEUE_BUDGET_US);
+}
+
+
+/**
+ * Let PubSubClient read from the broker (this is where switch callbacks come from) and send its keepalives.
+ */
+static void taskMqtt(void) {
+    if(! pubsubClient.connected()) return;
+    pubsubClient.loop();
+}
+
+
+/**
+ * Keep Ethernet and MQTT up, one short step at a time. See network.cpp.
+ * A new session gets every sensor's state straight away, rather than at the next heartbeat check.
+ */
+static void taskNetwork(void) {
+    if(! networkRun()) return;
+    sendHeartbeatsMQTT(&oldPinReadings, allSensors, sizeof(allSensors));
+}
+
 
+/**
+ * If nothing happens, still re-publish each class of sensor on its own (long) period, in case HA missed something.
+ * Whether we're up at all is the availability topic's job.
+ */
+static void taskHeartbeat(void) {
+    if(! pubsubClient.connected()) return;
+    sendHeartbeatsMQTT(&oldPinReadings, allSensors, sizeof(allSensors));
+}
+
+
+/**
+ * DS18x temperatures, on their own period, no matter what the pins are doing.
+ * The conversion runs in the background; we just check on it every TEMPERATURE_POLL.
+ */
+static void taskTemperature(void) {
+    if(! readDS18xSensors(TEMPERATURE_PERIOD)) return;
+    if(! pubsubClient.connected()) return;
+    mqttds18xSendDiscovery(allds18x, allds18x_count);
+    mqttds18xSendData(allds18x, allds18x_count);
+}
+
+
+/**
+ * Blink LED_BUILTIN off briefly once per (LED_PERIOD * LED_BLINK_EVERY) ms, so we can see loop() is alive.
+ */
+static void taskLed(void) {
+    static uint8_t ledTick = 0;
+    digitalWrite(LED_BUILTIN, (ledTick == 0) ? LOW : HIGH);
+    ledTick = (ledTick + 1) % LED_BLINK_EVERY;
+}
+
+
+/**
+ * Single character commands typed on the Serial monitor:
+ * t - task statistics
+ * l - edge-to-publish latency histogram
+ * m - heap and stack high-water marks
+ * r - reset task statistics
+ * 1...5 - log level: errors, warnings, info, debug, verbose (every payload sent)
+ */
+static void taskSerial(void) {
+    while(Serial.available() > 0) {
+      int command = Serial.read();
+      switch(command) {
+        case 't':
+          schedulerPrintStats();
+          latencyPrintStats();
+          memoryPrintStats();
+          logPrintStats();
+          ds18xPrintStats();
+          mqttQueuePrintStats();
+          networkPrintStats();
+#if JOURNAL_ENABLE
+          journalPrintStats();
+#endif
+#if PINCAPTURE_PCINT
+          pinCapturePrintStats();
+#endif
+          break;
+        case 'l':
+          latencyPrintStats();
+          break;
+        case 'm':
+          memoryPrintStats();
+          break;
+        case 'r':
+          schedulerResetStats();
+          mqttQueueResetStats();
+          networkResetStats();
+#if JOURNAL_ENABLE
+          journalResetStats();
+#endif
+          logResetStats();
+          break;
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+          logLevel = command - '0';
+          logPrintStats();
+          break;
+        default:
+          break;
+      }
+    }
 }
 
 
 bool pubsubReconnect(void) {
 
-    char deviceName[24];
-    getDeviceName(deviceName, sizeof(deviceName));
+    const char *deviceName = getDeviceName();
     // Validate deviceName is not ""
     if (strlen(deviceName) == 0) {  
-        Serial.println("Invalid device name; cannot connect to MQTT.");
+        LOG(LOG_ERROR).println(F("Invalid device name; cannot connect to MQTT."));
         return false;
     }
     //Validate mqtt_username is not ""
     if (strlen(mqtt_username) == 0) {  
-        Serial.println("Invalid MQTT username; cannot connect to MQTT.");
+        LOG(LOG_ERROR).println(F("Invalid MQTT username; cannot connect to MQTT."));
         return false;
     }
     //Maybe(?) empty mqtt password is allowed? Do not validate that.
     
 
     if(! pubsubClient.connected()) {
-      setupEthernet();
       pubsubClient.setServer(mqtt_address, mqtt_port);
       pubsubClient.setCallback(mqttCallback);
-      if(! pubsubClient.connect(deviceName, mqtt_username, mqtt_password)) {
-        Serial.print("Failed connect ");
-        Serial.print(mqtt_username);
-        Serial.print(":");
-        Serial.print(mqtt_password);
-        Serial.print("@");
-        Serial.print(mqtt_address[0]);
-        Serial.print(".");
-        Serial.print(mqtt_address[1]);
-        Serial.print(".");
-        Serial.print(mqtt_address[2]);
-        Serial.print(".");
-        Serial.print(mqtt_address[3]);
-        Serial.print(":");
-        Serial.print(mqtt_port);
-        Serial.println("");
-        Serial.println(deviceName);
+      // Last will: if we drop off without saying goodbye, the broker marks every entity of ours unavailable.
+      if(! pubsubClient.connect(deviceName, mqtt_username, mqtt_password, getDeviceAvailabilityTopic(), 0, true, "offline")) {
+        // Never the password.
+        if(LOG_ENABLED(LOG_WARN)) {
+          Log.print(F("Failed connect "));
+          Log.print(mqtt_username);
+          Log.print(F("@"));
+          Log.print(mqtt_address[0]);
+          Log.print(F("."));
+          Log.print(mqtt_address[1]);
+          Log.print(F("."));
+          Log.print(mqtt_address[2]);
+          Log.print(F("."));
+          Log.print(mqtt_address[3]);
+          Log.print(F(":"));
+          Log.print(mqtt_port);
+          Log.print(F(" as "));
+          Log.print(deviceName);
+          Log.print(F(" state="));
+          Log.println(pubsubClient.state());
+        }
 
         return false;
       }
     }
 
+    mqttQueueClear(); // Queued for the last session; the sweeps below queue it all again.
+    latencyForget();
+    pubsubClient.publish(getDeviceAvailabilityTopic(), "online", true);
+    pubsubClient.subscribe(HA_STATUS_TOPIC);
+    resetSensorHeartbeats();
+    resetds18xHeartbeats(allds18x, allds18x_count);
     
-    // TODO: Send Discovery here.
-    // setupSwitchSensors(); // Subscribe to MQTT Topics.
-    mqttSensorSendDiscovery(0);
+    setupSwitchSensors(); // Subscribe to MQTT Topics.
+    resetDiagnosticsDiscovery();
+#if DISCOVERY_ONCE
+    // New session: each sensor re-sends its (retained) discovery the next time it publishes.
+    resetSensorDiscovery(allSensors, sizeof(allSensors));
+    resetds18xDiscovery(allds18x, allds18x_count);
+#else
+    pinBitset_t noPinReadings;
+    pinBitsetClear(&noPinReadings);
+    mqttSensorSendDiscovery(&noPinReadings);
+#endif
     //pubsubClient.subscribe(HA_TOPIC_DATA);    
 
     return true;
@@ -187,6 +336,15 @@ bool pubsubReconnect(void) {
 
 
 void mqttCallback(char *topic, byte *payloadBytes, unsigned int length) {
+    // HA (re)started. It has our retained discovery and availability, but not our states; send them all again.
+    if(strcmp_P(topic, PSTR(HA_STATUS_TOPIC)) == 0) {
+      if((length == 6) && (strncmp_P((const char *) payloadBytes, PSTR("online"), length) == 0)) {
+        resetSensorHeartbeats();
+        resetds18xHeartbeats(allds18x, allds18x_count);
+      }
+      return;
+    }
+
     // Listen for changes in one of our Switches here.
     size_t charsLength = length + 1;
     char *payloadChars =  (char *) calloc(charsLength, sizeof(char));
@@ -194,7 +352,7 @@ void mqttCallback(char *topic, byte *payloadBytes, unsigned int length) {
     memset(payloadChars, '\0', charsLength);
     strncpy(payloadChars, (const char *) payloadBytes, length);
     
-    Serial.println("CALLBACK!!");    
+    LOG(LOG_DEBUG).println(F("CALLBACK!!"));
 
     handleCallbackSwitches(payloadChars);    
     didCallback = true;
@@ -205,50 +363,6 @@ void mqttCallback(char *topic, byte *payloadBytes, unsigned int length) {
 
 
 
-static bool setupEthernet(void) {
-
-    // Validate "mac" is populated (not all zeros). Log such, and return false if not.
-    bool macIsValid = false;
-    for (size_t i = 0; i < 6; i++) {
-        if (mac[i] != 0) {
-            macIsValid = true;
-            break;;
-        }
-    }
-    if (!macIsValid) {
-        Serial.println("Invalid MAC address; cannot setup Ethernet.");
-        return false;
-    }
-
-    Ethernet.begin(mac);
-    delay(2000); // Let DHCP do it's thing.
-
-    if (Ethernet.hardwareStatus() == EthernetNoHardware) {
-      Serial.println("Ethernet hardware not found.");
-      return false;
-    } else if (Ethernet.hardwareStatus() == EthernetW5100) {
-      Serial.println("W5100 Ethernet controller detected.");
-    } else if (Ethernet.hardwareStatus() == EthernetW5200) {
-      Serial.println("W5200 Ethernet controller detected.");
-    } else if (Ethernet.hardwareStatus() == EthernetW5500) {
-      Serial.println("W5500 Ethernet controller detected.");
-    }
-    
-    
-    if(Ethernet.linkStatus() == Unknown) {
-      Serial.println("Ethernet.linkStatus(): Unknown");
-    }    
-    if(Ethernet.linkStatus() == LinkON) {
-      Serial.println("Ethernet.linkStatus(): On");
-      return true;
-    }
-    if(Ethernet.linkStatus() == LinkOFF) {
-      Serial.println("Ethernet.linkStatus(): OFF");
-    }
-
-    return false;
-}
-
 int allSensorCount(void) {
   size_t totalsize = sizeof(allSensors);
   size_t onesize = sizeof(baseSensor_t);
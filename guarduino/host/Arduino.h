@@ -0,0 +1,130 @@
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+/**
+ * Host (Linux) stand-in for the Arduino core, sized for an ATmega2560 "Mega".
+ * Only what guarduino uses is provided. Pins, millis() and micros() are simulated; see hal.h.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <avr/pgmspace.h>
+
+// Mega RAM layout, for memory.cpp. The Makefile's host link puts __heap_start and __stack on halRam[].
+#define RAMEND 0x21FF
+extern "C" { extern char *__brkval; extern size_t __malloc_margin; }
+extern uint8_t halRam[8192];
+extern uint8_t *halSP;
+#define SP ((uintptr_t) halSP)
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define LED_BUILTIN 13
+#define DEC 10
+#define HEX 16
+#define NUM_DIGITAL_PINS 70
+
+// Port numbering follows the Mega's pins_arduino.h (there is no PI).
+#define NOT_A_PORT 0
+#define PA 1
+#define PB 2
+#define PC 3
+#define PD 4
+#define PE 5
+#define PF 6
+#define PG 7
+#define PH 8
+#define PJ 10
+#define PK 11
+#define PL 12
+
+extern const uint8_t digital_pin_to_port_PGM[];
+extern const uint8_t digital_pin_to_bit_mask_PGM[];
+extern volatile uint8_t *const port_to_input_PGM[];
+#define digitalPinToPort(P) (((P) >= 0 && (P) < NUM_DIGITAL_PINS) ? digital_pin_to_port_PGM[(P)] : NOT_A_PORT)
+#define digitalPinToBitMask(P) (((P) >= 0 && (P) < NUM_DIGITAL_PINS) ? digital_pin_to_bit_mask_PGM[(P)] : 0)
+#define portInputRegister(P) (port_to_input_PGM[(P)])
+
+#define bit(b) (1UL << (b))
+#define _BV(b) (1 << (b))
+
+// Pin change interrupt registers and the Mega's pin -> PCINT mapping (pins_arduino.h).
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+#define PINB (*portInputRegister(PB))
+#define PINJ (*portInputRegister(PJ))
+#define PINK (*portInputRegister(PK))
+#define digitalPinToPCICR(p) ((((p) >= 10) && ((p) <= 13)) || (((p) >= 50) && ((p) <= 53)) || (((p) >= 62) && ((p) <= 69)) ? (&PCICR) : ((volatile uint8_t *) 0))
+#define digitalPinToPCICRbit(p) ((((p) >= 10) && ((p) <= 13)) || (((p) >= 50) && ((p) <= 53)) ? 0 : ((((p) >= 62) && ((p) <= 69)) ? 2 : 0))
+#define digitalPinToPCMSK(p) ((((p) >= 10) && ((p) <= 13)) || (((p) >= 50) && ((p) <= 53)) ? (&PCMSK0) : ((((p) >= 62) && ((p) <= 69)) ? (&PCMSK2) : ((volatile uint8_t *) 0)))
+#define digitalPinToPCMSKbit(p) ((((p) >= 10) && ((p) <= 13)) ? ((p) - 6) : (((p) == 50) ? 3 : (((p) == 51) ? 2 : (((p) == 52) ? 1 : (((p) == 53) ? 0 : ((((p) >= 62) && ((p) <= 69)) ? ((p) - 62) : 0))))))
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void interrupts(void);
+void noInterrupts(void);
+
+size_t strlcat(char *dst, const char *src, size_t size);
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+class Print;
+class Printable {
+  public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    virtual int availableForWrite(void) { return 0; }
+    size_t write(const char *str) { return str ? write((const uint8_t *) str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *) buffer, size); }
+
+    size_t print(const __FlashStringHelper *s) { return write((const char *) s); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long) n, base); }
+    size_t print(int n, int base = DEC) { return print((long) n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long) n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+    size_t print(const Printable &x) { return x.printTo(*this); }
+
+    size_t println(void) { return write("\r\n"); }
+    template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(T v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+};
+
+class HardwareSerial : public Print {
+  public:
+    void begin(unsigned long baud) { (void) baud; }
+    int available(void);
+    int read(void);
+    int availableForWrite(void);
+    size_t write(uint8_t c);
+    using Print::write;
+    operator bool() { return true; }
+};
+extern HardwareSerial Serial;
+
+#endif /* _HOST_ARDUINO_H_ */
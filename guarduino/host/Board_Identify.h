@@ -0,0 +1,8 @@
+#ifndef _HOST_BOARD_IDENTIFY_H_
+#define _HOST_BOARD_IDENTIFY_H_
+namespace BoardIdentify {
+  static const char *make = "Arduino";
+  static const char *model = "Mega 2560";
+  static const char *mcu __attribute__((unused)) = "ATmega2560";
+}
+#endif
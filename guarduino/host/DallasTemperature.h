@@ -0,0 +1,47 @@
+#ifndef _HOST_DALLASTEMPERATURE_H_
+#define _HOST_DALLASTEMPERATURE_H_
+/**
+ * Host stand-in for milesburton/DallasTemperature, backed by the virtual probes on the simulated bus (hal.h).
+ * Conversion time is simulated, including the blocking wait when setWaitForConversion(true).
+ */
+#include <Arduino.h>
+#include <OneWire.h>
+
+typedef uint8_t DeviceAddress[8];
+#define DEVICE_DISCONNECTED_C -127
+#define DEVICE_DISCONNECTED_F -196.6
+#define DEVICE_DISCONNECTED_RAW -7040
+
+class DallasTemperature {
+  public:
+    DallasTemperature(OneWire *oneWire) : oneWire(oneWire) {}
+    void begin(void) {}
+    uint8_t getDeviceCount(void);
+    uint8_t getDS18Count(void);
+    bool getAddress(uint8_t *deviceAddress, uint8_t index);
+    bool isConnected(const uint8_t *deviceAddress);
+    bool validFamily(const uint8_t *deviceAddress) {
+        switch (deviceAddress[0]) {
+            case 0x10: case 0x28: case 0x22: case 0x3B: case 0x42: return true;
+            default: return false;
+        }
+    }
+    uint8_t getResolution() { return resolution; }
+    bool setResolution(uint8_t newResolution) { resolution = newResolution; return true; }
+    void setWaitForConversion(bool flag) { waitForConversion = flag; }
+    bool getWaitForConversion(void) { return waitForConversion; }
+    int16_t millisToWaitForConversion(uint8_t bitResolution);
+    bool isConversionComplete(void);
+    struct request_t { bool result; unsigned long timestamp; operator bool() { return result; } };
+    request_t requestTemperatures(void);
+    request_t requestTemperaturesByAddress(const uint8_t *deviceAddress);
+    float getTempC(const uint8_t *deviceAddress);
+    float getTempF(const uint8_t *deviceAddress);
+  private:
+    OneWire *oneWire;
+    uint8_t resolution = 12;
+    bool waitForConversion = true;
+    unsigned long conversionStartedAt = 0;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _HOST_ETHERNET_H_
+#define _HOST_ETHERNET_H_
+#include <Arduino.h>
+
+class IPAddress : public Printable {
+  public:
+    IPAddress() { memset(octets, 0, sizeof(octets)); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { octets[0] = a; octets[1] = b; octets[2] = c; octets[3] = d; }
+    uint8_t operator[](int i) const { return octets[i]; }
+    uint8_t &operator[](int i) { return octets[i]; }
+    size_t printTo(Print &p) const { size_t n = 0; for (int i = 0; i < 4; i++) { if (i) n += p.print('.'); n += p.print((unsigned int) octets[i]); } return n; }
+    bool operator==(const IPAddress &o) const { return memcmp(octets, o.octets, 4) == 0; }
+  private:
+    uint8_t octets[4];
+};
+
+enum EthernetLinkStatus { Unknown, LinkON, LinkOFF };
+enum EthernetHardwareStatus { EthernetNoHardware, EthernetW5100, EthernetW5200, EthernetW5500 };
+
+class Client : public Print {
+  public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+    virtual void flush() = 0;
+};
+
+class EthernetClient : public Client {
+  public:
+    int connect(IPAddress ip, uint16_t port);
+    uint8_t connected();
+    void stop();
+    void flush() {}
+    int availableForWrite(void);
+    size_t write(uint8_t c) { (void) c; return 1; }
+    using Print::write;
+    void setConnectionTimeout(uint16_t timeout) { connectTimeout = timeout; }
+    uint16_t connectTimeout = 1000; // Ethernet 2.x default.
+};
+
+class EthernetClass {
+  public:
+    int begin(uint8_t *mac, unsigned long timeout = 60000, unsigned long responseTimeout = 4000);
+    int maintain();
+    void MACAddress(uint8_t *mac_address);
+    IPAddress localIP();
+    EthernetHardwareStatus hardwareStatus();
+    EthernetLinkStatus linkStatus();
+};
+extern EthernetClass Ethernet;
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _HOST_INIFILE_H_
+#define _HOST_INIFILE_H_
+/**
+ * Host stand-in for stevemarple/IniFile, reading from the simulated SD card.
+ */
+#include <SD.h>
+
+class IniFile {
+  public:
+    IniFile(const char *filename, uint8_t mode = FILE_READ, bool caseSensitive = false);
+    bool open(void);
+    void close(void);
+    bool validate(char *buffer, size_t len) const;
+    bool getValue(const char *section, const char *key, char *buffer, size_t len) const;
+  private:
+    char filename[64];
+    bool isOpen = false;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _HOST_ONEWIRE_H_
+#define _HOST_ONEWIRE_H_
+#include <Arduino.h>
+
+class OneWire {
+  public:
+    OneWire(uint8_t pin) : pin(pin) {}
+    void reset_search();
+    bool search(uint8_t *newAddr, bool search_mode = true);
+    uint8_t reset(void) { return 1; }
+    static uint8_t crc8(const uint8_t *addr, uint8_t len);
+  private:
+    uint8_t pin;
+    uint8_t searchIndex = 0;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _HOST_PUBSUBCLIENT_H_
+#define _HOST_PUBSUBCLIENT_H_
+/**
+ * Host stand-in for knolleary/PubSubClient. Every publish (including beginPublish()/write()/endPublish()
+ * streams) is recorded by hal.cpp instead of going out over a socket.
+ */
+#include <Arduino.h>
+#include <Ethernet.h>
+
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char *, uint8_t *, unsigned int)
+
+class PubSubClient : public Print {
+  public:
+    PubSubClient(Client &client) : client(&client) {}
+    PubSubClient &setServer(IPAddress ip, uint16_t port) { (void) ip; (void) port; return *this; }
+    PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+    PubSubClient &setSocketTimeout(uint16_t timeout) { (void) timeout; return *this; }
+    PubSubClient &setKeepAlive(uint16_t keepAlive) { (void) keepAlive; return *this; }
+    bool setBufferSize(uint16_t size) { bufferSize = size; return true; }
+    uint16_t getBufferSize() { return bufferSize; }
+
+    bool connect(const char *id, const char *user, const char *pass);
+    bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage);
+    bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession);
+    void disconnect();
+    bool connected();
+    bool loop();
+    int state() { return connectedFlag ? 0 : -1; }
+
+    bool publish(const char *topic, const char *payload) { return publish(topic, payload, false); }
+    bool publish(const char *topic, const char *payload, bool retained);
+    bool publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained);
+    bool publish_P(const char *topic, const char *payload, bool retained) { return publish(topic, payload, retained); }
+    bool beginPublish(const char *topic, unsigned int plength, bool retained);
+    int endPublish();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    bool subscribe(const char *topic);
+    bool unsubscribe(const char *topic) { (void) topic; return true; }
+
+    MQTT_CALLBACK_SIGNATURE = NULL;
+  private:
+    Client *client;
+    uint16_t bufferSize = MQTT_MAX_PACKET_SIZE;
+    bool connectedFlag = false;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _HOST_SD_H_
+#define _HOST_SD_H_
+/**
+ * Host stand-in for the Arduino SD library. The "card" is a host directory (hal.h: halSetSdRoot()).
+ */
+#include <Arduino.h>
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x13
+#define O_READ 0x01
+#define O_WRITE 0x02
+#define O_CREAT 0x10
+#define O_APPEND 0x04
+#define SPI_HALF_SPEED 1
+#define SPI_FULL_SPEED 0
+#define SD_CARD_TYPE_SD1 1
+#define SD_CARD_TYPE_SD2 2
+#define SD_CARD_TYPE_SDHC 3
+
+class File : public Print {
+  public:
+    File() {}
+    File(void *fp, void *dir, const char *path);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size);
+    using Print::write;
+    int read();
+    int read(void *buf, uint16_t nbyte);
+    int available();
+    void flush();
+    bool seek(uint32_t pos);
+    uint32_t position();
+    uint32_t size();
+    void close();
+    operator bool() { return fp || dir; }
+    const char *name() { return fileName; }
+    bool isDirectory(void) { return dir != NULL; }
+    File openNextFile(uint8_t mode = O_READ);
+  private:
+    void *fp = NULL;
+    void *dir = NULL;
+    long cacheBlock = -1; // Like SdFat's one block cache: blocks only go to the card when evicted or flushed.
+    bool cacheDirty = false;
+    void cacheUse(long block, bool forWrite, bool partial);
+    char path[256] = "";
+    char fileName[64] = "";
+};
+
+class SDClass {
+  public:
+    bool begin(uint8_t csPin) { (void) csPin; return true; }
+    void end() {}
+    File open(const char *filename, uint8_t mode = FILE_READ);
+    bool exists(const char *filepath);
+    bool remove(const char *filepath);
+    bool mkdir(const char *filepath);
+};
+extern SDClass SD;
+
+class Sd2Card {
+  public:
+    bool init(uint8_t sckRateID, uint8_t chipSelectPin) { (void) sckRateID; (void) chipSelectPin; return true; }
+    uint8_t type(void) const { return SD_CARD_TYPE_SDHC; }
+};
+
+class SdVolume {
+  public:
+    bool init(Sd2Card &card) { (void) card; return true; }
+};
+
+extern const char *halSdPath(const char *filepath, char *destbuf, size_t destbufsize);
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _HOST_SPI_H_
+#define _HOST_SPI_H_
+#include <Arduino.h>
+#endif
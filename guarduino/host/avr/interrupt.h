@@ -0,0 +1,7 @@
+#ifndef _HOST_INTERRUPT_H_
+#define _HOST_INTERRUPT_H_
+// Host ISRs are plain functions, called by hal.cpp when a simulated pin changes.
+#define ISR(vector, ...) extern "C" void vector(void)
+#define sei()
+#define cli()
+#endif
@@ -0,0 +1,23 @@
+#ifndef _HOST_PGMSPACE_H_
+#define _HOST_PGMSPACE_H_
+// Host has one address space; flash accessors become plain loads.
+#include <string.h>
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define pgm_read_word(addr) (*(const uint16_t *) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t *) (addr))
+#define pgm_read_ptr(addr) (*(void *const *) (addr))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+#define strlcpy_P strlcpy
+#define strlcat_P strlcat
+#define strcasecmp_P strcasecmp
+#define snprintf_P snprintf
+#define sprintf_P sprintf
+#endif
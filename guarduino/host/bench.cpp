@@ -0,0 +1,281 @@
+/**
+ * Fixed scenarios run against the host build (make bench), printed as JSON so two builds can be compared, e.g.
+ *
+ *     build/host/bench > before.json
+ *
+ * Each scenario runs in its own process (fork()), so each boots the firmware from scratch, off a CONFIG.INI
+ * written to a temporary SD card: the example's [network], then N sensors cycling door2, motion2, window2 over
+ * the pins CONFIG.INI may use (reused past 30 pairs). Every sensor starts closed / still. The firmware gets
+ * "warmup" ms to come up, connect and send discovery; the numbers are for the "window" after that:
+ *
+ *   loops                    loop() passes
+ *   cpu_ns_per_loop, _max    host CPU time in loop(); compare runs on the same machine only
+ *   sim_us_per_loop, _max    simulated time loop() spent waiting (delay(), the network, ...)
+ *   mallocs, frees           the firmware's, in the window
+ *   heap_peak                the firmware's heap, since boot, in bytes
+ *   mqtt_messages, _bytes    published; bytes are topic + payload
+ *   serial_bytes             written to Serial
+ *
+ * The scan_* scenarios then also time the pin scan on its own, for 8, 32 and 64 configured pins (door2 pairs on
+ * any pins but Serial's, not CONFIG.INI's, so there are 64 to be had):
+ *
+ *   scan_pins                pins configured
+ *   scan_ns                  host CPU time per pinScannerRead(): one snapshot of each port in use
+ *   readbit_ns               the same pins, one readBit() (digitalRead()) each, as readSensors() used to
+ *
+ * Time is simulated as in host/main.cpp: each pass takes BENCH_PASS_US plus whatever the firmware waits for.
+ */
+#include <Arduino.h>
+#include <OneWire.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal.h"
+#include "../guarduino.h"
+
+#define BENCH_PASS_US 100
+
+extern void setup(void);
+extern void loop(void);
+
+typedef struct benchScenario_t {
+    const char *name;
+    int sensors;
+    int probes;
+    unsigned long warmupMs;
+    unsigned long windowMs;
+    void (*drive)(unsigned long ms); // Each pass, with ms into the window. NULL = leave everything alone.
+    int scanPins; // After the window, time the pin scan for this many pins. 0 = don't.
+} benchScenario_t;
+
+// Digital pins CONFIG.INI will take: not 0/1 (Serial), 4 (SD), 8 (1-Wire), 10 (Ethernet), 13 (LED), 50-53 (SPI).
+static const uint8_t benchPins[] = {
+    2, 3, 5, 6, 7, 9, 11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+    36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69,
+};
+#define BENCH_PAIRS (sizeof(benchPins) / 2)
+static const char *const benchTypes[] = { "door2", "motion2", "window2" };
+
+static uint8_t benchPin1(int sensor) { return benchPins[(sensor % BENCH_PAIRS) * 2]; }
+static uint8_t benchPin2(int sensor) { return benchPins[((sensor % BENCH_PAIRS) * 2) + 1]; }
+
+
+static void driveDoorFlip(unsigned long ms)
+{
+    if (ms == 1000) halSetPin(benchPin1(0), HIGH);
+}
+
+// Sensor 1 is a motion2: 10 changes of state a second, each way.
+static void drivePir(unsigned long ms)
+{
+    halSetPin(benchPin1(1), ((ms / 50) & 1) ? HIGH : LOW);
+}
+
+// The broker goes away for 5s; when it's back, every sensor is rediscovered and republished.
+static void driveStorm(unsigned long ms)
+{
+    if (ms == 0) halSetBroker(false);
+    if (ms == 5000) halSetBroker(true);
+}
+
+// Each probe drifts by up to +/-1F, a few degrees a minute.
+static void driveProbes(unsigned long ms)
+{
+    if ((ms % 1000) != 0) return;
+    for (int probe = 0; probe < 16; probe++) halSetProbe(probe, 68.0 + probe + sin((ms / 20000.0) + probe));
+}
+
+static const benchScenario_t benchScenarios[] = {
+    // name           sensors probes warmup  window             drive          scanPins
+    { "idle_8",       8,      0,     30000,  16UL * 60 * 1000,  NULL,          0 },
+    { "idle_32",      32,     0,     30000,  16UL * 60 * 1000,  NULL,          0 },
+    { "idle_64",      64,     0,     30000,  16UL * 60 * 1000,  NULL,          0 },
+    { "door_flip",    8,      0,     30000,  10000,             driveDoorFlip, 0 },
+    { "pir_10hz",     8,      0,     30000,  60000,             drivePir,      0 },
+    { "storm_64",     64,     16,    30000,  60000,             driveStorm,    0 },
+    { "ds18x_16",     8,      16,    30000,  5UL * 60 * 1000,   driveProbes,   0 },
+    { "scan_8",       4,      0,     30000,  10000,             NULL,          8 },
+    { "scan_32",      16,     0,     30000,  10000,             NULL,          32 },
+    { "scan_64",      32,     0,     30000,  10000,             NULL,          64 },
+};
+#define BENCH_SCANS 1000000
+
+
+static bool benchWriteConfig(const char *dir, int sensors)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/CONFIG.INI", dir);
+    FILE *fp = fopen(path, "w");
+    if (!fp) return false;
+    fprintf(fp, "[network]\nmacaddress = 00:EA:BB:CC:15:78\nmqtt_address = 192.168.15.6\nmqtt_port = 1883\n"
+                "mqtt_username = homeassistant\nmqtt_password = your_mqtt_password_here\n");
+    for (int sensor = 0; sensor < sensors; sensor++) {
+        fprintf(fp, "\n[sensor%d]\ntype = %s\npin1 = %d\npin2 = %d\n", sensor, benchTypes[sensor % 3],
+                benchPin1(sensor), benchPin2(sensor));
+    }
+    return fclose(fp) == 0;
+}
+
+
+static void benchRemoveDir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d) {
+        char path[512];
+        for (struct dirent *e; (e = readdir(d)) != NULL; ) {
+            if (e->d_name[0] == '.') continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+
+static unsigned long long benchCpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+
+/**
+ * Time the pin scan for "pins" pins, each way, and print those fields. Replaces the firmware's scan table.
+ */
+static void benchScan(int pins)
+{
+    static baseSensor_t sensors[NUM_DIGITAL_PINS / 2];
+    int sensorCount = 0;
+    for (uint8_t pin = 2; ((sensorCount * 2) < pins) && ((pin + 1) < NUM_DIGITAL_PINS); pin += 2) {
+        baseSensor_t sensor = { door2, (int8_t) pin, (int8_t) (pin + 1), NULL, NULL, false, 0, 0 };
+        sensors[sensorCount++] = sensor;
+    }
+    setupPinScanner(sensors, sensorCount * sizeof(baseSensor_t));
+
+    pinBitset_t readings;
+    pinBitsetClear(&readings);
+    unsigned long long scanNs = benchCpuNs();
+    for (unsigned long i = 0; i < BENCH_SCANS; i++) pinScannerRead(&readings);
+    scanNs = benchCpuNs() - scanNs;
+
+    unsigned long long readBitNs = benchCpuNs();
+    for (unsigned long i = 0; i < BENCH_SCANS; i++) {
+        for (int sensor = 0; sensor < sensorCount; sensor++) {
+            readBit(&readings, sensors[sensor].pin1);
+            readBit(&readings, sensors[sensor].pin2);
+        }
+    }
+    readBitNs = benchCpuNs() - readBitNs;
+
+    printf(", \"scan_pins\": %d, \"scan_ns\": %.1f, \"readbit_ns\": %.1f",
+           sensorCount * 2, (double) scanNs / BENCH_SCANS, (double) readBitNs / BENCH_SCANS);
+}
+
+
+/**
+ * Boot the firmware and run one scenario. In the child: prints its JSON object and exits.
+ */
+static void benchRun(const benchScenario_t *s, const char *sd)
+{
+    halSetSdRoot(sd);
+    halSerialEcho(false);
+    for (int sensor = 0; sensor < s->sensors; sensor++) {
+        halSetPin(benchPin1(sensor), LOW);
+        halSetPin(benchPin2(sensor), HIGH);
+    }
+    for (int probe = 0; probe < s->probes; probe++) {
+        uint8_t address[8] = { 0x28, (uint8_t) probe, 0, 0, 0, 0, 0, 0 };
+        address[7] = OneWire::crc8(address, 7);
+        halAddProbe(address, 68.0 + probe);
+    }
+
+    setup();
+    while (millis() < s->warmupMs) {
+        loop();
+        halAdvanceMicros(BENCH_PASS_US);
+    }
+
+    halClearPublishes();
+    unsigned long serialBytes = halSerialBytes();
+    unsigned long mallocs = halMallocs();
+    unsigned long frees = halFrees();
+    unsigned long loops = 0;
+    unsigned long long cpuNs = 0, cpuNsMax = 0;
+    unsigned long long simUs = 0;
+    unsigned long simUsMax = 0;
+    unsigned long start = millis();
+    unsigned long lastDriven = (unsigned long) -1;
+
+    while ((millis() - start) < s->windowMs) {
+        unsigned long ms = millis() - start;
+        if (s->drive && (ms != lastDriven)) {
+            s->drive(ms);
+            lastDriven = ms;
+        }
+        unsigned long before = micros();
+        unsigned long long cpu = benchCpuNs();
+        loop();
+        cpu = benchCpuNs() - cpu;
+        unsigned long waited = micros() - before;
+
+        loops++;
+        cpuNs += cpu;
+        if (cpu > cpuNsMax) cpuNsMax = cpu;
+        simUs += waited;
+        if (waited > simUsMax) simUsMax = waited;
+        halAdvanceMicros(BENCH_PASS_US);
+    }
+
+    printf("    {\"name\": \"%s\", \"sensors\": %d, \"probes\": %d, \"window_ms\": %lu, \"loops\": %lu, "
+           "\"cpu_ns_per_loop\": %llu, \"cpu_ns_max\": %llu, \"sim_us_per_loop\": %.1f, \"sim_us_max\": %lu, "
+           "\"mallocs\": %lu, \"frees\": %lu, \"heap_peak\": %zu, "
+           "\"mqtt_messages\": %zu, \"mqtt_bytes\": %lu, \"serial_bytes\": %lu",
+           s->name, s->sensors, s->probes, s->windowMs, loops,
+           loops ? (cpuNs / loops) : 0, cpuNsMax, loops ? ((double) simUs / loops) : 0.0, simUsMax,
+           halMallocs() - mallocs, halFrees() - frees, halHeapPeak(),
+           halPublishCount(), halPublishBytes(), halSerialBytes() - serialBytes);
+    if (s->scanPins) benchScan(s->scanPins);
+    printf("}");
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *only = (argc > 1) ? argv[1] : NULL; // Just the scenario of this name.
+    bool first = true;
+    int failed = 0;
+
+    printf("{\"scenarios\": [\n");
+    for (size_t i = 0; i < (sizeof(benchScenarios) / sizeof(benchScenarios[0])); i++) {
+        const benchScenario_t *s = &benchScenarios[i];
+        if (only && strcmp(only, s->name) != 0) continue;
+
+        char sd[] = "/tmp/guarduino-bench-XXXXXX";
+        if (!mkdtemp(sd) || !benchWriteConfig(sd, s->sensors)) {
+            fprintf(stderr, "%s: can't write an SD card in /tmp\n", s->name);
+            return 1;
+        }
+        if (!first) printf(",\n");
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            benchRun(s, sd);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 0;
+        if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            fprintf(stderr, "%s: failed\n", s->name);
+            printf("    {\"name\": \"%s\", \"failed\": true}", s->name);
+            failed++;
+        }
+        first = false;
+        benchRemoveDir(sd);
+    }
+    printf("\n]}\n");
+    return failed ? 1 : 0;
+}
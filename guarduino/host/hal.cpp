@@ -0,0 +1,761 @@
+/**
+ * Host implementation of the Arduino core and library stand-ins used by guarduino.
+ * Everything is single threaded and deterministic: time only moves when the firmware delay()s
+ * or a driver calls halAdvanceMicros().
+ */
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <PubSubClient.h>
+#include <OneWire.h>
+#include <DallasTemperature.h>
+#include <SD.h>
+#include <IniFile.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hal.h"
+
+// ---------------------------------------------------------------------------------------------
+// Pins, laid out like the ATmega2560 (see variants/mega/pins_arduino.h).
+// ---------------------------------------------------------------------------------------------
+
+const uint8_t digital_pin_to_port_PGM[NUM_DIGITAL_PINS] = {
+    PE, PE, PE, PE, PG, PE, PH, PH, PH, PH, // 0-9
+    PB, PB, PB, PB, PJ, PJ, PH, PH, PD, PD, // 10-19
+    PD, PD, PA, PA, PA, PA, PA, PA, PA, PA, // 20-29
+    PC, PC, PC, PC, PC, PC, PC, PC, PD, PG, // 30-39
+    PG, PG, PL, PL, PL, PL, PL, PL, PL, PL, // 40-49
+    PB, PB, PB, PB, PF, PF, PF, PF, PF, PF, // 50-59
+    PF, PF, PK, PK, PK, PK, PK, PK, PK, PK, // 60-69
+};
+
+const uint8_t digital_pin_to_bit_mask_PGM[NUM_DIGITAL_PINS] = {
+    _BV(0), _BV(1), _BV(4), _BV(5), _BV(5), _BV(3), _BV(3), _BV(4), _BV(5), _BV(6), // 0-9
+    _BV(4), _BV(5), _BV(6), _BV(7), _BV(1), _BV(0), _BV(1), _BV(0), _BV(3), _BV(2), // 10-19
+    _BV(1), _BV(0), _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7), // 20-29
+    _BV(7), _BV(6), _BV(5), _BV(4), _BV(3), _BV(2), _BV(1), _BV(0), _BV(7), _BV(2), // 30-39
+    _BV(1), _BV(0), _BV(7), _BV(6), _BV(5), _BV(4), _BV(3), _BV(2), _BV(1), _BV(0), // 40-49
+    _BV(3), _BV(2), _BV(1), _BV(0), _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5), // 50-59
+    _BV(6), _BV(7), _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7), // 60-69
+};
+
+static volatile uint8_t portInput[PL + 1];
+static uint8_t portDirection[PL + 1];
+volatile uint8_t *const port_to_input_PGM[PL + 1] = {
+    NULL, &portInput[PA], &portInput[PB], &portInput[PC], &portInput[PD], &portInput[PE], &portInput[PF],
+    &portInput[PG], &portInput[PH], NULL, &portInput[PJ], &portInput[PK], &portInput[PL],
+};
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PORT) return;
+    if (mode == OUTPUT) portDirection[port] |= digitalPinToBitMask(pin);
+    else portDirection[port] &= ~digitalPinToBitMask(pin);
+}
+
+int digitalRead(uint8_t pin) {
+    uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PORT) return LOW;
+    return (portInput[port] & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+static void setPinLevel(uint8_t pin, uint8_t level) {
+    uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PORT) return;
+    if (level == HIGH) portInput[port] |= digitalPinToBitMask(pin);
+    else portInput[port] &= ~digitalPinToBitMask(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PORT) return;
+    if (portDirection[port] & digitalPinToBitMask(pin)) setPinLevel(pin, value);
+}
+
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+
+void halSetPin(uint8_t pin, uint8_t level) {
+    uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PORT) return;
+    if (portDirection[port] & digitalPinToBitMask(pin)) return; // Driven by the firmware.
+    uint8_t before = portInput[port];
+    setPinLevel(pin, level);
+    if (before == portInput[port]) return;
+
+    // Raise the pin change interrupt, if the firmware enabled one for this pin.
+    volatile uint8_t *pcmsk = digitalPinToPCMSK(pin);
+    if (!pcmsk || !(*pcmsk & bit(digitalPinToPCMSKbit(pin)))) return;
+    if (!(PCICR & bit(digitalPinToPCICRbit(pin)))) return;
+    if (digitalPinToPCICRbit(pin) == 0 && PCINT0_vect) PCINT0_vect();
+    if (digitalPinToPCICRbit(pin) == 2 && PCINT2_vect) PCINT2_vect();
+}
+
+uint8_t halGetPin(uint8_t pin) { return (uint8_t) digitalRead(pin); }
+
+// ---------------------------------------------------------------------------------------------
+// Time
+// ---------------------------------------------------------------------------------------------
+static unsigned long long nowMicros = 0;
+
+unsigned long millis(void) { return (unsigned long) (nowMicros / 1000); }
+unsigned long micros(void) { return (unsigned long) nowMicros; }
+void delay(unsigned long ms) { halAdvanceMicros(ms * 1000UL); }
+void delayMicroseconds(unsigned int us) { halAdvanceMicros(us); }
+void interrupts(void) {}
+void noInterrupts(void) {}
+static struct { unsigned long long at; uint8_t pin; uint8_t level; } scheduledPins[8];
+static int scheduledPinCount = 0;
+void halSchedulePin(uint8_t pin, uint8_t level, unsigned long at) {
+    if (scheduledPinCount >= (int) (sizeof(scheduledPins) / sizeof(scheduledPins[0]))) return;
+    scheduledPins[scheduledPinCount].at = at; scheduledPins[scheduledPinCount].pin = pin; scheduledPins[scheduledPinCount].level = level;
+    scheduledPinCount++;
+}
+void halAdvanceMicros(unsigned long us) {
+    nowMicros += us;
+    for (int i = 0; i < scheduledPinCount; i++) {
+        if (scheduledPins[i].at && nowMicros >= scheduledPins[i].at) { scheduledPins[i].at = 0; halSetPin(scheduledPins[i].pin, scheduledPins[i].level); }
+    }
+}
+
+size_t strlcat(char *dst, const char *src, size_t size) {
+    size_t dlen = strnlen(dst, size);
+    size_t slen = strlen(src);
+    if (dlen == size) return size + slen;
+    size_t copy = (slen < size - dlen - 1) ? slen : size - dlen - 1;
+    memcpy(dst + dlen, src, copy);
+    dst[dlen + copy] = '\0';
+    return dlen + slen;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t slen = strlen(src);
+    if (size > 0) {
+        size_t copy = (slen < size - 1) ? slen : size - 1;
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return slen;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Print / Serial
+// ---------------------------------------------------------------------------------------------
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(long n, int base) {
+    char buf[24];
+    if (base == HEX) snprintf(buf, sizeof(buf), "%lX", n);
+    else snprintf(buf, sizeof(buf), "%ld", n);
+    return write(buf);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    char buf[24];
+    if (base == HEX) snprintf(buf, sizeof(buf), "%lX", n);
+    else snprintf(buf, sizeof(buf), "%lu", n);
+    return write(buf);
+}
+
+size_t Print::print(double n, int digits) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
+
+HardwareSerial Serial;
+static bool serialEcho = false;
+static unsigned long serialBytes = 0;
+static char serialInput[256];
+static size_t serialInputHead = 0, serialInputTail = 0;
+
+// UART model (halSetSerialUart): a 64 byte TX buffer draining at 115200 baud; write() blocks while it's full.
+static bool uartModel = false;
+static unsigned long uartFreeAt = 0; // micros() the buffer will be empty.
+static unsigned long uartBlockedUs = 0;
+#define UART_BYTE_US 87
+void halSetSerialUart(bool on) { uartModel = on; uartFreeAt = micros(); }
+unsigned long halSerialBlockedUs(void) { return uartBlockedUs; }
+static int uartQueued(void) {
+    long left = (long) (uartFreeAt - micros());
+    return left <= 0 ? 0 : (int) ((left + UART_BYTE_US - 1) / UART_BYTE_US);
+}
+int HardwareSerial::availableForWrite(void) { return uartModel ? 63 - uartQueued() : 63; }
+size_t HardwareSerial::write(uint8_t c) {
+    if (uartModel) {
+        if (uartQueued() >= 63) { unsigned long wait = (uartFreeAt - micros()) - 62 * UART_BYTE_US; uartBlockedUs += wait; halAdvanceMicros(wait); }
+        if ((long) (uartFreeAt - micros()) < 0) uartFreeAt = micros();
+        uartFreeAt += UART_BYTE_US;
+    }
+    serialBytes++;
+    if (serialEcho) fputc(c, stdout);
+    return 1;
+}
+int HardwareSerial::available(void) { return (int) (serialInputTail - serialInputHead); }
+int HardwareSerial::read(void) {
+    if (serialInputHead == serialInputTail) return -1;
+    return (uint8_t) serialInput[serialInputHead++];
+}
+
+void halSerialEcho(bool echo) { serialEcho = echo; }
+unsigned long halSerialBytes(void) { return serialBytes; }
+void halSerialInput(const char *s) {
+    if (serialInputHead == serialInputTail) serialInputHead = serialInputTail = 0;
+    while (*s && serialInputTail < sizeof(serialInput)) serialInput[serialInputTail++] = *s++;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Ethernet
+// ---------------------------------------------------------------------------------------------
+EthernetClass Ethernet;
+static bool linkUp = true;
+static bool brokerUp = true;
+static bool haveLease = false;
+static uint8_t ethernetMac[6];
+
+int EthernetClass::begin(uint8_t *mac, unsigned long timeout, unsigned long responseTimeout) {
+    (void) responseTimeout;
+    memcpy(ethernetMac, mac, sizeof(ethernetMac));
+    if (!linkUp) {
+        halAdvanceMicros(timeout * 1000UL); // DHCP gives up after "timeout".
+        haveLease = false;
+        return 0;
+    }
+    halAdvanceMicros(50UL * 1000UL); // A quick DHCP exchange.
+    haveLease = true;
+    return 1;
+}
+int EthernetClass::maintain() { return 0; }
+void EthernetClass::MACAddress(uint8_t *mac_address) { memcpy(mac_address, ethernetMac, sizeof(ethernetMac)); }
+IPAddress EthernetClass::localIP() { return haveLease ? IPAddress(192, 168, 15, 77) : IPAddress(); }
+EthernetHardwareStatus EthernetClass::hardwareStatus() { return EthernetW5500; }
+EthernetLinkStatus EthernetClass::linkStatus() { return linkUp ? LinkON : LinkOFF; }
+
+int EthernetClient::connect(IPAddress ip, uint16_t port) {
+    (void) ip; (void) port;
+    if (linkUp && brokerUp && haveLease) { halAdvanceMicros(2000); return 1; }
+    halAdvanceMicros(connectTimeout * 1000UL); // Broker host unreachable: the SYN goes unanswered.
+    return 0;
+}
+uint8_t EthernetClient::connected() { return (linkUp && brokerUp && haveLease) ? 1 : 0; }
+void EthernetClient::stop() {}
+
+void halSetLink(bool up) { linkUp = up; if (!up) haveLease = false; }
+void halSetBroker(bool up) { brokerUp = up; }
+
+// ---------------------------------------------------------------------------------------------
+// PubSubClient: records every message.
+// ---------------------------------------------------------------------------------------------
+static halPublish_t *publishes = NULL;
+static size_t publishCount = 0, publishCapacity = 0;
+static unsigned long publishBytes = 0;
+static halPublish_t streaming;
+static size_t streamingExpected = 0;
+static bool isStreaming = false;
+static PubSubClient *activeClient = NULL;
+
+static unsigned long halPublishCostUs = 0;
+void halSetPublishCost(unsigned long usPerByte) { halPublishCostUs = usPerByte; }
+static void recordPublish(const halPublish_t *p) {
+    halAdvanceMicros(halPublishCostUs * (strlen(p->topic) + p->length)); // A slow broker/link: the write blocks.
+    if (publishCount == publishCapacity) {
+        publishCapacity = publishCapacity ? publishCapacity * 2 : 256;
+        publishes = (halPublish_t *) realloc(publishes, publishCapacity * sizeof(halPublish_t));
+    }
+    publishes[publishCount] = *p;
+    publishes[publishCount].at = micros();
+    publishCount++;
+    publishBytes += strlen(p->topic) + p->length;
+}
+
+size_t halPublishCount(void) { return publishCount; }
+const halPublish_t *halPublishAt(size_t i) { return (i < publishCount) ? &publishes[i] : NULL; }
+unsigned long halPublishBytes(void) { return publishBytes; }
+void halClearPublishes(void) {
+    for (size_t i = 0; i < publishCount; i++) free(publishes[i].payload);
+    publishCount = 0;
+    publishBytes = 0;
+}
+
+static int halTxRoom = 2048;
+void halSetTxRoom(int room) { halTxRoom = room; }
+int EthernetClient::availableForWrite(void) { return connected() ? halTxRoom : 0; }
+static char halWill[128];
+const char *halLastWill(void) { return halWill; }
+bool PubSubClient::connect(const char *id, const char *user, const char *pass) {
+    return connect(id, user, pass, NULL, 0, false, NULL, true);
+}
+bool PubSubClient::connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage) {
+    return connect(id, user, pass, willTopic, willQos, willRetain, willMessage, true);
+}
+bool PubSubClient::connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession) {
+    (void) id; (void) user; (void) pass; (void) willQos; (void) willRetain; (void) cleanSession;
+    halWill[0] = 0;
+    if (willTopic) snprintf(halWill, sizeof(halWill), "%s=%s%s", willTopic, willMessage, willRetain ? " (retained)" : "");
+    connectedFlag = client->connect(IPAddress(), 1883) == 1;
+    if (connectedFlag) activeClient = this;
+    return connectedFlag;
+}
+void PubSubClient::disconnect() { connectedFlag = false; }
+bool PubSubClient::connected() {
+    if (connectedFlag && !client->connected()) connectedFlag = false;
+    return connectedFlag;
+}
+bool PubSubClient::loop() { return connected(); }
+
+bool PubSubClient::publish(const char *topic, const char *payload, bool retained) {
+    return publish(topic, (const uint8_t *) payload, payload ? strlen(payload) : 0, retained);
+}
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained) {
+    if (!connected()) return false;
+    if (strlen(topic) + plength + 7 > bufferSize) return false; // PubSubClient refuses oversized packets.
+    halPublish_t p;
+    memset(&p, 0, sizeof(p));
+    strlcpy(p.topic, topic, sizeof(p.topic));
+    p.payload = (char *) calloc(plength + 1, 1);
+    memcpy(p.payload, payload, plength);
+    p.length = plength;
+    p.retained = retained;
+    recordPublish(&p);
+    return true;
+}
+bool PubSubClient::beginPublish(const char *topic, unsigned int plength, bool retained) {
+    if (!connected()) return false;
+    memset(&streaming, 0, sizeof(streaming));
+    strlcpy(streaming.topic, topic, sizeof(streaming.topic));
+    streaming.payload = (char *) calloc(plength + 1, 1);
+    streaming.retained = retained;
+    streamingExpected = plength;
+    isStreaming = true;
+    return true;
+}
+size_t PubSubClient::write(uint8_t c) { return write(&c, 1); }
+size_t PubSubClient::write(const uint8_t *buffer, size_t size) {
+    if (!isStreaming) return 0;
+    if (streaming.length + size > streamingExpected) {
+        fprintf(stderr, "hal: %s overran its announced length %zu\n", streaming.topic, streamingExpected);
+        abort();
+    }
+    memcpy(streaming.payload + streaming.length, buffer, size);
+    streaming.length += size;
+    return size;
+}
+int PubSubClient::endPublish() {
+    if (!isStreaming) return 0;
+    isStreaming = false;
+    if (streaming.length != streamingExpected) {
+        fprintf(stderr, "hal: %s sent %zu of %zu announced bytes\n", streaming.topic, streaming.length, streamingExpected);
+        abort();
+    }
+    recordPublish(&streaming);
+    return 1;
+}
+bool PubSubClient::subscribe(const char *topic) { (void) topic; return connected(); }
+
+void halDeliver(const char *topic, const char *payload) {
+    if (!activeClient || !activeClient->callback || !activeClient->connected()) return;
+    char topicCopy[128];
+    strlcpy(topicCopy, topic, sizeof(topicCopy));
+    activeClient->callback(topicCopy, (uint8_t *) payload, strlen(payload));
+}
+
+// ---------------------------------------------------------------------------------------------
+// 1-Wire / DS18x
+// ---------------------------------------------------------------------------------------------
+#define HAL_MAX_PROBES 32
+typedef struct halProbe_t {
+    bool present;
+    uint8_t address[8];
+    float tempF;
+    float latchedF; // Value captured at the last Convert T.
+} halProbe_t;
+static halProbe_t probes[HAL_MAX_PROBES];
+
+int halAddProbe(const uint8_t address[8], float tempF) {
+    for (int i = 0; i < HAL_MAX_PROBES; i++) {
+        if (probes[i].present) continue;
+        probes[i].present = true;
+        memcpy(probes[i].address, address, 8);
+        probes[i].tempF = tempF;
+        probes[i].latchedF = 185.0; // DS18B20 power-on scratchpad is 85C.
+        return i;
+    }
+    return -1;
+}
+void halSetProbe(int probe, float tempF) { probes[probe].tempF = tempF; }
+void halRemoveProbe(int probe) { probes[probe].present = false; }
+
+static halProbe_t *findProbe(const uint8_t *address) {
+    for (int i = 0; i < HAL_MAX_PROBES; i++) {
+        if (probes[i].present && memcmp(probes[i].address, address, 8) == 0) return &probes[i];
+    }
+    return NULL;
+}
+
+void OneWire::reset_search() { searchIndex = 0; }
+bool OneWire::search(uint8_t *newAddr, bool search_mode) {
+    (void) search_mode;
+    halAdvanceMicros(8UL * 1000UL); // A ROM search step is ~8 ms of bus time per device.
+    while (searchIndex < HAL_MAX_PROBES) {
+        halProbe_t *p = &probes[searchIndex++];
+        if (!p->present) continue;
+        memcpy(newAddr, p->address, 8);
+        return true;
+    }
+    return false;
+}
+uint8_t OneWire::crc8(const uint8_t *addr, uint8_t len) {
+    uint8_t crc = 0;
+    while (len--) {
+        uint8_t inbyte = *addr++;
+        for (uint8_t i = 8; i; i--) {
+            uint8_t mix = (crc ^ inbyte) & 0x01;
+            crc >>= 1;
+            if (mix) crc ^= 0x8C;
+            inbyte >>= 1;
+        }
+    }
+    return crc;
+}
+
+uint8_t DallasTemperature::getDeviceCount(void) {
+    uint8_t count = 0;
+    for (int i = 0; i < HAL_MAX_PROBES; i++) if (probes[i].present) count++;
+    halAdvanceMicros(count * 8UL * 1000UL);
+    return count;
+}
+uint8_t DallasTemperature::getDS18Count(void) { return getDeviceCount(); }
+bool DallasTemperature::getAddress(uint8_t *deviceAddress, uint8_t index) {
+    // Like the real library, every call re-runs the ROM search from the start.
+    uint8_t seen = 0;
+    for (int i = 0; i < HAL_MAX_PROBES; i++) {
+        if (!probes[i].present) continue;
+        halAdvanceMicros(8UL * 1000UL);
+        if (seen++ == index) {
+            memcpy(deviceAddress, probes[i].address, 8);
+            return true;
+        }
+    }
+    return false;
+}
+bool DallasTemperature::isConnected(const uint8_t *deviceAddress) { return findProbe(deviceAddress) != NULL; }
+int16_t DallasTemperature::millisToWaitForConversion(uint8_t bitResolution) {
+    switch (bitResolution) {
+        case 9: return 94;
+        case 10: return 188;
+        case 11: return 375;
+        default: return 750;
+    }
+}
+bool DallasTemperature::isConversionComplete(void) {
+    return (millis() - conversionStartedAt) >= (unsigned long) millisToWaitForConversion(resolution);
+}
+DallasTemperature::request_t DallasTemperature::requestTemperatures(void) {
+    for (int i = 0; i < HAL_MAX_PROBES; i++) if (probes[i].present) probes[i].latchedF = probes[i].tempF;
+    conversionStartedAt = millis();
+    if (waitForConversion) halAdvanceMicros(millisToWaitForConversion(resolution) * 1000UL);
+    request_t r = { true, millis() };
+    return r;
+}
+DallasTemperature::request_t DallasTemperature::requestTemperaturesByAddress(const uint8_t *deviceAddress) {
+    halProbe_t *p = findProbe(deviceAddress);
+    request_t r = { p != NULL, millis() };
+    if (!p) return r;
+    p->latchedF = p->tempF;
+    conversionStartedAt = millis();
+    if (waitForConversion) halAdvanceMicros(millisToWaitForConversion(resolution) * 1000UL);
+    return r;
+}
+float DallasTemperature::getTempF(const uint8_t *deviceAddress) {
+    halAdvanceMicros(10UL * 1000UL); // Scratchpad read.
+    halProbe_t *p = findProbe(deviceAddress);
+    if (!p) return DEVICE_DISCONNECTED_F;
+    return p->latchedF;
+}
+float DallasTemperature::getTempC(const uint8_t *deviceAddress) {
+    float f = getTempF(deviceAddress);
+    if (f == (float) DEVICE_DISCONNECTED_F) return DEVICE_DISCONNECTED_C;
+    return (f - 32.0f) * 5.0f / 9.0f;
+}
+
+// ---------------------------------------------------------------------------------------------
+// SD card and IniFile
+// ---------------------------------------------------------------------------------------------
+SDClass SD;
+static char sdRoot[200] = ".";
+
+void halSetSdRoot(const char *path) { strlcpy(sdRoot, path, sizeof(sdRoot)); }
+
+const char *halSdPath(const char *filepath, char *destbuf, size_t destbufsize) {
+    while (*filepath == '/') filepath++;
+    snprintf(destbuf, destbufsize, "%s/%s", sdRoot, filepath);
+    return destbuf;
+}
+
+File::File(void *fp, void *dir, const char *path) : fp(fp), dir(dir) {
+    strlcpy(this->path, path, sizeof(this->path));
+    const char *slash = strrchr(path, '/');
+    strlcpy(fileName, slash ? slash + 1 : path, sizeof(fileName));
+}
+static unsigned long sdBlockUs = 0, sdWrites = 0, sdReads = 0;
+void halSetSdBlockCost(unsigned long us) { sdBlockUs = us; }
+unsigned long halSdBlockWrites(void) { return sdWrites; }
+unsigned long halSdBlockReads(void) { return sdReads; }
+void File::cacheUse(long block, bool forWrite, bool partial) {
+    if (block != cacheBlock) {
+        if (cacheDirty) { sdWrites++; halAdvanceMicros(sdBlockUs); }
+        cacheDirty = false;
+        if (!forWrite || partial) { sdReads++; halAdvanceMicros(sdBlockUs); }
+        cacheBlock = block;
+    }
+    if (forWrite) cacheDirty = true;
+}
+size_t File::write(const uint8_t *buf, size_t size) {
+    if (!fp) return 0;
+    fflush((FILE *) fp);
+    struct stat st; fstat(fileno((FILE *) fp), &st);
+    long end = st.st_size;
+    for (long pos = end; pos < end + (long) size; pos = (pos / 512 + 1) * 512) cacheUse(pos / 512, true, (pos % 512) != 0);
+    return fwrite(buf, 1, size, (FILE *) fp);
+}
+int File::read() {
+    if (!fp) return -1;
+    int c = fgetc((FILE *) fp);
+    return (c == EOF) ? -1 : c;
+}
+int File::read(void *buf, uint16_t nbyte) {
+    if (!fp) return -1;
+    long at = ftell((FILE *) fp);
+    for (long pos = at; pos < at + (long) nbyte; pos = (pos / 512 + 1) * 512) cacheUse(pos / 512, false, false);
+    return (int) fread(buf, 1, nbyte, (FILE *) fp);
+}
+int File::available() { return fp ? (int) (size() - position()) : 0; }
+void File::flush() {
+    if (!fp) return;
+    fflush((FILE *) fp);
+    if (cacheDirty) { sdWrites++; halAdvanceMicros(sdBlockUs); cacheDirty = false; }
+    sdReads++; sdWrites++; halAdvanceMicros(2 * sdBlockUs); // Directory entry: file size.
+}
+bool File::seek(uint32_t pos) { return fp && fseek((FILE *) fp, pos, SEEK_SET) == 0; }
+uint32_t File::position() { return fp ? (uint32_t) ftell((FILE *) fp) : 0; }
+uint32_t File::size() {
+    if (!fp) return 0;
+    struct stat st;
+    fflush((FILE *) fp);
+    return (fstat(fileno((FILE *) fp), &st) == 0) ? (uint32_t) st.st_size : 0;
+}
+void File::close() {
+    if (fp) fclose((FILE *) fp);
+    if (dir) closedir((DIR *) dir);
+    fp = NULL;
+    dir = NULL;
+}
+File File::openNextFile(uint8_t mode) {
+    (void) mode;
+    if (!dir) return File();
+    struct dirent *entry;
+    while ((entry = readdir((DIR *) dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char child[512];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (stat(child, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) return File(NULL, opendir(child), child);
+        return File(fopen(child, "rb"), NULL, child);
+    }
+    return File();
+}
+
+File SDClass::open(const char *filename, uint8_t mode) {
+    char path[256];
+    halSdPath(filename, path, sizeof(path));
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) return File(NULL, opendir(path), path);
+    FILE *fp = fopen(path, (mode & O_WRITE) ? "a+b" : "rb");
+    if (!fp) return File();
+    return File(fp, NULL, path);
+}
+bool SDClass::exists(const char *filepath) {
+    char path[256];
+    return access(halSdPath(filepath, path, sizeof(path)), F_OK) == 0;
+}
+bool SDClass::remove(const char *filepath) {
+    char path[256];
+    return unlink(halSdPath(filepath, path, sizeof(path))) == 0;
+}
+bool SDClass::mkdir(const char *filepath) {
+    char path[256];
+    return ::mkdir(halSdPath(filepath, path, sizeof(path)), 0755) == 0;
+}
+
+IniFile::IniFile(const char *filename, uint8_t mode, bool caseSensitive) {
+    (void) mode; (void) caseSensitive;
+    strlcpy(this->filename, filename, sizeof(this->filename));
+}
+bool IniFile::open(void) { isOpen = SD.exists(filename); return isOpen; }
+void IniFile::close(void) { isOpen = false; }
+bool IniFile::validate(char *buffer, size_t len) const { (void) buffer; (void) len; return isOpen; }
+
+static char *trim(char *s) {
+    while (isspace((unsigned char) *s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1])) *--end = '\0';
+    return s;
+}
+
+bool IniFile::getValue(const char *section, const char *key, char *buffer, size_t len) const {
+    if (!isOpen) return false;
+    char path[256];
+    FILE *fp = fopen(halSdPath(filename, path, sizeof(path)), "r");
+    if (!fp) return false;
+    char line[256];
+    bool inSection = false;
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), fp)) {
+        char *s = trim(line);
+        if (*s == '#' || *s == ';' || *s == '\0') continue;
+        if (*s == '[') {
+            char *end = strchr(s, ']');
+            if (end) *end = '\0';
+            inSection = (strcasecmp(s + 1, section) == 0);
+            continue;
+        }
+        if (!inSection) continue;
+        char *eq = strchr(s, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        if (strcasecmp(trim(s), key) != 0) continue;
+        strlcpy(buffer, trim(eq + 1), len);
+        found = true;
+    }
+    fclose(fp);
+    return found;
+}
+
+// ---------------------------------------------------------------------------------------------
+// RAM, as memory.cpp sees it. The firmware's malloc() is avr-libc's, more or less, on the heap in halRam[]: the
+// Makefile points its malloc/free/calloc/realloc here (through memory.cpp's wraps). The hal and drivers use the host's.
+// ---------------------------------------------------------------------------------------------
+uint8_t halRam[8192];
+uint8_t *halSP = halRam + sizeof(halRam) - 1;
+
+// memory.cpp's memoryPaint() runs from .init3, which the host doesn't have.
+__attribute__((constructor)) static void halPaintRam(void) { memset(halRam, 0xC5, sizeof(halRam)); }
+
+// avr-libc's malloc.c: each chunk is a size_t of its length followed by the data; free chunks hold the next one.
+struct __freelist {
+    size_t sz;
+    struct __freelist *nx;
+};
+extern "C" {
+extern char __heap_start;
+char *__brkval = 0;
+size_t __malloc_margin = 128;
+struct __freelist *__flp = 0;
+void *__wrap_malloc(size_t size);
+void __wrap_free(void *ptr);
+void *halMalloc(size_t len);
+void halFree(void *p);
+void *halCalloc(size_t nele, size_t size);
+void *halRealloc(void *ptr, size_t len);
+}
+
+static unsigned long halMallocCount = 0;
+static unsigned long halFreeCount = 0;
+static size_t halHeapTop = 0;
+
+// Best fit from the free list, else grow the heap up to __malloc_margin below the stack.
+void *halMalloc(size_t len)
+{
+    if (len < sizeof(struct __freelist) - sizeof(size_t)) len = sizeof(struct __freelist) - sizeof(size_t);
+
+    struct __freelist *best = NULL, **bestPrev = NULL;
+    for (struct __freelist **prev = &__flp; *prev; prev = &(*prev)->nx) {
+        if ((*prev)->sz < len) continue;
+        if (!best || ((*prev)->sz < best->sz)) {
+            best = *prev;
+            bestPrev = prev;
+        }
+    }
+    if (best) {
+        halMallocCount++;
+        if ((best->sz - len) < sizeof(struct __freelist)) {
+            *bestPrev = best->nx;
+            return &best->nx;
+        }
+        // Split, handing out the top end so the list entry stays put.
+        best->sz -= len + sizeof(size_t);
+        struct __freelist *chunk = (struct __freelist *) ((char *) &best->nx + best->sz);
+        chunk->sz = len;
+        return &chunk->nx;
+    }
+
+    char *top = __brkval ? __brkval : &__heap_start;
+    if ((top + sizeof(size_t) + len) > ((char *) halSP - __malloc_margin)) return NULL;
+    struct __freelist *chunk = (struct __freelist *) top;
+    chunk->sz = len;
+    __brkval = top + sizeof(size_t) + len;
+    if ((size_t) (__brkval - &__heap_start) > halHeapTop) halHeapTop = __brkval - &__heap_start;
+    halMallocCount++;
+    return &chunk->nx;
+}
+
+// Back onto the list in address order, merged with its neighbours; a free chunk on top of the heap gives it back.
+void halFree(void *p)
+{
+    if (!p) return;
+    halFreeCount++;
+    struct __freelist *chunk = (struct __freelist *) ((char *) p - sizeof(size_t));
+
+    struct __freelist **prev = &__flp, *before = NULL;
+    while (*prev && (*prev < chunk)) {
+        before = *prev;
+        prev = &(*prev)->nx;
+    }
+    chunk->nx = *prev;
+    *prev = chunk;
+    if (chunk->nx && (((char *) &chunk->nx + chunk->sz) == (char *) chunk->nx)) {
+        chunk->sz += sizeof(size_t) + chunk->nx->sz;
+        chunk->nx = chunk->nx->nx;
+    }
+    if (before && (((char *) &before->nx + before->sz) == (char *) chunk)) {
+        before->sz += sizeof(size_t) + chunk->sz;
+        before->nx = chunk->nx;
+        chunk = before;
+    }
+    if (!chunk->nx && (((char *) &chunk->nx + chunk->sz) == __brkval)) {
+        __brkval = (char *) chunk;
+        struct __freelist **last = &__flp;
+        while (*last != chunk) last = &(*last)->nx;
+        *last = NULL;
+        if (__brkval == &__heap_start) __brkval = 0;
+    }
+}
+
+void *halCalloc(size_t nele, size_t size)
+{
+    void *p = __wrap_malloc(nele * size);
+    if (p) memset(p, 0, nele * size);
+    return p;
+}
+
+void *halRealloc(void *ptr, size_t len)
+{
+    if (!ptr) return __wrap_malloc(len);
+    size_t sz = ((struct __freelist *) ((char *) ptr - sizeof(size_t)))->sz;
+    if (len <= sz) return ptr;
+    void *p = __wrap_malloc(len);
+    if (!p) return NULL;
+    memcpy(p, ptr, sz);
+    __wrap_free(ptr);
+    return p;
+}
+
+unsigned long halMallocs(void) { return halMallocCount; }
+unsigned long halFrees(void) { return halFreeCount; }
+size_t halHeapPeak(void) { return halHeapTop; }
@@ -0,0 +1,59 @@
+#ifndef _HOST_HAL_H_
+#define _HOST_HAL_H_
+/**
+ * Simulation controls for the host build (make host). The firmware never includes this; drivers (host/main.cpp) do.
+ */
+#include <Arduino.h>
+
+// Pins. Levels on INPUT pins are driven from here; OUTPUT pins follow digitalWrite().
+extern void halSetPin(uint8_t pin, uint8_t level);
+extern uint8_t halGetPin(uint8_t pin);
+
+// Simulated clock. Only delay() and halAdvanceMicros() move time.
+extern void halAdvanceMicros(unsigned long us);
+extern void halSchedulePin(uint8_t pin, uint8_t level, unsigned long at); // halSetPin() once micros() reaches "at", even mid-publish.
+
+// Network: link (cable) and broker availability.
+extern void halSetLink(bool up);
+extern void halSetBroker(bool up);
+extern void halDeliver(const char *topic, const char *payload); // Broker -> firmware (mqtt callback).
+extern const char *halLastWill(void); // "topic=message" from the last connect(), or "".
+extern void halSetTxRoom(int room); // EthernetClient::availableForWrite(). Default 2048 (a W5100 socket).
+extern void halSetPublishCost(unsigned long usPerByte); // Each publish blocks this long per byte. Default 0.
+
+typedef struct halPublish_t {
+    char topic[128];
+    char *payload; // NUL terminated, owned by the hal.
+    size_t length;
+    bool retained;
+    unsigned long at; // micros() when endPublish()/publish() returned.
+} halPublish_t;
+extern size_t halPublishCount(void);
+extern const halPublish_t *halPublishAt(size_t i);
+extern void halClearPublishes(void);
+extern unsigned long halPublishBytes(void); // Topic + payload bytes, since the last halClearPublishes().
+
+// Serial.
+extern void halSerialEcho(bool echo);        // Copy Serial output to stdout.
+extern unsigned long halSerialBytes(void);   // Bytes written to Serial so far.
+extern void halSerialInput(const char *s);   // Bytes for Serial.read().
+extern void halSetSerialUart(bool on);       // 1 = model the UART: 64 byte TX buffer at 115200 baud, write() blocks when full.
+extern unsigned long halSerialBlockedUs(void); // Time write() has spent blocked, with the UART modelled.
+
+// 1-Wire bus with virtual DS18x probes.
+extern int halAddProbe(const uint8_t address[8], float tempF);
+extern void halSetProbe(int probe, float tempF);
+extern void halRemoveProbe(int probe);
+
+// SD card root directory on the host.
+extern void halSetSdRoot(const char *path);
+extern void halSetSdBlockCost(unsigned long us); // Each 512 byte block read or written from/to the card. Default 0.
+extern unsigned long halSdBlockWrites(void);
+extern unsigned long halSdBlockReads(void);
+
+// The firmware's heap (in halRam[]), since boot.
+extern unsigned long halMallocs(void);
+extern unsigned long halFrees(void);
+extern size_t halHeapPeak(void); // Bytes above __heap_start, at most.
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * Runs the firmware on the host (make host), against the simulated hardware in hal.cpp, e.g.
+ *
+ *     build/host/guarduino -s 60 -p 70.5 -p 68 -t 24:5000 -c t ~/sdcard
+ *
+ * The directory is the SD card, with a CONFIG.INI (see CONFIG.INI.example). Serial goes to stdout, and so does
+ * every MQTT message as it's published: "MQTT <ms> <topic> [retained] <payload>".
+ * Time is simulated: each loop() pass takes HOST_PASS_US, plus whatever the firmware waits for.
+ *
+ *   -s seconds  how long to run (10)
+ *   -p tempF    add a DS18x probe reading tempF
+ *   -H pin      drive input pin HIGH (inputs start LOW)
+ *   -t pin:ms   flip input pin at ms (up to 8)
+ *   -c text     type text on Serial half a second before the end, e.g. "t" for statistics
+ *   -b          broker down
+ *   -q          don't echo Serial
+ *   -m          don't print MQTT messages
+ */
+#include <Arduino.h>
+#include <OneWire.h>
+#include <getopt.h>
+#include "hal.h"
+
+#define HOST_PASS_US 100
+
+extern void setup(void);
+extern void loop(void);
+
+
+static void printPublishes(size_t *printed)
+{
+    for (; *printed < halPublishCount(); (*printed)++) {
+        const halPublish_t *p = halPublishAt(*printed);
+        printf("MQTT %lu %s %s%s\n", p->at / 1000, p->topic, p->retained ? "retained " : "", p->payload);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned long seconds = 10;
+    const char *serialInput = NULL;
+    bool printMqtt = true;
+    bool echo = true;
+    int probes = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:p:H:t:c:bqm")) != -1) {
+        switch (opt) {
+            case 's':
+                seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 'p': {
+                uint8_t address[8] = { 0x28, (uint8_t) probes, 0, 0, 0, 0, 0, 0 };
+                address[7] = OneWire::crc8(address, 7);
+                halAddProbe(address, atof(optarg));
+                probes++;
+                break;
+            }
+            case 'H':
+                halSetPin(atoi(optarg), HIGH);
+                break;
+            case 't': {
+                int pin = atoi(optarg);
+                const char *at = strchr(optarg, ':');
+                if (!at) break;
+                halSchedulePin(pin, halGetPin(pin) ? LOW : HIGH, strtoul(at + 1, NULL, 10) * 1000UL);
+                break;
+            }
+            case 'c':
+                serialInput = optarg;
+                break;
+            case 'b':
+                halSetBroker(false);
+                break;
+            case 'q':
+                echo = false;
+                break;
+            case 'm':
+                printMqtt = false;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s seconds] [-p tempF]... [-H pin]... [-t pin:ms]... [-c text] [-b] [-q] [-m] [sdcard]\n", argv[0]);
+                return 2;
+        }
+    }
+    halSetSdRoot((optind < argc) ? argv[optind] : ".");
+    halSerialEcho(echo);
+
+    size_t printed = 0;
+    setup();
+    while (millis() < (seconds * 1000UL)) {
+        if (serialInput && (millis() + 500) >= (seconds * 1000UL)) {
+            halSerialInput(serialInput);
+            serialInput = NULL;
+        }
+        loop();
+        halAdvanceMicros(HOST_PASS_US);
+        if (printMqtt) printPublishes(&printed);
+    }
+
+    fprintf(stderr, "%lus: %zu MQTT messages, %lu bytes; %lu bytes to Serial\n",
+            seconds, halPublishCount(), halPublishBytes(), halSerialBytes());
+    return 0;
+}
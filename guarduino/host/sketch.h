@@ -0,0 +1,17 @@
+#ifndef _HOST_SKETCH_H_
+#define _HOST_SKETCH_H_
+/**
+ * arduino-cli generates prototypes for guarduino.ino's functions before compiling it; the host build
+ * includes these instead. Add any new function of guarduino.ino which is used before it's defined.
+ */
+#include <Arduino.h>
+bool pubsubReconnect(void);
+static void taskPins(void);
+static void taskPublish(void);
+static void taskMqtt(void);
+static void taskNetwork(void);
+static void taskHeartbeat(void);
+static void taskTemperature(void);
+static void taskLed(void);
+static void taskSerial(void);
+#endif
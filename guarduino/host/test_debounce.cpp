@@ -0,0 +1,288 @@
+/**
+ * Replays noisy input traces through debounce.cpp (make host runs this; make check for just the tests).
+ *
+ * A trace is a list of pin edges, in microseconds from its start. It's replayed one of two ways:
+ *
+ *   polled     loop() comes around every TEST_PASS_US and scans the pins (debounceRead()), as it does without PCINT
+ *   captured   loop() is stuck for the whole trace; each edge is captured as pinCapture.cpp's ISR would, and then
+ *              the captures are replayed (debounceApplyPort()) and the pins scanned, as taskPins() does
+ *
+ * Each time a sensor's reported reading changes is recorded, and checked against what should have been reported.
+ *
+ * Then the firmware is booted off a CONFIG.INI with the same sensors, and the polled traces are replayed through
+ * loop() (taskPins() and the MQTT queue), counting the state messages each one publishes: one bounce, one publish.
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include "hal.h"
+#include "../guarduino.h"
+
+#define TEST_PASS_US 100
+#define TEST_TICK_US (DEBOUNCE_TICK_MS * 1000UL)
+// debounce_ms 20 is 4 ticks, the first of them at most a tick after the edge: reported within [us, us + TEST_SETTLE_SLACK].
+#define TEST_SETTLED(us) ((us) + 20000 - TEST_TICK_US)
+#define TEST_SETTLE_SLACK (TEST_TICK_US + TEST_PASS_US)
+#define TEST_BOOT_MS 15000 // Connected, and the first discovery and state sweep all sent.
+
+extern void setup(void);
+extern void loop(void);
+
+typedef struct testEdge_t {
+    unsigned long atUs;
+    uint8_t pin;
+    uint8_t level;
+} testEdge_t;
+
+typedef struct testChange_t {
+    uint8_t reading; // sensorReadingIndex()
+    unsigned long atUs; // From the start of the trace.
+} testChange_t;
+
+// 22/23: PA0/PA1, polled. 62-65: PK0-PK3, which have pin change interrupts.
+static baseSensor_t testSensors[] = {
+    { door2,   22, 23, NULL, NULL, false, 20, 0 },
+    { motion2, 62, 63, NULL, NULL, false, 20, 0 },
+    { motion2, 64, 65, NULL, NULL, false, 0,  0 }, // debounce_ms = 0
+};
+#define TEST_DOOR 0
+#define TEST_MOTION 1
+#define TEST_MOTION_RAW 2
+
+static pinBitset_t reported; // As taskPins()'s oldPinReadings.
+static testChange_t changes[32];
+static int changeCount;
+static int failures = 0;
+
+
+static void testRecord(int sensor, uint8_t *last, unsigned long start)
+{
+    uint8_t reading = sensorReadingIndex(testSensors[sensor], &reported);
+    if (reading == *last) return;
+    *last = reading;
+    if (changeCount < (int) (sizeof(changes) / sizeof(changes[0]))) {
+        changes[changeCount].reading = reading;
+        changes[changeCount].atUs = micros() - start;
+    }
+    changeCount++;
+}
+
+
+/**
+ * Replay "edges" with a scan every pass, until "lengthUs". Records "sensor"'s changes.
+ */
+static void testPolled(int sensor, const testEdge_t *edges, int edgeCount, unsigned long lengthUs)
+{
+    unsigned long start = micros();
+    uint8_t last = sensorReadingIndex(testSensors[sensor], &reported);
+    int next = 0;
+    changeCount = 0;
+    while ((micros() - start) < lengthUs) {
+        for (; (next < edgeCount) && (edges[next].atUs <= (micros() - start)); next++) {
+            halSetPin(edges[next].pin, edges[next].level);
+        }
+        readSensors(&reported);
+        testRecord(sensor, &last, start);
+        halAdvanceMicros(TEST_PASS_US);
+    }
+}
+
+
+/**
+ * Capture "edges" with loop() stuck until "lengthUs", then replay the captures and scan. Records "sensor"'s changes.
+ */
+static void testCaptured(int sensor, const testEdge_t *edges, int edgeCount, unsigned long lengthUs)
+{
+    pinEvent_t events[64];
+    unsigned long start = micros();
+    uint8_t last = sensorReadingIndex(testSensors[sensor], &reported);
+    changeCount = 0;
+    for (int i = 0; i < edgeCount; i++) {
+        halAdvanceMicros((start + edges[i].atUs) - micros());
+        halSetPin(edges[i].pin, edges[i].level);
+        events[i].port = digitalPinToPort(edges[i].pin);
+        events[i].portValue = *portInputRegister(events[i].port);
+        events[i].at = micros();
+    }
+    halAdvanceMicros((start + lengthUs) - micros());
+
+    for (int i = 0; i < edgeCount; i++) {
+        debounceApplyPort(&reported, events[i].port, events[i].portValue, events[i].at);
+        testRecord(sensor, &last, start);
+    }
+    readSensors(&reported);
+    testRecord(sensor, &last, start);
+}
+
+
+/**
+ * Compare the recorded changes with "expected", each of which must have been reported within [atUs, atUs + slackUs].
+ */
+static void testExpect(const char *name, const testChange_t *expected, int expectedCount, unsigned long slackUs)
+{
+    bool ok = (changeCount == expectedCount);
+    for (int i = 0; ok && (i < expectedCount); i++) {
+        if (changes[i].reading != expected[i].reading) ok = false;
+        if ((changes[i].atUs < expected[i].atUs) || (changes[i].atUs > (expected[i].atUs + slackUs))) ok = false;
+    }
+    if (ok) {
+        printf("PASS %s\n", name);
+        return;
+    }
+
+    printf("FAIL %s: expected", name);
+    for (int i = 0; i < expectedCount; i++) printf(" %u@%luus", expected[i].reading, expected[i].atUs);
+    printf(", got");
+    for (int i = 0; (i < changeCount) && (i < (int) (sizeof(changes) / sizeof(changes[0]))); i++) {
+        printf(" %u@%luus", changes[i].reading, changes[i].atUs);
+    }
+    printf("\n");
+    failures++;
+}
+
+#define TEST_COUNT(a) ((int) (sizeof(a) / sizeof(a[0])))
+
+
+// A door opening: its "closed" contact (pin2) chatters open, then its "open" contact (pin1) chatters closed.
+// Straight from closed to open, without ever reporting "offline" (both open) on the way.
+static const testEdge_t doorOpening[] = {
+    { 1000, 23, LOW }, { 1300, 23, HIGH }, { 1800, 23, LOW }, { 2500, 23, HIGH }, { 3000, 23, LOW },
+    { 6000, 22, HIGH }, { 6400, 22, LOW }, { 7000, 22, HIGH },
+};
+static const testChange_t doorOpened[] = { { 2, TEST_SETTLED(7000) } };
+
+// Mains hum on a motion sensor's output: 2ms spikes, every 50ms.
+static const testEdge_t motionHum[] = {
+    { 0, 62, HIGH }, { 2000, 62, LOW }, { 50000, 62, HIGH }, { 52000, 62, LOW }, { 100000, 62, HIGH },
+    { 102000, 62, LOW }, { 150000, 62, HIGH }, { 152000, 62, LOW }, { 200000, 62, HIGH }, { 202000, 62, LOW },
+};
+
+// A 200ms PIR pulse, ringing at both ends.
+static const testEdge_t motionPulse[] = {
+    { 10000, 62, HIGH }, { 10200, 62, LOW }, { 10500, 62, HIGH },
+    { 210000, 62, LOW }, { 210300, 62, HIGH }, { 210600, 62, LOW },
+};
+static const testChange_t motionPulseSeen[] = { { 3, TEST_SETTLED(10500) }, { 1, TEST_SETTLED(210600) } };
+
+// 10ms: shorter than debounce_ms.
+static const testEdge_t motionBlip[] = { { 10000, 62, HIGH }, { 20000, 62, LOW } };
+
+// The same pulse on the undebounced motion sensor: every edge is reported, as it's scanned.
+static const testEdge_t motionRawPulse[] = {
+    { 10000, 64, HIGH }, { 10200, 64, LOW }, { 10500, 64, HIGH }, { 210000, 64, LOW },
+};
+static const testChange_t motionRawPulseSeen[] = { { 3, 10000 }, { 1, 10200 }, { 3, 10500 }, { 1, 210000 } };
+
+
+/**
+ * Replay "edges" through loop() until "lengthUs", and check "topic" was published to "expected" times.
+ */
+static void testLoop(const char *name, const char *topic, const testEdge_t *edges, int edgeCount,
+                     unsigned long lengthUs, int expected)
+{
+    unsigned long start = micros();
+    int next = 0;
+    halClearPublishes();
+    while ((micros() - start) < lengthUs) {
+        for (; (next < edgeCount) && (edges[next].atUs <= (micros() - start)); next++) {
+            halSetPin(edges[next].pin, edges[next].level);
+        }
+        loop();
+        halAdvanceMicros(TEST_PASS_US);
+    }
+
+    int published = 0;
+    for (size_t p = 0; p < halPublishCount(); p++) {
+        if (strcmp(halPublishAt(p)->topic, topic) == 0) published++;
+    }
+    if (published == expected) {
+        printf("PASS %s\n", name);
+        return;
+    }
+    printf("FAIL %s: expected %d publishes to %s, got %d\n", name, expected, topic, published);
+    failures++;
+}
+
+
+/**
+ * Boot the firmware with testSensors[] in its CONFIG.INI, and replay the polled traces through loop().
+ */
+static void testPublishes(void)
+{
+    char sd[] = "/tmp/guarduino-test-XXXXXX";
+    char path[64];
+    if (!mkdtemp(sd)) {
+        printf("FAIL publishes: no SD card in /tmp\n");
+        failures++;
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/CONFIG.INI", sd);
+    FILE *fp = fopen(path, "w");
+    if (fp) {
+        fprintf(fp, "[network]\nmacaddress = 00:EA:BB:CC:15:78\nmqtt_address = 192.168.15.6\nmqtt_port = 1883\n"
+                    "mqtt_username = homeassistant\nmqtt_password = secret\n"
+                    "\n[sensor0]\ntype = door2\npin1 = 22\npin2 = 23\ndebounce_ms = 20\n"
+                    "\n[sensor1]\ntype = motion2\npin1 = 62\npin2 = 63\ndebounce_ms = 20\n"
+                    "\n[sensor2]\ntype = motion2\npin1 = 64\npin2 = 65\ndebounce_ms = 0\n");
+        fclose(fp);
+    }
+
+    halSetSdRoot(sd);
+    halSetPin(22, LOW);
+    halSetPin(23, HIGH);
+    halSetPin(62, LOW);
+    halSetPin(64, LOW);
+    setup();
+    unsigned long bootedAt = millis();
+    while ((millis() - bootedAt) < TEST_BOOT_MS) {
+        loop();
+        halAdvanceMicros(TEST_PASS_US);
+    }
+    unlink(path);
+    rmdir(sd);
+
+    static const char doorTopic[] = "aha/sensor/Arduino_CC1578/door_2223_CC1578/state";
+    static const char motionTopic[] = "aha/sensor/Arduino_CC1578/motion_6263_CC1578/state";
+    static const char motionRawTopic[] = "aha/sensor/Arduino_CC1578/motion_6465_CC1578/state";
+    testLoop("door_opening_published", doorTopic, doorOpening, TEST_COUNT(doorOpening), 500000, 1);
+    testLoop("motion_hum_published", motionTopic, motionHum, TEST_COUNT(motionHum), 500000, 0);
+    testLoop("motion_pulse_published", motionTopic, motionPulse, TEST_COUNT(motionPulse), 500000, 2);
+    testLoop("motion_blip_published", motionTopic, motionBlip, TEST_COUNT(motionBlip), 500000, 0);
+    testLoop("motion_undebounced_published", motionRawTopic, motionRawPulse, TEST_COUNT(motionRawPulse), 500000, 4);
+}
+
+
+int main(void)
+{
+    halSerialEcho(false);
+    halSetPin(22, LOW);
+    halSetPin(23, HIGH);
+    halSetPin(63, HIGH);
+    halSetPin(65, HIGH);
+    setupSensors(testSensors, sizeof(testSensors));
+    pinBitsetClear(&reported);
+    readSensors(&reported);
+    halAdvanceMicros(TEST_TICK_US / 3); // Start the traces off the tick boundaries.
+
+    testPolled(TEST_DOOR, doorOpening, TEST_COUNT(doorOpening), 500000);
+    testExpect("door_opening_polled", doorOpened, TEST_COUNT(doorOpened), TEST_SETTLE_SLACK);
+
+    testPolled(TEST_MOTION, motionHum, TEST_COUNT(motionHum), 500000);
+    testExpect("motion_hum_polled", NULL, 0, 0);
+    testCaptured(TEST_MOTION, motionHum, TEST_COUNT(motionHum), 500000);
+    testExpect("motion_hum_captured", NULL, 0, 0);
+
+    testPolled(TEST_MOTION, motionPulse, TEST_COUNT(motionPulse), 500000);
+    testExpect("motion_pulse_polled", motionPulseSeen, TEST_COUNT(motionPulseSeen), TEST_SETTLE_SLACK);
+    testCaptured(TEST_MOTION, motionPulse, TEST_COUNT(motionPulse), 1000000);
+    testExpect("motion_pulse_captured", motionPulseSeen, TEST_COUNT(motionPulseSeen), 1000000);
+
+    testCaptured(TEST_MOTION, motionBlip, TEST_COUNT(motionBlip), 1000000);
+    testExpect("motion_blip_captured", NULL, 0, 0);
+
+    testPolled(TEST_MOTION_RAW, motionRawPulse, TEST_COUNT(motionRawPulse), 500000);
+    testExpect("motion_undebounced_polled", motionRawPulseSeen, TEST_COUNT(motionRawPulseSeen), TEST_PASS_US);
+
+    testPublishes();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+/**
+ * jsonWriter.cpp's documents, byte for byte (make host runs this; make check for just the tests).
+ *
+ * Each document is checked three ways: jsonLength() is what jsonWrite() then sends, jsonWrite() says it sent
+ * that much, and what it sent is exactly the expected text. Then the firmware is booted, and the discovery and
+ * state documents it publishes are compared with what Home Assistant has always been sent.
+ */
+#include <Arduino.h>
+#include <OneWire.h>
+#include <unistd.h>
+#include "hal.h"
+#include "../guarduino.h"
+
+#define TEST_RUN_MS 15000
+
+extern void setup(void);
+extern void loop(void);
+
+static int failures = 0;
+
+
+// A Print which keeps what's written to it.
+class testCapture : public Print {
+  public:
+    char text[4096];
+    size_t length = 0;
+    size_t write(uint8_t c) override {
+        if (length < sizeof(text)) text[length++] = (char) c;
+        return 1;
+    }
+    using Print::write;
+};
+
+
+static void testResult(const char *name, bool ok, const char *expected, const char *got, size_t gotLength)
+{
+    if (ok) {
+        printf("PASS %s\n", name);
+        return;
+    }
+    printf("FAIL %s:\n  expected %s\n  got      %.*s\n", name, expected, (int) gotLength, got);
+    failures++;
+}
+
+
+static void testDocument(const char *name, const jsonWriter_t *writer, const char *expected)
+{
+    testCapture out;
+    size_t length = jsonLength(writer);
+    size_t sent = jsonWrite(writer, out);
+    bool ok = (length == strlen(expected)) && (sent == length) && (out.length == length) &&
+              (memcmp(out.text, expected, length) == 0);
+    if (!ok) printf("  jsonLength() %zu, jsonWrite() %zu, wrote %zu\n", length, sent, out.length);
+    testResult(name, ok, expected, out.text, out.length);
+}
+
+
+static void testLiterals(void)
+{
+    jsonWriter_t writer;
+    jsonBegin(&writer);
+    jsonLiteral(&writer, "{\"a\":");
+    jsonLiteral_P(&writer, PSTR("1,\"b\":\""));
+    jsonString(&writer, "two");
+    jsonLiteral(&writer, NULL); // Skipped, as are NULL strings.
+    jsonString_P(&writer, NULL);
+    jsonLiteral_P(&writer, PSTR("\"}"));
+    testDocument("literals", &writer, "{\"a\":1,\"b\":\"two\"}");
+
+    jsonBegin(&writer);
+    testDocument("empty", &writer, "");
+}
+
+
+static void testEscapes(void)
+{
+    // Quotes, backslashes and every control character; DEL and UTF-8 go out as they are.
+    static const char raw[] = "q\"b\\s/\b\f\n\r\t\x01\x1f\x7f\xc3\xa9.";
+    static const char escaped[] = "q\\\"b\\\\s/\\b\\f\\n\\r\\t\\u0001\\u001f\x7f\xc3\xa9.";
+    jsonWriter_t writer;
+
+    jsonBegin(&writer);
+    jsonString(&writer, raw);
+    testDocument("escapes", &writer, escaped);
+
+    jsonBegin(&writer);
+    jsonString_P(&writer, PSTR("q\"b\\s/\b\f\n\r\t\x01\x1f\x7f\xc3\xa9."));
+    testDocument("escapes_P", &writer, escaped);
+
+    char controls[32];
+    char expected[(31 * 6) + 1] = "";
+    for (int c = 1; c < 32; c++) {
+        controls[c - 1] = (char) c;
+        const char *shortForm = NULL;
+        switch (c) {
+            case '\b': shortForm = "\\b"; break;
+            case '\f': shortForm = "\\f"; break;
+            case '\n': shortForm = "\\n"; break;
+            case '\r': shortForm = "\\r"; break;
+            case '\t': shortForm = "\\t"; break;
+        }
+        char one[7];
+        if (shortForm) strlcpy(one, shortForm, sizeof(one));
+        else snprintf(one, sizeof(one), "\\u%04x", c);
+        strlcat(expected, one, sizeof(expected));
+    }
+    controls[31] = '\0';
+    jsonBegin(&writer);
+    jsonString(&writer, controls);
+    testDocument("escapes_controls", &writer, expected);
+}
+
+
+// jsonWrite() copies flash out 32 bytes (a string piece: 31) at a time.
+static void testFlashChunks(void)
+{
+    jsonWriter_t writer;
+
+    jsonBegin(&writer);
+    jsonLiteral_P(&writer, PSTR("0123456789abcdef0123456789abcdef"));
+    testDocument("flash_literal_32", &writer, "0123456789abcdef0123456789abcdef");
+
+    jsonBegin(&writer);
+    jsonLiteral_P(&writer, PSTR("{\"long\":\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef!\"}"));
+    testDocument("flash_literal_75", &writer,
+                 "{\"long\":\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef!\"}");
+
+    // Escapes on both sides of each chunk boundary.
+    jsonBegin(&writer);
+    jsonString_P(&writer, PSTR("\"23456789abcdef0123456789abcde\"\"\"3456789abcdef0123456789abcd\"\n\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\""));
+    testDocument("flash_string_chunks", &writer,
+                 "\\\"23456789abcdef0123456789abcde\\\"\\\"\\\"3456789abcdef0123456789abcd\\\"\\n"
+                 "\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"\\\"");
+}
+
+
+static void testOverflow(void)
+{
+    jsonWriter_t writer;
+    jsonBegin(&writer);
+    for (int i = 0; i < JSON_MAX_PIECES; i++) jsonLiteral_P(&writer, PSTR("x"));
+    bool full = !writer.overflow;
+    jsonLiteral_P(&writer, PSTR("y"));
+    bool ok = full && writer.overflow && (writer.count == JSON_MAX_PIECES) && !jsonPublish(&writer, "test", false);
+    testResult("overflow", ok, "refused", "accepted", 8);
+}
+
+
+#define TEST_DEVICE "{\"identifiers\":[\"Arduino_CC1578\"], \"name\":\"Arduino_CC1578\", \"model\":\"192.168.15.77\", " \
+    "\"hw_version\":\"Mega 2560\", \"manufacturer\":\"https://github.com/mkachline/guarduino/\", " \
+    "\"sw_version\":\"" SOFTWARE_VERSION "\", \"connections\":[[\"mac\",\"00:EA:BB:CC:15:78\"],[\"ip\", \"192.168.15.77\"]]}"
+
+typedef struct testPayload_t {
+    const char *topic;
+    bool retained;
+    const char *payload;
+} testPayload_t;
+
+static const testPayload_t testPayloads[] = {
+    { "homeassistant/sensor/door_2223_CC1578/config", true,
+      "{\"name\":\"Arduino_CC1578 Door NOPin:22 NCPin:23\",\"unique_id\":\"Arduino_CC1578_door_2223_CC1578\","
+      "\"object_id\":\"Arduino_CC1578_door_2223_CC1578\",\"state_topic\":\"aha/sensor/Arduino_CC1578/door_2223_CC1578/state\","
+      "\"device_class\":null,\"availability_topic\":\"aha/sensor/Arduino_CC1578/availability\","
+      "\"value_template\":\"{{ value_json.state }}\",\"json_attributes_topic\":\"aha/sensor/Arduino_CC1578/door_2223_CC1578/state\","
+      "\"device\":" TEST_DEVICE "}" },
+    { "aha/sensor/Arduino_CC1578/door_2223_CC1578/state", false, "{\"state\":\"closed\",\"icon\":\"mdi:door-closed\"}" },
+    { "homeassistant/sensor/motion_2425_CC1578/config", true,
+      "{\"name\":\"Arduino_CC1578 Motion Pin:24 PwrSns:25\",\"unique_id\":\"Arduino_CC1578_motion_2425_CC1578\","
+      "\"object_id\":\"Arduino_CC1578_motion_2425_CC1578\",\"state_topic\":\"aha/sensor/Arduino_CC1578/motion_2425_CC1578/state\","
+      "\"device_class\":null,\"availability_topic\":\"aha/sensor/Arduino_CC1578/availability\","
+      "\"value_template\":\"{{ value_json.state }}\",\"json_attributes_topic\":\"aha/sensor/Arduino_CC1578/motion_2425_CC1578/state\","
+      "\"device\":" TEST_DEVICE "}" },
+    { "aha/sensor/Arduino_CC1578/motion_2425_CC1578/state", false, "{\"state\":\"quiet\",\"icon\":\"mdi:meditation\"}" },
+    { "homeassistant/switch/switch_26_CC1578/config", true,
+      "{\"name\":\"Arduino_CC1578 Switch Pin:26\",\"unique_id\":\"Arduino_CC1578_switch_26_CC1578\","
+      "\"object_id\":\"Arduino_CC1578_switch_26_CC1578\",\"state_topic\":\"aha/switch/Arduino_CC1578/switch_26_CC1578/state\","
+      "\"command_topic\":\"aha/switch/Arduino_CC1578/cmd\",\"optimistic\":false,\"payload_off\":\"switch_26-OFF\","
+      "\"payload_on\":\"switch_26-ON\",\"state_off\":\"OFF\",\"state_on\":\"ON\",\"device_class\":\"switch\","
+      "\"availability_topic\":\"aha/sensor/Arduino_CC1578/availability\",\"value_template\":\"{{ value_json.state }}\","
+      "\"json_attributes_topic\":\"aha/switch/Arduino_CC1578/switch_26_CC1578/state\",\"device\":" TEST_DEVICE "}" },
+    { "aha/switch/Arduino_CC1578/switch_26_CC1578/state", false, "{\"state\":\"OFF\",\"icon\":\"mdi:light-switch-off\"}" },
+    { "homeassistant/sensor/280000000000001e/config", true,
+      "{\"name\":\"280000000000001e\", \"device_class\":\"temperature\", \"force_update\":true, "
+      "\"suggested_display_precision\":2, \"expire_after\":300,\"state_topic\":\"aha/sensor/Arduino_CC1578/280000000000001e/state\","
+      "\"availability_topic\":\"aha/sensor/Arduino_CC1578/availability\", \"value_template\":\"{{ value_json.temperature }}\", "
+      "\"json_attributes_topic\":\"aha/sensor/Arduino_CC1578/280000000000001e/state\",\"unique_id\":\"280000000000001e\","
+      "\"device\": " TEST_DEVICE "}" },
+    { "aha/sensor/Arduino_CC1578/280000000000001e/state", false, "{\"temperature\":70.50,\"icon\":\"mdi:thermometer\"}" },
+};
+
+
+/**
+ * Boot the firmware off a CONFIG.INI with one sensor of each kind and a DS18x probe, and check what it publishes.
+ * The host PubSubClient aborts if a streamed publish doesn't send the length it announced.
+ */
+static void testPublished(void)
+{
+    char sd[] = "/tmp/guarduino-test-XXXXXX";
+    char path[64];
+    if (!mkdtemp(sd)) {
+        testResult("payloads", false, "an SD card in /tmp", "none", 4);
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/CONFIG.INI", sd);
+    FILE *fp = fopen(path, "w");
+    if (fp) {
+        fprintf(fp, "[network]\nmacaddress = 00:EA:BB:CC:15:78\nmqtt_address = 192.168.15.6\nmqtt_port = 1883\n"
+                    "mqtt_username = homeassistant\nmqtt_password = secret\n"
+                    "\n[sensor0]\ntype = door2\npin1 = 22\npin2 = 23\n"
+                    "\n[sensor1]\ntype = motion2\npin1 = 24\npin2 = 25\n"
+                    "\n[sensor2]\ntype = switch1\npin1 = 26\n");
+        fclose(fp);
+    }
+
+    halSetSdRoot(sd);
+    halSerialEcho(false);
+    halSetPin(23, HIGH); // Door closed.
+    halSetPin(25, HIGH); // Motion sensor powered, quiet.
+    uint8_t address[8] = { 0x28, 0, 0, 0, 0, 0, 0, 0 };
+    address[7] = OneWire::crc8(address, 7);
+    halAddProbe(address, 70.5);
+
+    setup();
+    while (millis() < TEST_RUN_MS) {
+        loop();
+        halAdvanceMicros(100);
+    }
+    unlink(path);
+    rmdir(sd);
+
+    for (size_t i = 0; i < (sizeof(testPayloads) / sizeof(testPayloads[0])); i++) {
+        const testPayload_t *want = &testPayloads[i];
+        const halPublish_t *got = NULL;
+        for (size_t p = 0; p < halPublishCount(); p++) {
+            if (strcmp(halPublishAt(p)->topic, want->topic) == 0) got = halPublishAt(p);
+        }
+        char name[128];
+        snprintf(name, sizeof(name), "payload %s", want->topic);
+        if (!got) {
+            testResult(name, false, want->payload, "(not published)", 15);
+            continue;
+        }
+        bool ok = (got->retained == want->retained) && (got->length == strlen(want->payload)) &&
+                  (memcmp(got->payload, want->payload, got->length) == 0);
+        testResult(name, ok, want->payload, got->payload, got->length);
+    }
+}
+
+
+int main(void)
+{
+    testLiterals();
+    testEscapes();
+    testFlashChunks();
+    testOverflow();
+    testPublished();
+    return failures ? 1 : 0;
+}
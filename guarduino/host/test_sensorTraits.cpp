@@ -0,0 +1,242 @@
+/**
+ * sensorTraits.cpp's table against the per-type switches it replaced (make host runs this; make check for just the tests).
+ *
+ * The old*() functions below are those switches, as baseSensor.cpp and SDConfig.cpp had them, plus the rules added
+ * since in their terms: a two-pin sensor's fault and offline states need confirming (debounce.cpp), and "offline"
+ * is published. Every sensor type, with both of its pins at each level, must come out of the table the same.
+ */
+#include <Arduino.h>
+#include "hal.h"
+#include "../guarduino.h"
+
+#define TEST_PIN1 22
+#define TEST_PIN2 23
+
+static int failures = 0;
+static int checks = 0;
+
+
+static sensorStates oldStateEnum(sensorType type, bool pin1data, bool pin2data)
+{
+    sensorStates theState = unknown;
+    switch (type) {
+        // Door2 and Window2: "pin1" is "no" aka "normally open", "pin2" is "nc" aka "normally closed"
+        case door2:
+            if (pin1data && pin2data) theState = door2_fault;
+            if (pin1data && !pin2data) theState = door2_open;
+            if (!pin1data && pin2data) theState = door2_closed;
+            if (!pin1data && !pin2data) theState = door2_offline;
+            break;
+        case garagedoor2:
+            if (pin1data && pin2data) theState = garagedoor2_fault;
+            if (pin1data && !pin2data) theState = garagedoor2_open;
+            if (!pin1data && pin2data) theState = garagedoor2_closed;
+            if (!pin1data && !pin2data) theState = garagedoor2_offline;
+            break;
+        case window2:
+            if (pin1data && pin2data) theState = window2_fault;
+            if (pin1data && !pin2data) theState = window2_open;
+            if (!pin1data && pin2data) theState = window2_closed;
+            if (!pin1data && !pin2data) theState = window2_offline;
+            break;
+        // Motion2: "pin1" is "data", pin2 is "power sense"
+        case motion2:
+        case motion2_laser:
+            if (pin1data && pin2data) theState = motion2_motion;
+            if (pin1data && !pin2data) theState = motion2_fault;
+            if (!pin1data && pin2data) theState = motion2_quiet;
+            if (!pin1data && !pin2data) theState = motion2_offline;
+            break;
+        // Switch1: "pin1" is "switch status", "pin2" is unused.
+        case switch1:
+        case switch1_radiator:
+        case switch1_fan:
+        case switch1_fire:
+        case switch1_alarmlight:
+            theState = pin1data ? switch1_on : switch1_off;
+            break;
+        default:
+            break;
+    }
+    return theState;
+}
+
+
+static bool oldOffline(sensorStates theState)
+{
+    return (theState == door2_offline) || (theState == garagedoor2_offline) || (theState == window2_offline) ||
+           (theState == motion2_offline);
+}
+
+
+static bool oldFault(sensorStates theState)
+{
+    return (theState == door2_fault) || (theState == garagedoor2_fault) || (theState == window2_fault) ||
+           (theState == motion2_fault);
+}
+
+
+static bool oldReportable(sensorStates theState)
+{
+    return (theState != unknown) && !oldOffline(theState);
+}
+
+
+static const char *oldStateName(sensorType type, sensorStates theState)
+{
+    switch (type) {
+        case door2:
+        case garagedoor2:
+        case window2:
+        case motion2:
+            switch (theState) {
+                case door2_open: case garagedoor2_open: case window2_open: return "open";
+                case door2_closed: case garagedoor2_closed: case window2_closed: return "closed";
+                case door2_fault: case garagedoor2_fault: case window2_fault: return "wiringfault";
+                case door2_offline: case garagedoor2_offline: case window2_offline: case motion2_offline: return "offline";
+                case motion2_motion: return "motion";
+                case motion2_quiet: return "quiet";
+                case motion2_fault: return "motion-fault";
+                default: break;
+            }
+            break;
+        case switch1:
+        case switch1_radiator:
+        case switch1_fan:
+        case switch1_fire:
+        case switch1_alarmlight:
+            if (theState == switch1_on) return "ON";
+            if (theState == switch1_off) return "OFF";
+            break;
+        default:
+            break;
+    }
+    return "unknown";
+}
+
+
+static const char *oldStateIcon(sensorType type, sensorStates theState)
+{
+    if (oldFault(theState)) return "mdi:alert-circle-outline";
+    if (oldOffline(theState)) return "mdi:power-plug-off";
+    bool on = (theState == switch1_on);
+    switch (type) {
+        case door2: return (theState == door2_open) ? "mdi:door-open" : "mdi:door-closed";
+        case garagedoor2: return (theState == garagedoor2_open) ? "mdi:garage-open" : "mdi:garage";
+        case window2: return (theState == window2_open) ? "mdi:window-open" : "mdi:window-closed";
+        case motion2: return (theState == motion2_motion) ? "mdi:motion-sensor" : "mdi:meditation";
+        case motion2_laser: return (theState == motion2_motion) ? "mdi:motion-sensor" : "mdi:laser-pointer";
+        case switch1: return on ? "mdi:light-switch" : "mdi:light-switch-off";
+        case switch1_radiator: return on ? "mdi:radiator" : "mdi:radiator-off";
+        case switch1_fan: return on ? "mdi:fan" : "mdi:fan-off";
+        case switch1_fire: return on ? "mdi:fire" : "mdi:fire-off";
+        case switch1_alarmlight: return on ? "mdi:alarm-light-outline" : "mdi:alarm-light-off";
+        default: return "mdi:help-circle";
+    }
+}
+
+
+typedef struct oldType_t {
+    sensorType type;
+    const char *typeName;      // SDConfig.cpp's sensorTypeFromString()
+    const char *namePrefix;    // buildSensorName()
+    const char *plainName;     // mqttSensorDiscovery(), for device "dev", pins 22 and 23
+    const char *component;     // getSensorDiscoveryTopic()
+    uint8_t pinCount;
+    uint8_t direction;         // setupSensors()
+    heartbeatClass heartbeat;
+} oldType_t;
+
+static const oldType_t oldTypes[] = {
+    { door2,              "door2",              "door",       "dev Door NOPin:22 NCPin:23",       "sensor", 2, INPUT,  heartbeat_contact },
+    { garagedoor2,        "garagedoor2",        "garagedoor", "dev GarageDoor NOPin:22 NCPin:23", "sensor", 2, INPUT,  heartbeat_contact },
+    { window2,            "window2",            "window",     "dev Window NOPin:22 NCPin:23",     "sensor", 2, INPUT,  heartbeat_contact },
+    { motion2,            "motion2",            "motion",     "dev Motion Pin:22 PwrSns:23",      "sensor", 2, INPUT,  heartbeat_motion },
+    { motion2_laser,      "motion2_laser",      "laser",      "dev Laser Pin:22 PwrSns:23",       "sensor", 2, INPUT,  heartbeat_motion },
+    { switch1,            "switch1",            "switch",     "dev Switch Pin:22",                "switch", 1, OUTPUT, heartbeat_switch },
+    { switch1_radiator,   "switch1_radiator",   "switch",     "dev RadiatorSwitch Pin:22",        "switch", 1, OUTPUT, heartbeat_switch },
+    { switch1_fan,        "switch1_fan",        "switch",     "dev FanSwitch Pin:22",             "switch", 1, OUTPUT, heartbeat_switch },
+    { switch1_fire,       "switch1_fire",       "switch",     "dev FireSwitch Pin:22",            "switch", 1, OUTPUT, heartbeat_switch },
+    { switch1_alarmlight, "switch1_alarmlight", "switch",     "dev AlarmSwitch Pin:22",           "switch", 1, OUTPUT, heartbeat_switch },
+};
+
+
+static void testCheck(bool ok, const char *what, const char *typeName, int pin1, int pin2)
+{
+    checks++;
+    if (ok) return;
+    if (pin1 < 0) printf("FAIL %s %s\n", typeName, what);
+    else printf("FAIL %s pin1=%d pin2=%d %s\n", typeName, pin1, pin2, what);
+    failures++;
+}
+
+
+static bool testStringsEqual(PGM_P got, const char *expected)
+{
+    if (!got || !expected) return got == expected;
+    return strcmp_P(expected, got) == 0;
+}
+
+
+static void testType(const oldType_t *old)
+{
+    char plainName[64];
+    const char *name = old->typeName;
+
+    testCheck(sensorTypeFromName(name, 20) == old->type, "sensorTypeFromName()", name, -1, -1);
+    testCheck(testStringsEqual(sensorTypeName(old->type), name), "sensorTypeName()", name, -1, -1);
+    testCheck(testStringsEqual(sensorNamePrefix(old->type), old->namePrefix), "sensorNamePrefix()", name, -1, -1);
+    testCheck(testStringsEqual(sensorComponent(old->type), old->component), "sensorComponent()", name, -1, -1);
+    testCheck(sensorIsSwitch(old->type) == (old->direction == OUTPUT), "sensorIsSwitch()", name, -1, -1);
+    testCheck(sensorPinCount(old->type) == old->pinCount, "sensorPinCount()", name, -1, -1);
+    testCheck(sensorPinDirection(old->type) == old->direction, "sensorPinDirection()", name, -1, -1);
+    testCheck(sensorHeartbeatClass(old->type) == old->heartbeat, "sensorHeartbeatClass()", name, -1, -1);
+    snprintf_P(plainName, sizeof(plainName), sensorDiscoveryNameFormat(old->type), "dev", TEST_PIN1, TEST_PIN2);
+    testCheck(strcmp(plainName, old->plainName) == 0, "sensorDiscoveryNameFormat()", name, -1, -1);
+
+    baseSensor_t sensor = { old->type, TEST_PIN1, TEST_PIN2, NULL, NULL, false, 0, 0 };
+    for (int pin1 = 0; pin1 <= 1; pin1++) {
+        for (int pin2 = 0; pin2 <= 1; pin2++) {
+            pinBitset_t readings;
+            pinBitsetClear(&readings);
+            if (pin1) readings.ports[digitalPinToPort(TEST_PIN1) - 1] |= digitalPinToBitMask(TEST_PIN1);
+            if (pin2) readings.ports[digitalPinToPort(TEST_PIN2) - 1] |= digitalPinToBitMask(TEST_PIN2);
+
+            sensorStates theState = oldStateEnum(old->type, pin1, pin2);
+            bool twoPin = (old->pinCount == 2);
+            testCheck(getSensorStateEnum(sensor, &readings) == theState, "getSensorStateEnum()", name, pin1, pin2);
+            testCheck(sensorStateReportable(sensor, &readings) == oldReportable(theState), "sensorStateReportable()", name, pin1, pin2);
+            testCheck(sensorStateOffline(sensor, &readings) == oldOffline(theState), "sensorStateOffline()", name, pin1, pin2);
+            testCheck(sensorStateNeedsConfirming(sensor, &readings) == (twoPin && (oldFault(theState) || oldOffline(theState))),
+                      "sensorStateNeedsConfirming()", name, pin1, pin2);
+            testCheck(testStringsEqual(getSensorStateName(sensor, &readings), oldStateName(old->type, theState)),
+                      "getSensorStateName()", name, pin1, pin2);
+            testCheck(testStringsEqual(getSensorStateIcon(sensor, &readings), oldStateIcon(old->type, theState)),
+                      "getSensorStateIcon()", name, pin1, pin2);
+        }
+    }
+}
+
+
+int main(void)
+{
+    for (size_t i = 0; i < (sizeof(oldTypes) / sizeof(oldTypes[0])); i++) testType(&oldTypes[i]);
+    static_assert(sizeof(oldTypes) / sizeof(oldTypes[0]) == sensorTypeCount - 1, "oldTypes[] needs every sensorType but unused");
+
+    // Unused/reserved, and anything CONFIG.INI might say that isn't a type.
+    baseSensor_t unusedSensor = { unused, TEST_PIN1, TEST_PIN2, NULL, NULL, false, 0, 0 };
+    pinBitset_t readings;
+    memset(&readings, 0xFF, sizeof(readings));
+    testCheck(sensorPinCount(unused) == 0, "sensorPinCount()", "unused", -1, -1);
+    testCheck(sensorComponent(unused) == NULL, "sensorComponent()", "unused", -1, -1);
+    testCheck(sensorNamePrefix(unused) == NULL, "sensorNamePrefix()", "unused", -1, -1);
+    testCheck(!sensorStateReportable(unusedSensor, &readings), "sensorStateReportable()", "unused", -1, -1);
+    testCheck(testStringsEqual(getSensorStateName(unusedSensor, &readings), "unknown"), "getSensorStateName()", "unused", -1, -1);
+    testCheck(sensorTypeFromName("door", 20) == unused, "sensorTypeFromName(\"door\")", "unused", -1, -1);
+    testCheck(sensorTypeFromName("switch1_", 20) == unused, "sensorTypeFromName(\"switch1_\")", "unused", -1, -1);
+    testCheck(sensorTypeFromName(NULL, 20) == unused, "sensorTypeFromName(NULL)", "unused", -1, -1);
+    testCheck(sensorPinCount((sensorType) sensorTypeCount) == 0, "sensorPinCount(out of range)", "unused", -1, -1);
+
+    if (!failures) printf("PASS sensor_traits (%d checks)\n", checks);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+#ifndef _HOST_ATOMIC_H_
+#define _HOST_ATOMIC_H_
+// Host "ISRs" run synchronously from the simulator, so an atomic block is just a block.
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 0
+#define ATOMIC_BLOCK(type) for (int _atomic_once = 1; _atomic_once; _atomic_once = 0)
+#endif
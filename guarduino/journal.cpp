@@ -0,0 +1,310 @@
+#include <SPI.h>
+#include <SD.h>
+#include <PubSubClient.h> // https://github.com/knolleary/pubsubclient/tree/master
+#include "guarduino.h"
+
+
+/**
+ * Append-only journal of sensor transitions on the SD card (optional, see JOURNAL_ENABLE in guarduino.h).
+ *
+ * Every transition sendChangedSensorsMQTT() sees becomes one 8 byte journalRecord_t. journalSensor() only
+ * puts it in a small RAM ring; journalRun() appends the ring to JOURNAL_FILE later, so a slow card never
+ * holds up the pins. The SD library writes the card a 512 byte sector at a time (from its one sector cache),
+ * so 64 records share each write. We flush() (the sector, and the file's size in the directory) when a
+ * sector fills, or once the oldest unflushed record is JOURNAL_FLUSH_MS old.
+ *
+ * Records made while we had no MQTT session are flagged JOURNAL_OFFLINE. Once we're connected, and the MQTT
+ * queue has nothing more urgent, they're replayed to getDeviceJournalTopic(), one per JOURNAL_REPLAY_MS.
+ * Catching up appends a JOURNAL_SENSOR_REPLAYED record; at boot we look back for the last of those, so what
+ * happened before a restart (say the power was cut while the network was down) is replayed too.
+ *
+ * tools/journalDecode.py prints the file on a PC.
+ */
+#if JOURNAL_ENABLE
+
+#define JOURNAL_SECTOR_RECORDS (512 / sizeof(journalRecord_t))
+#define JOURNAL_BOOT_SCAN (4 * JOURNAL_SECTOR_RECORDS) // How far back from the end setupJournal() looks for JOURNAL_SENSOR_REPLAYED.
+#define JOURNAL_REPLAY_BATCH 8 // Records read from the card at a time while replaying.
+
+static_assert(sizeof(journalRecord_t) == 8, "tools/journalDecode.py reads 8 byte records");
+static_assert((JOURNAL_RAM_RECORDS & (JOURNAL_RAM_RECORDS - 1)) == 0, "JOURNAL_RAM_RECORDS must be a power of two");
+static_assert(JOURNAL_RAM_RECORDS <= 128, "JOURNAL_RAM_RECORDS must fit the uint8_t ring indexes");
+
+static File journalFile;
+static bool journalOpen = false;
+static uint8_t journalBoot = 0;
+
+// Records waiting for journalRun(). Only loop() touches these.
+static journalRecord_t ring[JOURNAL_RAM_RECORDS];
+static uint8_t ringHead = 0;
+static uint8_t ringTail = 0;
+
+static uint32_t fileRecords = 0;     // Records in JOURNAL_FILE, flushed or not.
+static uint32_t replayNext = 0;      // First record not yet replayed (or passed over). Counts ring[] records too.
+static bool unflushed = false;
+static unsigned long unflushedSince = 0;
+static unsigned long lastReplayAt = 0;
+static bool replayedAny = false;     // Since the last JOURNAL_SENSOR_REPLAYED.
+
+static journalRecord_t replayBatch[JOURNAL_REPLAY_BATCH];
+static uint32_t replayBatchFirst = 0; // Record number of replayBatch[0].
+static uint8_t replayBatchCount = 0;
+
+static unsigned long journalAppended = 0;
+static unsigned long journalDropped = 0;  // Ring full, or the card failed.
+static unsigned long journalFlushes = 0;
+static unsigned long journalReplayed = 0;
+static unsigned long journalWorstUs = 0;
+
+
+static uint8_t journalWaiting(void)
+{
+  return (uint8_t) (ringHead - ringTail);
+}
+
+
+/**
+ * Put a record in the ring for journalRun() to write.
+ */
+static void journalAppend(uint8_t sensor, uint8_t state, uint8_t flags)
+{
+  if(! journalOpen) return;
+  if(journalWaiting() >= JOURNAL_RAM_RECORDS) {
+    journalDropped++;
+    return;
+  }
+
+  // Sent live, with nothing older waiting to be replayed: step replay past it rather than read it back.
+  if(! (flags & JOURNAL_OFFLINE) && (replayNext == (fileRecords + journalWaiting()))) replayNext++;
+
+  journalRecord_t *record = &ring[ringHead & (JOURNAL_RAM_RECORDS - 1)];
+  record->at = millis();
+  record->boot = journalBoot;
+  record->sensor = sensor;
+  record->state = state;
+  record->flags = flags;
+  ringHead++;
+}
+
+
+static bool journalRead(uint32_t recordNumber, journalRecord_t *records, uint8_t count)
+{
+  if(! journalFile.seek(recordNumber * sizeof(journalRecord_t))) return false;
+  size_t length = count * sizeof(journalRecord_t);
+  return journalFile.read(records, length) == (int) length;
+}
+
+
+/**
+ * Open (or start) JOURNAL_FILE, and find where replay got up to. Call once from setup(), after readSDConfig().
+ */
+void setupJournal(void)
+{
+  journalOpen = false;
+  if(! SD.begin(SDCARD_CS_PIN)) {
+    Serial.println(F("Journal: SD.begin() failed; not journalling."));
+    return;
+  }
+  journalFile = SD.open(JOURNAL_FILE, FILE_WRITE);
+  if(! journalFile) {
+    Serial.println(F("Journal: cannot open " JOURNAL_FILE "; not journalling."));
+    return;
+  }
+
+  // Only whole records are ever written, but if the card was pulled mid-write, pad it out so what follows lines up.
+  uint32_t size = journalFile.size();
+  if(size % sizeof(journalRecord_t)) {
+    uint8_t pad[sizeof(journalRecord_t)];
+    memset(pad, 0xFF, sizeof(pad));
+    journalFile.write(pad, sizeof(pad) - (size % sizeof(pad)));
+    journalFile.flush();
+    size = journalFile.size();
+  }
+  fileRecords = size / sizeof(journalRecord_t);
+
+  // Replay from the last JOURNAL_SENSOR_REPLAYED, if it isn't too far back. The last record says which boot this is.
+  replayNext = (fileRecords > JOURNAL_BOOT_SCAN) ? (fileRecords - JOURNAL_BOOT_SCAN) : 0;
+  journalBoot = 0;
+  journalRecord_t record;
+  for(uint32_t i = fileRecords; i > replayNext; i--) {
+    if(! journalRead(i - 1, &record, 1)) break;
+    if(i == fileRecords) journalBoot = record.boot + 1;
+    if(record.sensor == JOURNAL_SENSOR_REPLAYED) {
+      replayNext = i;
+      break;
+    }
+  }
+  replayBatchCount = 0;
+  journalOpen = true;
+
+  Serial.print(F("Journal: "));
+  Serial.print(fileRecords);
+  Serial.print(F(" records, boot "));
+  Serial.print(journalBoot);
+  Serial.print(F(", replaying from "));
+  Serial.println(replayNext);
+
+  journalAppend(JOURNAL_SENSOR_BOOT, 0, JOURNAL_OFFLINE);
+}
+
+
+/**
+ * Journal allSensors[sensor]'s new state, as read in "pinReadings".
+ */
+void journalSensor(uint8_t sensor, const pinBitset_t *pinReadings)
+{
+  baseSensor_t thisSensor = allSensors[sensor];
+  if(thisSensor.type == reserved) return;
+
+  uint8_t flags = sensorReadingIndex(thisSensor, pinReadings) & JOURNAL_READING_MASK;
+  if(! pubsubClient.connected()) flags |= JOURNAL_OFFLINE;
+  journalAppend(sensor, getSensorStateEnum(thisSensor, pinReadings), flags);
+}
+
+
+/**
+ * e.g. {"sensor":"door_2425_CC1578","state":"open","boot":3,"at":123456,"ago":4567}
+ * "at" is millis() at the time; "ago", how long before this was sent (only if we haven't restarted since).
+ */
+static bool journalPublish(const journalRecord_t *record)
+{
+  baseSensor_t thisSensor = allSensors[record->sensor];
+  char payload[128];
+  size_t length;
+
+  snprintf_P(payload, sizeof(payload), PSTR("{\"sensor\":\"%s\",\"state\":\""), getSensorName(thisSensor));
+  strlcat_P(payload, sensorStateNameAt(thisSensor.type, record->flags & JOURNAL_READING_MASK), sizeof(payload));
+  length = strlen(payload);
+  snprintf_P(payload + length, sizeof(payload) - length, PSTR("\",\"boot\":%u,\"at\":%lu"), record->boot, (unsigned long) record->at);
+  if(record->boot == journalBoot) {
+    length = strlen(payload);
+    snprintf_P(payload + length, sizeof(payload) - length, PSTR(",\"ago\":%lu"), (unsigned long) (millis() - record->at));
+  }
+  strlcat_P(payload, PSTR("}"), sizeof(payload));
+  return pubsubClient.publish(getDeviceJournalTopic(), payload, false);
+}
+
+
+/**
+ * Replay the next JOURNAL_OFFLINE record, if we're connected, nothing else is waiting to go, and
+ * JOURNAL_REPLAY_MS has passed. Records which went out live are passed over, a batch at most per call.
+ */
+static void journalReplay(unsigned long now)
+{
+  if(replayNext >= fileRecords) {
+    if(replayedAny && (journalWaiting() == 0)) {
+      replayedAny = false;
+      journalAppend(JOURNAL_SENSOR_REPLAYED, 0, 0);
+    }
+    return;
+  }
+  if(! pubsubClient.connected()) return;
+  if(mqttQueueDepth() > 0) return;
+  if((now - lastReplayAt) < JOURNAL_REPLAY_MS) return;
+
+  for(uint8_t looked = 0; (looked < JOURNAL_REPLAY_BATCH) && (replayNext < fileRecords); looked++) {
+    if((replayNext < replayBatchFirst) || (replayNext >= (replayBatchFirst + replayBatchCount))) {
+      uint32_t count = fileRecords - replayNext;
+      if(count > JOURNAL_REPLAY_BATCH) count = JOURNAL_REPLAY_BATCH;
+      replayBatchCount = 0;
+      if(! journalRead(replayNext, replayBatch, count)) return;
+      replayBatchFirst = replayNext;
+      replayBatchCount = count;
+    }
+
+    const journalRecord_t *record = &replayBatch[replayNext - replayBatchFirst];
+    bool replayable = (record->flags & JOURNAL_OFFLINE)
+      && (record->sensor < allSensorCount())
+      && (allSensors[record->sensor].type != reserved);
+    if(! replayable) {
+      replayNext++;
+      continue;
+    }
+
+    if(! journalPublish(record)) return; // Try it again next time.
+    replayNext++;
+    replayedAny = true;
+    journalReplayed++;
+    lastReplayAt = now;
+    return;
+  }
+}
+
+
+/**
+ * Write what's waiting in the ring to the card, flush when a sector fills (or JOURNAL_FLUSH_MS has passed),
+ * then replay one offline record if it's time to. Call every few ms; when there's nothing to do it doesn't
+ * touch the card.
+ */
+void journalRun(void)
+{
+  if(! journalOpen) return;
+  unsigned long startedAt = micros();
+  unsigned long now = millis();
+  bool sectorFilled = false;
+
+  while(journalWaiting() > 0) {
+    journalRecord_t *record = &ring[ringTail & (JOURNAL_RAM_RECORDS - 1)];
+    if(journalFile.write((const uint8_t *) record, sizeof(*record)) != sizeof(*record)) {
+      LOG(LOG_ERROR).println(F("Journal: write failed; not journalling."));
+      journalDropped += journalWaiting();
+      ringTail = ringHead;
+      journalFile.close();
+      journalOpen = false;
+      return;
+    }
+    ringTail++;
+    fileRecords++;
+    journalAppended++;
+    if(! unflushed) {
+      unflushed = true;
+      unflushedSince = now;
+    }
+    if((fileRecords % JOURNAL_SECTOR_RECORDS) == 0) sectorFilled = true;
+  }
+
+  if(unflushed && (sectorFilled || ((now - unflushedSince) >= JOURNAL_FLUSH_MS))) {
+    journalFile.flush();
+    journalFlushes++;
+    unflushed = false;
+  }
+
+  journalReplay(now);
+
+  unsigned long tookUs = micros() - startedAt;
+  if(tookUs > journalWorstUs) journalWorstUs = tookUs;
+}
+
+
+void journalPrintStats(void)
+{
+  Serial.print(F("Journal records="));
+  Serial.print(fileRecords);
+  Serial.print(F(" appended="));
+  Serial.print(journalAppended);
+  Serial.print(F(" waiting="));
+  Serial.print(journalWaiting());
+  Serial.print(F(" dropped="));
+  Serial.print(journalDropped);
+  Serial.print(F(" flushes="));
+  Serial.print(journalFlushes);
+  Serial.print(F(" replay="));
+  Serial.print(replayNext);
+  Serial.print(F(" replayed="));
+  Serial.print(journalReplayed);
+  Serial.print(F(" worst="));
+  Serial.print(journalWorstUs);
+  Serial.println(F("us"));
+}
+
+
+void journalResetStats(void)
+{
+  journalAppended = 0;
+  journalDropped = 0;
+  journalFlushes = 0;
+  journalReplayed = 0;
+  journalWorstUs = 0;
+}
+
+#endif /* JOURNAL_ENABLE */
@@ -0,0 +1,247 @@
+#include <avr/pgmspace.h>
+#include "guarduino.h"
+
+
+/**
+ * Streaming JSON writer for MQTT payloads.
+ *
+ * MQTT needs a payload's length before its first byte (beginPublish()). Rather than build the document
+ * twice (once to count, once to send) or into a big buffer, the builder records the document as a list of
+ * pieces: pointers to literal JSON text (RAM or flash) and to strings which need escaping. Nothing is copied.
+ * jsonLength() then adds the pieces up, and jsonPublish() streams them through beginPublish()/endPublish().
+ *
+ * Every piece must stay valid until jsonPublish() returns, so build and publish from the same function.
+ */
+#define JSON_PIECE_LITERAL 0   // RAM, sent as-is.
+#define JSON_PIECE_LITERAL_P 1 // Flash (PSTR), sent as-is.
+#define JSON_PIECE_STRING 2    // RAM, escaped.
+#define JSON_PIECE_STRING_P 3  // Flash, escaped.
+
+
+void jsonBegin(jsonWriter_t *writer)
+{
+  writer->count = 0;
+  writer->overflow = false;
+}
+
+
+static void jsonAdd(jsonWriter_t *writer, const char *text, uint8_t kind)
+{
+  if(! text) return;
+  if(writer->count >= JSON_MAX_PIECES) {
+    writer->overflow = true;
+    return;
+  }
+  writer->pieces[writer->count].text = text;
+  writer->pieces[writer->count].kind = kind;
+  writer->count++;
+}
+
+
+/**
+ * Literal JSON text, e.g. ",\"expire_after\":60". Sent exactly as given.
+ */
+void jsonLiteral(jsonWriter_t *writer, const char *text)
+{
+  jsonAdd(writer, text, JSON_PIECE_LITERAL);
+}
+
+
+/**
+ * As jsonLiteral(), for text in flash, e.g. jsonLiteral_P(writer, PSTR(",\"optimistic\":false")).
+ */
+void jsonLiteral_P(jsonWriter_t *writer, PGM_P text)
+{
+  jsonAdd(writer, text, JSON_PIECE_LITERAL_P);
+}
+
+
+/**
+ * The inside of a JSON string (the caller writes the quotes). Quotes, backslashes and control characters are escaped.
+ */
+void jsonString(jsonWriter_t *writer, const char *value)
+{
+  jsonAdd(writer, value, JSON_PIECE_STRING);
+}
+
+
+/**
+ * As jsonString(), for a string in flash (e.g. an icon name from getSensorStateIcon()).
+ */
+void jsonString_P(jsonWriter_t *writer, PGM_P value)
+{
+  jsonAdd(writer, value, JSON_PIECE_STRING_P);
+}
+
+
+/**
+ * Returns the escape sequence for "c", or NULL if "c" goes out as-is.
+ * Control characters without a short form come back as "u", and are sent as \u00XX.
+ */
+static inline const char *jsonEscape(char c)
+{
+  if(((uint8_t) c >= 0x20) && (c != '"') && (c != '\\')) return NULL; // Nearly everything we send.
+  switch(c) {
+    case '"':  return "\\\"";
+    case '\\': return "\\\\";
+    case '\b': return "\\b";
+    case '\f': return "\\f";
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\t': return "\\t";
+    default:
+      if((uint8_t) c < 0x20) return "u";
+      return NULL;
+  }
+}
+
+
+static size_t jsonStringLength(const char *value)
+{
+  size_t len = 0;
+  for(const char *p = value; *p; p++) {
+    const char *escape = jsonEscape(*p);
+    if(! escape) len += 1;
+    else if(escape[0] == 'u') len += 6;
+    else len += 2;
+  }
+  return len;
+}
+
+
+static size_t jsonStringLength_P(PGM_P value)
+{
+  size_t len = 0;
+  char c;
+  while((c = pgm_read_byte(value++))) {
+    const char *escape = jsonEscape(c);
+    if(! escape) len += 1;
+    else if(escape[0] == 'u') len += 6;
+    else len += 2;
+  }
+  return len;
+}
+
+
+/**
+ * Bytes jsonPublish() will send. Only string lengths are looked at; nothing is formatted.
+ */
+size_t jsonLength(const jsonWriter_t *writer)
+{
+  size_t len = 0;
+  for(uint8_t i = 0; i < writer->count; i++) {
+    const jsonPiece_t *piece = &writer->pieces[i];
+    switch(piece->kind) {
+      case JSON_PIECE_LITERAL:   len += strlen(piece->text); break;
+      case JSON_PIECE_LITERAL_P: len += strlen_P(piece->text); break;
+      case JSON_PIECE_STRING:    len += jsonStringLength(piece->text); break;
+      case JSON_PIECE_STRING_P:  len += jsonStringLength_P(piece->text); break;
+    }
+  }
+  return len;
+}
+
+
+/**
+ * Sends "value", escaped. Unescaped runs go out in one write().
+ */
+static size_t jsonWriteString(Print &out, const char *value)
+{
+  size_t sent = 0;
+  const char *run = value;
+  for(const char *p = value; ; p++) {
+    const char *escape = (*p) ? jsonEscape(*p) : NULL;
+    if((*p) && (! escape)) continue;
+
+    if(p > run) sent += out.write((const uint8_t *) run, p - run);
+    if(! *p) break;
+
+    if(escape[0] == 'u') {
+      char unicode[7];
+      snprintf(unicode, sizeof(unicode), "\\u%04x", (uint8_t) *p);
+      sent += out.write((const uint8_t *) unicode, 6);
+    } else {
+      sent += out.write((const uint8_t *) escape, 2);
+    }
+    run = p + 1;
+  }
+  return sent;
+}
+
+
+/**
+ * Sends every piece to "out" (pubsubClient, Serial, ...). Returns bytes sent.
+ */
+size_t jsonWrite(const jsonWriter_t *writer, Print &out)
+{
+  size_t sent = 0;
+  for(uint8_t i = 0; i < writer->count; i++) {
+    const jsonPiece_t *piece = &writer->pieces[i];
+    switch(piece->kind) {
+      case JSON_PIECE_LITERAL:
+        sent += out.write((const uint8_t *) piece->text, strlen(piece->text));
+        break;
+      case JSON_PIECE_LITERAL_P: {
+        // Out of flash a chunk at a time.
+        char chunk[32];
+        size_t remaining = strlen_P(piece->text);
+        PGM_P from = piece->text;
+        while(remaining > 0) {
+          size_t n = (remaining < sizeof(chunk)) ? remaining : sizeof(chunk);
+          memcpy_P(chunk, from, n);
+          sent += out.write((const uint8_t *) chunk, n);
+          from += n;
+          remaining -= n;
+        }
+        break;
+      }
+      case JSON_PIECE_STRING:
+        sent += jsonWriteString(out, piece->text);
+        break;
+      case JSON_PIECE_STRING_P: {
+        // Escaping is per character, so a chunk at a time works here too.
+        char chunk[32];
+        size_t remaining = strlen_P(piece->text);
+        PGM_P from = piece->text;
+        while(remaining > 0) {
+          size_t n = (remaining < (sizeof(chunk) - 1)) ? remaining : (sizeof(chunk) - 1);
+          memcpy_P(chunk, from, n);
+          chunk[n] = '\0';
+          sent += jsonWriteString(out, chunk);
+          from += n;
+          remaining -= n;
+        }
+        break;
+      }
+    }
+  }
+  return sent;
+}
+
+
+/**
+ * Publish the document to "topic" in one pass. Returns false (sending nothing) if the document had too many pieces.
+ */
+bool jsonPublish(const jsonWriter_t *writer, const char *topic, bool retained)
+{
+  if(writer->overflow) {
+    LOG(LOG_ERROR).print(F("jsonPublish(): more than "));
+    LOG(LOG_ERROR).print(JSON_MAX_PIECES);
+    LOG(LOG_ERROR).print(F(" pieces for "));
+    LOG(LOG_ERROR).println(topic);
+    return false;
+  }
+
+  size_t len = jsonLength(writer);
+  if(! pubsubClient.beginPublish(topic, len, retained)) return false;
+  size_t sent = jsonWrite(writer, pubsubClient);
+  pubsubClient.endPublish();
+  if(sent != len) {
+    LOG(LOG_ERROR).print(F("jsonPublish(): sent "));
+    LOG(LOG_ERROR).print(sent);
+    LOG(LOG_ERROR).print(F(" of "));
+    LOG(LOG_ERROR).println(len);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,151 @@
+#include <PubSubClient.h> // https://github.com/knolleary/pubsubclient/tree/master
+#include "guarduino.h"
+
+
+/**
+ * Edge-to-publish latency: from the pass of taskPins() which captured a sensor's transition (or the pin change
+ * interrupt, with PINCAPTURE_PCINT) to its state's publish() returning, i.e. handed to the W5x00.
+ *
+ * Each changed sensor remembers when its oldest unpublished transition was captured; publishing its state
+ * (or the AGGREGATE_STATE document) records the difference in a histogram of power of two buckets:
+ * bucket 0 is under LATENCY_BUCKET0_US, bucket N under LATENCY_BUCKET0_US << N, the last catches the rest.
+ * Percentiles are reported as the top of their bucket (or max, if that's lower), so they're never flattering.
+ *
+ * Transitions captured while we have no MQTT session aren't measured; they'd only tell us how long the
+ * broker was away (see network.cpp, and the journal).
+ *
+ * latencyEndWindow() closes a window (DIAGNOSTICS_PERIOD) for the diagnostic entities; 'l' on Serial prints
+ * the window in progress. Only closing a window clears it ('r' doesn't), so every one published is whole.
+ */
+#define LATENCY_BUCKETS 16
+#define LATENCY_BUCKET0_US 256UL // So the last bucket starts at 4.2s.
+
+static unsigned long capturedAt[sizeof(allSensors) / sizeof(allSensors[0])]; // micros(); 0 = nothing waiting.
+static unsigned long buckets[LATENCY_BUCKETS];
+static unsigned long windowCount = 0;
+static unsigned long windowMaxUs = 0;
+static latencySummary_t lastWindow = { };
+
+static void latencyStartWindow(void);
+
+
+/**
+ * allSensors[sensor] has a new state to publish, captured at micros() "changedAt". If an earlier one is still
+ * waiting, that's the one we're timing.
+ */
+void latencyChanged(uint8_t sensor, unsigned long changedAt)
+{
+  if(sensor >= (sizeof(capturedAt) / sizeof(capturedAt[0]))) return;
+  if(! pubsubClient.connected()) return;
+  if(capturedAt[sensor] != 0) return;
+  capturedAt[sensor] = changedAt ? changedAt : 1;
+}
+
+
+static uint8_t latencyBucket(unsigned long us)
+{
+  uint8_t bucket = 0;
+  for(unsigned long top = LATENCY_BUCKET0_US; (us >= top) && (bucket < (LATENCY_BUCKETS - 1)); top <<= 1) bucket++;
+  return bucket;
+}
+
+
+/**
+ * allSensors[sensor]'s state has just been published.
+ */
+void latencyPublished(uint8_t sensor)
+{
+  if(sensor >= (sizeof(capturedAt) / sizeof(capturedAt[0]))) return;
+  if(capturedAt[sensor] == 0) return;
+
+  unsigned long us = micros() - capturedAt[sensor];
+  capturedAt[sensor] = 0;
+  buckets[latencyBucket(us)]++;
+  windowCount++;
+  if(us > windowMaxUs) windowMaxUs = us;
+}
+
+
+/**
+ * The AGGREGATE_STATE document, with everyone in it, has just been published.
+ */
+void latencyPublishedAll(void)
+{
+  for(uint8_t sensor = 0; sensor < (sizeof(capturedAt) / sizeof(capturedAt[0])); sensor++) latencyPublished(sensor);
+}
+
+
+/**
+ * Stop timing whatever's waiting, e.g. when the session it was queued for has gone.
+ */
+void latencyForget(void)
+{
+  memset(capturedAt, '\0', sizeof(capturedAt));
+}
+
+
+/**
+ * Top of the bucket holding the "permille"th sample (500 = median), or the max if that's lower.
+ */
+static unsigned long latencyPercentile(unsigned int permille)
+{
+  if(windowCount == 0) return 0;
+  unsigned long rank = ((windowCount * permille) + 999) / 1000; // 1-based, rounded up.
+  unsigned long seen = 0;
+  for(uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    seen += buckets[bucket];
+    if(seen < rank) continue;
+    unsigned long top = LATENCY_BUCKET0_US << bucket;
+    return ((bucket < (LATENCY_BUCKETS - 1)) && (top < windowMaxUs)) ? top : windowMaxUs;
+  }
+  return windowMaxUs;
+}
+
+
+/**
+ * Summarise the window in progress into latencyLastWindow(), and start a new one.
+ */
+void latencyEndWindow(void)
+{
+  lastWindow.p50Us = latencyPercentile(500);
+  lastWindow.p99Us = latencyPercentile(990);
+  lastWindow.maxUs = windowMaxUs;
+  lastWindow.count = windowCount;
+  latencyStartWindow();
+}
+
+
+const latencySummary_t *latencyLastWindow(void)
+{
+  return &lastWindow;
+}
+
+
+void latencyPrintStats(void)
+{
+  Serial.print(F("Latency edge-to-publish count="));
+  Serial.print(windowCount);
+  Serial.print(F(" p50<"));
+  Serial.print(latencyPercentile(500));
+  Serial.print(F("us p99<"));
+  Serial.print(latencyPercentile(990));
+  Serial.print(F("us max="));
+  Serial.print(windowMaxUs);
+  Serial.println(F("us"));
+  for(uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    if(buckets[bucket] == 0) continue;
+    Serial.print(F("  <"));
+    if(bucket < (LATENCY_BUCKETS - 1)) Serial.print(LATENCY_BUCKET0_US << bucket);
+    else Serial.print(F("inf"));
+    Serial.print(F("us "));
+    Serial.println(buckets[bucket]);
+  }
+}
+
+
+static void latencyStartWindow(void)
+{
+  memset(buckets, '\0', sizeof(buckets));
+  windowCount = 0;
+  windowMaxUs = 0;
+}
@@ -0,0 +1,116 @@
+#include "guarduino.h"
+
+
+/**
+ * Levelled logging to Serial, without waiting on the UART.
+ *
+ * LOG(level).print(...) is compiled out above LOG_LEVEL, and skipped above the runtime level (logLevel, LOG_LEVEL_DEFAULT
+ * at boot, digits on Serial change it). What's left goes into a RAM ring; logRun() moves whole lines from there
+ * into HardwareSerial's own buffer as it has room, so its TX interrupt sends them and nobody blocks.
+ * A line which doesn't fit is dropped, all of it, and counted. As only whole lines leave the ring, the
+ * Serial.print()s of setup() and of the 't' style commands never land in the middle of one.
+ *
+ * Until logBegin() (the end of setup()) it writes straight to Serial, in order with everything else.
+ */
+#if (LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) != 0
+#error LOG_BUFFER_SIZE must be a power of two
+#endif
+
+logPrint_t Log;
+uint8_t logLevel = LOG_LEVEL_DEFAULT;
+
+static uint8_t logRing[LOG_BUFFER_SIZE];
+static uint16_t logHead = 0;      // Counts up; logRing[logHead % LOG_BUFFER_SIZE] is the next byte written.
+static uint16_t logLineStart = 0; // Start of the line being written. Everything before it is complete lines.
+static uint16_t logTail = 0;      // Next byte to Serial.
+static bool logAsync = false;
+static bool logDropping = false;  // The rest of this line goes too.
+static unsigned long logDropped = 0;
+static unsigned long logDroppedTotal = 0;
+static uint16_t logPeak = 0;
+static unsigned long logLastWindowDropped = 0;
+
+
+size_t logPrint_t::write(uint8_t c)
+{
+  if(! logAsync) return Serial.write(c);
+
+  if(logDropping) {
+    logDropped++;
+    if(c == '\n') logDropping = false;
+    return 1;
+  }
+
+  if((uint16_t) (logHead - logTail) >= LOG_BUFFER_SIZE) {
+    logDropped += (uint16_t) (logHead - logLineStart) + 1;
+    logHead = logLineStart;
+    logDropping = (c != '\n');
+    return 1;
+  }
+
+  logRing[logHead % LOG_BUFFER_SIZE] = c;
+  logHead++;
+  if(c == '\n') logLineStart = logHead;
+  if((uint16_t) (logHead - logTail) > logPeak) logPeak = logHead - logTail;
+  return 1;
+}
+
+
+void logBegin(void)
+{
+  logAsync = true;
+}
+
+
+/**
+ * Hand complete lines to Serial, only as much as it'll take without blocking. Call every pass.
+ */
+void logRun(void)
+{
+  int room = Serial.availableForWrite();
+  while((room > 0) && (logTail != logLineStart)) {
+    Serial.write(logRing[logTail % LOG_BUFFER_SIZE]);
+    logTail++;
+    room--;
+  }
+}
+
+
+/**
+ * Bytes dropped in the window just ended (DIAGNOSTICS_PERIOD). Starts a new one.
+ */
+void logEndWindow(void)
+{
+  logLastWindowDropped = logDropped;
+  logDroppedTotal += logDropped;
+  logDropped = 0;
+}
+
+
+unsigned long logLastWindowDroppedBytes(void)
+{
+  return logLastWindowDropped;
+}
+
+
+void logPrintStats(void)
+{
+  Serial.print(F("Log level="));
+  Serial.print(logLevel);
+  Serial.print(F(" buffered="));
+  Serial.print((uint16_t) (logHead - logTail));
+  Serial.print(F(" peak="));
+  Serial.print(logPeak);
+  Serial.print(F(" of "));
+  Serial.print(LOG_BUFFER_SIZE);
+  Serial.print(F(" dropped="));
+  Serial.print(logDroppedTotal + logDropped);
+  Serial.println(F(" bytes"));
+}
+
+
+void logResetStats(void)
+{
+  logPeak = 0;
+  logDroppedTotal = 0;
+}
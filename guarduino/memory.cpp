@@ -0,0 +1,182 @@
+#include "guarduino.h"
+
+
+/**
+ * Heap and stack high-water marks, so a slow leak or a fragmented heap shows up before the board locks up.
+ *
+ * memoryPaint() fills all RAM above .bss with MEMORY_CANARY before main() runs. The heap grows up into that and
+ * the stack grows down; whatever is still painted above the top of the heap has never been used by either, so
+ * counting it gives the least free RAM there has ever been.
+ * malloc() and free() are wrapped (the Makefile links with --wrap; avr-libc's calloc() and realloc() go through
+ * them too) to count blocks and keep the heap's peak. Built without the wrap, the counts stay at 0 and the
+ * peak is only sampled.
+ * The largest free block is the biggest of the free list (__flp) and the gap malloc() may still take between
+ * the heap and the stack; fragmentation is how much of what's free isn't in that one block.
+ *
+ * memoryEndWindow() snapshots these for the diagnostic entities (DIAGNOSTICS_PERIOD); 'm' on Serial prints
+ * them now.
+ */
+#define MEMORY_CANARY 0xC5
+
+// avr-libc's malloc.c
+struct __freelist
+{
+  size_t sz;
+  struct __freelist *nx;
+};
+extern "C" {
+extern char *__brkval;
+extern struct __freelist *__flp;
+extern char __heap_start;
+extern uint8_t __stack;
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+void *__wrap_malloc(size_t size);
+void __wrap_free(void *ptr);
+}
+
+static unsigned long allocCount = 0;
+static unsigned long freeCount = 0;
+static unsigned long failCount = 0;
+static size_t heapPeak = 0;
+static size_t freeMin = RAMEND; // Until the first look.
+static memorySummary_t lastWindow = { };
+
+
+/**
+ * Runs from .init3, before .data and .bss are set up and before anything is on the stack: no call, no return.
+ */
+void memoryPaint(void) __attribute__((naked, used, section(".init3")));
+void memoryPaint(void)
+{
+  for(uint8_t *p = (uint8_t *) &__heap_start; p <= &__stack; p++) *p = MEMORY_CANARY;
+}
+
+
+static char *memoryHeapTop(void)
+{
+  return __brkval ? __brkval : &__heap_start;
+}
+
+
+static void memoryHeapSample(void)
+{
+  size_t heapSize = memoryHeapTop() - &__heap_start;
+  if(heapSize > heapPeak) heapPeak = heapSize;
+}
+
+
+void *__wrap_malloc(size_t size)
+{
+  void *ptr = __real_malloc(size);
+  if(ptr) {
+    allocCount++;
+    memoryHeapSample();
+  } else if(size) {
+    failCount++;
+  }
+  return ptr;
+}
+
+
+void __wrap_free(void *ptr)
+{
+  if(ptr) freeCount++;
+  __real_free(ptr);
+}
+
+
+/**
+ * Bytes between the top of the heap and the stack which are still painted, i.e. were never used.
+ */
+static size_t memoryUnused(void)
+{
+  const uint8_t *top = (const uint8_t *) memoryHeapTop();
+  const uint8_t *sp = (const uint8_t *) SP;
+  size_t unused = 0;
+  while(((top + unused) < sp) && (top[unused] == MEMORY_CANARY)) unused++;
+  return unused;
+}
+
+
+/**
+ * The biggest single malloc() we could satisfy now, and everything free (*freeBytes).
+ */
+static size_t memoryLargestFree(size_t *freeBytes)
+{
+  size_t largest = 0;
+  *freeBytes = 0;
+  for(struct __freelist *fp = __flp; fp; fp = fp->nx) {
+    *freeBytes += fp->sz;
+    if(fp->sz > largest) largest = fp->sz;
+  }
+
+  // malloc() leaves __malloc_margin for the stack when it grows the heap.
+  char *top = memoryHeapTop();
+  char *sp = (char *) SP;
+  if(sp > (top + __malloc_margin)) {
+    size_t gap = sp - top - __malloc_margin;
+    *freeBytes += gap;
+    if(gap > largest) largest = gap;
+  }
+  return largest;
+}
+
+
+static void memorySummarise(memorySummary_t *summary)
+{
+  size_t freeBytes;
+  memoryHeapSample();
+  size_t unused = memoryUnused();
+  if(unused < freeMin) freeMin = unused;
+
+  summary->freeMin = freeMin;
+  summary->heapPeak = heapPeak;
+  summary->largestFree = memoryLargestFree(&freeBytes);
+  summary->fragmentation = freeBytes ? (uint8_t) (100 - ((100UL * summary->largestFree) / freeBytes)) : 0;
+  summary->blocks = allocCount - freeCount;
+  summary->failures = failCount;
+}
+
+
+/**
+ * Snapshot everything into memoryLastWindow(). The marks themselves are since boot.
+ */
+void memoryEndWindow(void)
+{
+  memorySummarise(&lastWindow);
+}
+
+
+const memorySummary_t *memoryLastWindow(void)
+{
+  return &lastWindow;
+}
+
+
+void memoryPrintStats(void)
+{
+  memorySummary_t now;
+  memorySummarise(&now);
+
+  Serial.print(F("Memory free min="));
+  Serial.print(now.freeMin);
+  Serial.print(F(" stack peak="));
+  Serial.print((unsigned int) ((&__stack + 1) - ((const uint8_t *) memoryHeapTop() + now.freeMin)));
+  Serial.print(F(" heap="));
+  Serial.print((unsigned int) (memoryHeapTop() - &__heap_start));
+  Serial.print(F(" peak="));
+  Serial.print(now.heapPeak);
+  Serial.print(F(" largest free="));
+  Serial.print(now.largestFree);
+  Serial.print(F(" fragmentation="));
+  Serial.print(now.fragmentation);
+  Serial.print(F("% blocks="));
+  Serial.print(now.blocks);
+  Serial.print(F(" mallocs="));
+  Serial.print(allocCount);
+  Serial.print(F(" failed="));
+  Serial.print(now.failures);
+  if(allocCount == 0) Serial.print(F(" (malloc not wrapped)"));
+  Serial.println();
+}
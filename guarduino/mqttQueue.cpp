@@ -0,0 +1,270 @@
+#include <Ethernet.h>
+#include <PubSubClient.h> // https://github.com/knolleary/pubsubclient/tree/master
+#include "guarduino.h"
+
+extern EthernetClient ethClient;
+
+
+/**
+ * Outbound MQTT queue, between everything that wants to publish and PubSubClient.
+ *
+ * Nothing is queued but "which message": a bit per sensor (or probe) per kind of message, and the payload is
+ * built from the latest readings when it's sent. So the queue is bounded by construction (every message it
+ * could ever hold has a slot), and a newer state for a sensor whose state is still waiting costs nothing:
+ * its bit is already set, and the newer state is what goes out.
+ *
+ * mqttQueueRun() sends the most urgent first:
+ *   1. security state: doors, windows, motion (or the AGGREGATE_STATE document)
+ *   2. switch state, e.g. the echo of a command from HA
+ *   3. DS18x temperatures
+ *   4. discovery, the diagnostic entities' included, so each is ahead of its first state
+ *   5. diagnostics state (diagnostics.cpp)
+ * and only while the Ethernet socket has MQTT_QUEUE_TX_ROOM free, so a slow broker leaves messages waiting
+ * here (to be coalesced) rather than blocking loop() in a socket write.
+ * A message which fails to publish goes back on the queue, and the run stops; it's tried again next run, until
+ * it goes, the session does (mqttQueueClear()), or it has failed MQTT_QUEUE_MAX_TRIES times in a row. Then it's
+ * dropped (and logged), so one message which can never go (too big for PubSubClient's buffer, say) can't hold
+ * up everything behind it.
+ */
+#define MQTT_QUEUE_SLOTS 64 // Per kind: allSensors[64], DS18X_MAX probes, or the one device.
+
+enum mqttPriority
+{
+    prioritySecurity = 0,
+    prioritySwitch,
+    priorityTemperature,
+    priorityDiscovery,
+    priorityDiagnostics,
+    priorityCount
+};
+
+static_assert(sizeof(allSensors) / sizeof(allSensors[0]) <= MQTT_QUEUE_SLOTS, "allSensors[] outgrew the MQTT queue");
+static_assert(DS18X_MAX <= MQTT_QUEUE_SLOTS, "DS18X_MAX outgrew the MQTT queue");
+
+static uint8_t pending[queuedKindCount][MQTT_QUEUE_SLOTS / 8];
+static uint8_t queueDepth = 0;
+static uint8_t queueDepthMax = 0;
+static unsigned long queueSent = 0;
+static unsigned long queueCoalesced = 0; // Put while already waiting.
+static unsigned long queueFailed = 0;    // Publishes which failed, and were put back.
+static unsigned long queueDropped = 0;   // Thrown away by mqttQueueClear() or mqttQueueRemove(), or failed too often.
+static unsigned long queueStalls = 0;    // Runs cut short for want of socket TX room.
+static uint8_t failedKind = queuedKindCount; // The message which failed last, and how many times in a row.
+static uint8_t failedIndex = 0;
+static uint8_t failedTries = 0;
+
+
+/**
+ * Queue a message: "index" is the sensor (allSensors[]) or probe (allds18x[]); 0 for queuedDeviceState.
+ */
+void mqttQueuePut(mqttQueued kind, uint8_t index)
+{
+  if((kind >= queuedKindCount) || (index >= MQTT_QUEUE_SLOTS)) return;
+
+  uint8_t *slot = &pending[kind][index / 8];
+  uint8_t bit = 1 << (index % 8);
+  if(*slot & bit) {
+    queueCoalesced++;
+    return;
+  }
+  *slot |= bit;
+  queueDepth++;
+  if(queueDepth > queueDepthMax) queueDepthMax = queueDepth;
+}
+
+
+/**
+ * Take a message off the queue unsent, e.g. for a probe which has gone.
+ */
+void mqttQueueRemove(mqttQueued kind, uint8_t index)
+{
+  if((kind >= queuedKindCount) || (index >= MQTT_QUEUE_SLOTS)) return;
+
+  uint8_t *slot = &pending[kind][index / 8];
+  uint8_t bit = 1 << (index % 8);
+  if(!(*slot & bit)) return;
+  *slot &= ~bit;
+  queueDepth--;
+  queueDropped++;
+}
+
+
+/**
+ * A sensor or probe has moved from index "from" to "to": so does its message, if one is waiting. Whatever was
+ * waiting for "to" is dropped.
+ */
+void mqttQueueMove(mqttQueued kind, uint8_t from, uint8_t to)
+{
+  if((kind >= queuedKindCount) || (from >= MQTT_QUEUE_SLOTS) || (to >= MQTT_QUEUE_SLOTS) || (from == to)) return;
+
+  mqttQueueRemove(kind, to);
+  uint8_t *slot = &pending[kind][from / 8];
+  uint8_t bit = 1 << (from % 8);
+  if(!(*slot & bit)) return;
+  *slot &= ~bit;
+  pending[kind][to / 8] |= 1 << (to % 8);
+}
+
+
+static uint8_t mqttQueuePriority(uint8_t kind, uint8_t index)
+{
+  switch(kind) {
+    case queuedSensorState: return sensorIsSwitch(allSensors[index].type) ? prioritySwitch : prioritySecurity;
+    case queuedDeviceState: return prioritySecurity;
+    case queuedds18xState: return priorityTemperature;
+    case queuedDiagnosticsState: return priorityDiagnostics;
+    default: return priorityDiscovery;
+  }
+}
+
+
+/**
+ * Takes the most urgent message off the queue. Within a priority, lower kinds and indexes go first.
+ */
+static bool mqttQueueTake(uint8_t *kind, uint8_t *index)
+{
+  if(queueDepth == 0) return false;
+
+  for(uint8_t priority = 0; priority < priorityCount; priority++) {
+    for(uint8_t k = 0; k < queuedKindCount; k++) {
+      for(uint8_t slot = 0; slot < (MQTT_QUEUE_SLOTS / 8); slot++) {
+        uint8_t bits = pending[k][slot];
+        while(bits) {
+          uint8_t bit = (uint8_t) __builtin_ctz(bits);
+          bits &= bits - 1;
+          uint8_t i = (slot * 8) + bit;
+          if(mqttQueuePriority(k, i) != priority) continue;
+
+          pending[k][slot] &= ~(1 << bit);
+          queueDepth--;
+          *kind = k;
+          *index = i;
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Build and publish one message, from "pinReadings" for pin sensors.
+ */
+static bool mqttQueueSend(uint8_t kind, uint8_t index, const pinBitset_t *pinReadings)
+{
+  switch(kind) {
+    case queuedSensorState: return publishSensorState(index, pinReadings);
+    case queuedSensorDiscovery: return publishSensorDiscovery(index, pinReadings);
+    case queuedds18xState: return publishds18xState(index);
+    case queuedds18xDiscovery: return publishds18xDiscovery(index);
+#if AGGREGATE_STATE
+    case queuedDeviceState: return publishDeviceState(pinReadings, allSensors, sizeof(allSensors));
+#endif
+    case queuedDiagnosticsState: return publishDiagnosticsState();
+    case queuedDiagnosticsDiscovery: return publishDiagnosticsDiscovery(index);
+    default: return true;
+  }
+}
+
+
+/**
+ * Send what's waiting, most urgent first, for up to "budgetUs" (at least one message, if there's room).
+ * "pinReadings" is what we've most recently reported, i.e. the readings each sensor's state is built from.
+ */
+void mqttQueueRun(const pinBitset_t *pinReadings, unsigned long budgetUs)
+{
+  if(queueDepth == 0) return;
+  if(! pubsubClient.connected()) return;
+
+  unsigned long startedAt = micros();
+  uint8_t kind;
+  uint8_t index;
+  while(queueDepth > 0) {
+    if(ethClient.availableForWrite() < MQTT_QUEUE_TX_ROOM) {
+      queueStalls++;
+      return;
+    }
+    if(! mqttQueueTake(&kind, &index)) return;
+
+    if(! mqttQueueSend(kind, index, pinReadings)) {
+      queueFailed++;
+      if((kind != failedKind) || (index != failedIndex)) {
+        failedKind = kind;
+        failedIndex = index;
+        failedTries = 0;
+      }
+      if(++failedTries < MQTT_QUEUE_MAX_TRIES) {
+        mqttQueuePut((mqttQueued) kind, index);
+      } else {
+        queueDropped++;
+        failedKind = queuedKindCount;
+        if(LOG_ENABLED(LOG_WARN)) {
+          Log.print(F("MQTT publish dropped: kind="));
+          Log.print(kind);
+          Log.print(F(" index="));
+          Log.println(index);
+        }
+      }
+      return;
+    }
+    queueSent++;
+    if((kind == failedKind) && (index == failedIndex)) failedKind = queuedKindCount;
+
+    if((micros() - startedAt) >= budgetUs) return;
+  }
+}
+
+
+/**
+ * Throw away everything waiting, e.g. when the MQTT session it was meant for has gone.
+ */
+void mqttQueueClear(void)
+{
+  queueDropped += queueDepth;
+  memset(pending, '\0', sizeof(pending));
+  queueDepth = 0;
+  failedKind = queuedKindCount;
+}
+
+
+uint8_t mqttQueueDepth(void)
+{
+  return queueDepth;
+}
+
+
+unsigned long mqttQueueDrops(void)
+{
+  return queueDropped;
+}
+
+
+void mqttQueuePrintStats(void)
+{
+  Serial.print(F("MqttQueue depth="));
+  Serial.print(queueDepth);
+  Serial.print(F(" max="));
+  Serial.print(queueDepthMax);
+  Serial.print(F(" sent="));
+  Serial.print(queueSent);
+  Serial.print(F(" coalesced="));
+  Serial.print(queueCoalesced);
+  Serial.print(F(" failed="));
+  Serial.print(queueFailed);
+  Serial.print(F(" dropped="));
+  Serial.print(queueDropped);
+  Serial.print(F(" stalls="));
+  Serial.println(queueStalls);
+}
+
+
+void mqttQueueResetStats(void)
+{
+  queueDepthMax = queueDepth;
+  queueSent = 0;
+  queueCoalesced = 0;
+  queueFailed = 0;
+  queueDropped = 0;
+  queueStalls = 0;
+}
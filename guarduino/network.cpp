@@ -0,0 +1,237 @@
+#include <Ethernet.h>
+#include <PubSubClient.h> // https://github.com/knolleary/pubsubclient/tree/master
+#include "guarduino.h"
+
+extern EthernetClient ethClient;
+
+
+/**
+ * Ethernet and MQTT (re)connection, as a state machine stepped by taskNetwork().
+ *
+ *   networkNoLink     - cable out. Poll the PHY until it comes back.
+ *   networkNeedLease  - DHCP. Only on the way up from networkNoLink, or when the lease couldn't be renewed.
+ *   networkNeedBroker - TCP + MQTT connect, keeping the lease we have.
+ *   networkConnected  - keep the lease renewed (Ethernet.maintain()), and watch for the session or link dropping.
+ *
+ * Each step does at most one thing which can block, so the scheduler gets back to the pins in between. That
+ * one thing isn't short: a DHCP attempt blocks for up to NETWORK_DHCP_TIMEOUT_MS, and a broker connect for up to
+ * NETWORK_CONNECT_TIMEOUT_MS (TCP) plus NETWORK_MQTT_TIMEOUT_S (CONNACK). Failed steps are retried after
+ * NETWORK_BACKOFF_MIN_MS, doubling up to NETWORK_BACKOFF_MAX_MS; or up to NETWORK_LEASE_BACKOFF_MAX_MS for DHCP,
+ * so a link with no DHCP server on it leaves the pins scanned most of the time.
+ */
+enum networkStates
+{
+    networkNoLink = 0,
+    networkNeedLease,
+    networkNeedBroker,
+    networkConnected
+};
+
+static networkStates networkState = networkNoLink;
+static bool macIsValid = false;
+static unsigned long nextAttemptAt = 0;
+static unsigned long backoffMs = NETWORK_BACKOFF_MIN_MS;
+static unsigned long lastMaintainAt = 0;
+static unsigned long networkAttempts = 0;
+static unsigned long networkSessions = 0;
+static unsigned long worstStepUs = 0;
+
+
+/**
+ * Check our config and set the short timeouts the steps rely on. Call once from setup().
+ */
+void setupNetwork(void)
+{
+    // Validate "mac" is populated (not all zeros). Log such.
+    macIsValid = false;
+    for (size_t i = 0; i < 6; i++) {
+        if (mac[i] != 0) {
+            macIsValid = true;
+            break;
+        }
+    }
+    if (!macIsValid) {
+        Serial.println(F("Invalid MAC address; cannot setup Ethernet."));
+    }
+
+    ethClient.setConnectionTimeout(NETWORK_CONNECT_TIMEOUT_MS); // TCP connect.
+    pubsubClient.setSocketTimeout(NETWORK_MQTT_TIMEOUT_S);      // CONNACK, and each read.
+    networkState = networkNoLink;
+    nextAttemptAt = millis();
+    backoffMs = NETWORK_BACKOFF_MIN_MS;
+}
+
+
+/**
+ * W5100s can't tell us about the link (Unknown); assume it's up and let DHCP/connect find out.
+ */
+static bool networkLinkUp(void)
+{
+    return Ethernet.linkStatus() != LinkOFF;
+}
+
+
+/**
+ * One DHCP attempt, bounded by NETWORK_DHCP_TIMEOUT_MS.
+ */
+static bool networkLease(void)
+{
+    if (!macIsValid) return false;
+
+    if (Ethernet.begin(mac, NETWORK_DHCP_TIMEOUT_MS, NETWORK_DHCP_RESPONSE_MS) == 0) {
+      if (Ethernet.hardwareStatus() == EthernetNoHardware) {
+        LOG(LOG_ERROR).println(F("Ethernet hardware not found."));
+      } else {
+        LOG(LOG_WARN).println(F("DHCP failed."));
+      }
+      return false;
+    }
+
+    if (Ethernet.hardwareStatus() == EthernetW5100) {
+      LOG(LOG_INFO).println(F("W5100 Ethernet controller detected."));
+    } else if (Ethernet.hardwareStatus() == EthernetW5200) {
+      LOG(LOG_INFO).println(F("W5200 Ethernet controller detected."));
+    } else if (Ethernet.hardwareStatus() == EthernetW5500) {
+      LOG(LOG_INFO).println(F("W5500 Ethernet controller detected."));
+    }
+    LOG(LOG_INFO).print(F("DHCP lease "));
+    LOG(LOG_INFO).println(Ethernet.localIP());
+    lastMaintainAt = millis();
+    return true;
+}
+
+
+/**
+ * Try the current step again after the backoff, and double the backoff for next time.
+ */
+static void networkBackoff(unsigned long now)
+{
+    nextAttemptAt = now + backoffMs;
+    backoffMs *= 2;
+    unsigned long maxMs = (networkState == networkNeedLease) ? NETWORK_LEASE_BACKOFF_MAX_MS : NETWORK_BACKOFF_MAX_MS;
+    if (backoffMs > maxMs) backoffMs = maxMs;
+}
+
+
+static void networkEnter(networkStates state, unsigned long now)
+{
+    networkState = state;
+    nextAttemptAt = now;
+    backoffMs = NETWORK_BACKOFF_MIN_MS;
+}
+
+
+/**
+ * Renew the DHCP lease when it's due. False if it's gone.
+ */
+static bool networkMaintain(unsigned long now)
+{
+    if ((now - lastMaintainAt) < NETWORK_MAINTAIN_MS) return true;
+    lastMaintainAt = now;
+    switch (Ethernet.maintain()) {
+      case 1: // Renew failed. We keep the address until rebinding fails too.
+        LOG(LOG_WARN).println(F("DHCP renew failed."));
+        return true;
+      case 3: // Rebind failed.
+        LOG(LOG_WARN).println(F("DHCP lease lost."));
+        return false;
+      default:
+        return true;
+    }
+}
+
+
+/**
+ * End the MQTT session without losing our last will. A clean DISCONNECT makes the broker discard the will, which
+ * would leave "online" retained while we're gone. So say "offline" ourselves first when the broker can still
+ * hear us; when it can't (the link is down), just drop the socket and let the broker's keepalive fire the will.
+ */
+static void networkDropSession(bool reachable)
+{
+    if (reachable && pubsubClient.connected()) {
+      pubsubClient.publish(getDeviceAvailabilityTopic(), "offline", true);
+      pubsubClient.disconnect();
+    } else {
+      ethClient.stop();
+    }
+}
+
+
+/**
+ * One step. Returns true when an MQTT session has just started (see pubsubReconnect()), so the caller can
+ * queue everything up for it.
+ */
+bool networkRun(void)
+{
+    unsigned long startedAt = micros();
+    unsigned long now = millis();
+    bool connected = false;
+
+    if ((networkState != networkNoLink) && ! networkLinkUp()) {
+      LOG(LOG_WARN).println(F("Ethernet link down."));
+      networkDropSession(false);
+      networkEnter(networkNoLink, now);
+    }
+    if (((networkState == networkNeedBroker) || (networkState == networkConnected)) && ! networkMaintain(now)) {
+      networkDropSession(true);
+      networkEnter(networkNeedLease, now);
+    }
+    if ((networkState == networkConnected) && ! pubsubClient.connected()) {
+      LOG(LOG_WARN).println(F("MQTT NOT Connected"));
+      networkEnter(networkNeedBroker, now);
+    }
+
+    if ((networkState != networkConnected) && ((long) (now - nextAttemptAt) >= 0)) {
+      switch (networkState) {
+        case networkNoLink:
+          if (networkLinkUp()) networkEnter(networkNeedLease, now);
+          else nextAttemptAt = now + NETWORK_LINK_POLL_MS;
+          break;
+        case networkNeedLease:
+          networkAttempts++;
+          if (networkLease()) networkEnter(networkNeedBroker, now);
+          else networkBackoff(now);
+          break;
+        case networkNeedBroker:
+          networkAttempts++;
+          if (pubsubReconnect()) {
+            networkEnter(networkConnected, now);
+            networkSessions++;
+            connected = true;
+          } else {
+            networkBackoff(now);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    unsigned long tookUs = micros() - startedAt;
+    if (tookUs > worstStepUs) worstStepUs = tookUs;
+    return connected;
+}
+
+
+void networkPrintStats(void)
+{
+    Serial.print(F("Network state="));
+    Serial.print(networkState);
+    Serial.print(F(" attempts="));
+    Serial.print(networkAttempts);
+    Serial.print(F(" sessions="));
+    Serial.print(networkSessions);
+    Serial.print(F(" backoff="));
+    Serial.print(backoffMs);
+    Serial.print(F("ms worst step="));
+    Serial.print(worstStepUs);
+    Serial.println(F("us"));
+}
+
+
+void networkResetStats(void)
+{
+    networkAttempts = 0;
+    networkSessions = 0;
+    worstStepUs = 0;
+}
@@ -0,0 +1,153 @@
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "guarduino.h"
+
+
+/**
+ * Interrupt driven pin change capture (optional, see PINCAPTURE_PCINT in guarduino.h).
+ *
+ * loop() only sees a pin when it comes around, so a short PIR pulse or a door bounce can
+ * happen entirely between two passes. Here, each pin change interrupt pushes a snapshot of its
+ * port (plus a micros() timestamp) into a single-producer/single-consumer ring buffer, which loop()
+ * then replays in order through the normal sendSensorsMQTT() path.
+ *
+ * On the Mega, only PORTB (pins 10-13, 50-53) and PORTK (A8-A15, pins 62-69) have pin change interrupts
+ * the core knows about. Sensors on any other pin are still read by polling, as before.
+ */
+#if PINCAPTURE_PCINT
+
+#define PINCAPTURE_GROUPS 3 // PCINT0 (PORTB), PCINT1 (unused), PCINT2 (PORTK)
+
+// The ring buffer. The ISRs only ever move "ringHead", loop() only ever moves "ringTail".
+// Both are single bytes, so reading either is atomic on AVR.
+static volatile pinEvent_t ring[PINCAPTURE_RING_SIZE];
+static volatile uint8_t ringHead = 0;
+static volatile uint8_t ringTail = 0;
+
+static volatile unsigned long captureCount = 0;
+static volatile unsigned long captureOverflows = 0;
+
+// Per group: which bits we care about, and what they were at the last interrupt.
+static volatile uint8_t captureMask[PINCAPTURE_GROUPS];
+static volatile uint8_t captureLast[PINCAPTURE_GROUPS];
+
+
+/**
+ * Called from the ISRs only. Pushes one event, or counts an overflow if loop() has fallen too far behind.
+ * Interrupts which didn't change any of our pins (e.g. SPI traffic on PORTB) are ignored.
+ */
+static inline void pinCapturePush(uint8_t group, uint8_t port, uint8_t portValue)
+{
+  if(((portValue ^ captureLast[group]) & captureMask[group]) == 0) return;
+  captureLast[group] = portValue;
+
+  uint8_t nextHead = (ringHead + 1) & (PINCAPTURE_RING_SIZE - 1);
+  if(nextHead == ringTail) {
+    captureOverflows++;
+    return;
+  }
+  ring[ringHead].port = port;
+  ring[ringHead].portValue = portValue;
+  ring[ringHead].at = micros();
+  ringHead = nextHead;
+  captureCount++;
+}
+
+ISR(PCINT0_vect)
+{
+  pinCapturePush(0, PB, PINB);
+}
+
+ISR(PCINT2_vect)
+{
+  pinCapturePush(2, PK, PINK);
+}
+
+
+/**
+ * Enable pin change interrupts for each sensor input pin which has one.
+ * Call from setupSensors(), after the pins have been set to INPUT.
+ */
+static uint8_t pinCaptureAddPin(int8_t pin)
+{
+  if(pin < 0) return 0;
+  volatile uint8_t *pcicr = digitalPinToPCICR(pin);
+  if(! pcicr) return 0;
+
+  uint8_t group = digitalPinToPCICRbit(pin);
+  uint8_t pinMask = bit(digitalPinToPCMSKbit(pin));
+  *digitalPinToPCMSK(pin) |= pinMask;
+  captureMask[group] |= pinMask;
+  *pcicr |= bit(group);
+  return 1;
+}
+
+void setupPinCapture(baseSensor_t *sensors, size_t sensorsSize)
+{
+  int capturedPins = 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(size_t i = 0; i < (sensorsSize / sizeof(baseSensor_t)); i++) {
+      baseSensor_t thisSensor = sensors[i];
+      if(sensorPinDirection(thisSensor.type) != INPUT) continue; // Switches are outputs; we already know when they change.
+      uint8_t pinCount = sensorPinCount(thisSensor.type);
+      if(pinCount >= 1) capturedPins += pinCaptureAddPin(thisSensor.pin1);
+      if(pinCount >= 2) capturedPins += pinCaptureAddPin(thisSensor.pin2);
+    }
+    captureLast[0] = PINB;
+    captureLast[2] = PINK;
+  }
+
+  Serial.print(F("PinCapture: "));
+  Serial.print(capturedPins);
+  Serial.println(F(" pins on pin change interrupts."));
+}
+
+
+/**
+ * Pops the oldest captured event into "event". Returns false if there are none.
+ * Only loop() may call this.
+ */
+bool pinCaptureNext(pinEvent_t *event)
+{
+  uint8_t tail = ringTail;
+  if(tail == ringHead) return false;
+
+  event->port = ring[tail].port;
+  event->portValue = ring[tail].portValue;
+  event->at = ring[tail].at;
+  ringTail = (tail + 1) & (PINCAPTURE_RING_SIZE - 1);
+  return true;
+}
+
+
+unsigned long pinCaptureOverflows(void)
+{
+  unsigned long overflows;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    overflows = captureOverflows;
+  }
+  return overflows;
+}
+
+
+/**
+ * Serial summary: events captured, events still queued, events dropped because the ring was full.
+ */
+void pinCapturePrintStats(void)
+{
+  unsigned long captured;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    captured = captureCount;
+  }
+  uint8_t queued = (ringHead - ringTail) & (PINCAPTURE_RING_SIZE - 1);
+
+  Serial.print(F("PinCapture captured="));
+  Serial.print(captured);
+  Serial.print(F(" queued="));
+  Serial.print(queued);
+  Serial.print(F(" overflows="));
+  Serial.println(pinCaptureOverflows());
+}
+
+#endif /* PINCAPTURE_PCINT */
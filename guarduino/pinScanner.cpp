@@ -0,0 +1,119 @@
+#include <util/atomic.h>
+#include "guarduino.h"
+
+
+/**
+ * Port-register snapshot scanner.
+ *
+ * Rather than one digitalRead() per configured pin, we look up each pin's port/bitmask once (at setup),
+ * then every scan copies each PINx register that has a configured pin on it, all inside one atomic block.
+ * Both pins of a two-pin sensor therefore come from the same instant. Readings are a pinBitset_t laid out
+ * by port, so folding a snapshot in is one masked byte copy per port, whatever the pin numbers.
+ */
+#define PINSCAN_MAX_PORTS PINBITSET_PORTS // PA..PL on the Mega 2560.
+
+typedef struct pinScanPort_t
+{
+    volatile uint8_t *inputRegister; // PINx
+    uint8_t port;                    // PA, PB, ... as returned by digitalPinToPort()
+    uint8_t mask;                    // Our configured pins on this port.
+} pinScanPort_t;
+
+static pinScanPort_t scanPorts[PINSCAN_MAX_PORTS];
+static uint8_t scanPortCount = 0;
+static uint8_t scanPinCount = 0;
+
+
+/**
+ * Adds "pin" to our scan table, registering its port if we've not seen that port yet.
+ * Silently ignores unused (-1) pins and pins we've already added.
+ */
+static void pinScannerAddPin(int8_t pin)
+{
+  if(pin < 0) return;
+  if(pin >= NUM_DIGITAL_PINS) {
+    Serial.print(F("Pin "));
+    Serial.print(pin);
+    Serial.println(F(" is not a digital pin on this board. Ignored."));
+    return;
+  }
+
+  uint8_t port = digitalPinToPort(pin);
+  if((port == NOT_A_PORT) || (port > PINBITSET_PORTS)) return;
+  uint8_t mask = digitalPinToBitMask(pin);
+
+  uint8_t portSlot = 0;
+  while((portSlot < scanPortCount) && (scanPorts[portSlot].port != port)) portSlot++;
+  if(portSlot == scanPortCount) {
+    if(scanPortCount >= PINSCAN_MAX_PORTS) return;
+    scanPorts[portSlot].port = port;
+    scanPorts[portSlot].inputRegister = portInputRegister(port);
+    scanPorts[portSlot].mask = 0;
+    scanPortCount++;
+  }
+
+  if(scanPorts[portSlot].mask & mask) return;
+  scanPorts[portSlot].mask |= mask;
+  scanPinCount++;
+}
+
+
+/**
+ * Build the port/mask table from "sensors". Call after pinMode() has been set for each sensor,
+ * i.e. from setupSensors(). Safe to call again; the table is rebuilt from scratch.
+ */
+void setupPinScanner(baseSensor_t *sensors, size_t sensorsSize)
+{
+  scanPortCount = 0;
+  scanPinCount = 0;
+
+  for(size_t i = 0; i < (sensorsSize / sizeof(baseSensor_t)); i++) {
+    baseSensor_t thisSensor = sensors[i];
+    uint8_t pinCount = sensorPinCount(thisSensor.type);
+    if(pinCount >= 1) pinScannerAddPin(thisSensor.pin1);
+    if(pinCount >= 2) pinScannerAddPin(thisSensor.pin2);
+  }
+
+  Serial.print(F("PinScanner: "));
+  Serial.print(scanPinCount);
+  Serial.print(F(" pins on "));
+  Serial.print(scanPortCount);
+  Serial.println(F(" ports."));
+}
+
+
+/**
+ * Snapshot every used PINx register at once, and fold the results into "pinReadings".
+ * Bits of pins we don't scan are left in-place.
+ */
+void pinScannerRead(pinBitset_t *pinReadings)
+{
+  uint8_t snapshot[PINSCAN_MAX_PORTS];
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for(uint8_t i = 0; i < scanPortCount; i++) {
+      snapshot[i] = *scanPorts[i].inputRegister;
+    }
+  }
+
+  for(uint8_t i = 0; i < scanPortCount; i++) {
+    const pinScanPort_t *thisPort = &scanPorts[i];
+    uint8_t *readings = &pinReadings->ports[thisPort->port - 1];
+    *readings = (*readings & ~thisPort->mask) | (snapshot[i] & thisPort->mask);
+  }
+}
+
+
+/**
+ * As pinScannerRead(), but for one port whose PINx value was captured elsewhere (e.g. in a pin change ISR).
+ * Only pins on "port" are modified.
+ */
+void pinScannerApplyPort(pinBitset_t *pinReadings, uint8_t port, uint8_t portValue)
+{
+  uint8_t portSlot = 0;
+  while((portSlot < scanPortCount) && (scanPorts[portSlot].port != port)) portSlot++;
+  if(portSlot == scanPortCount) return;
+
+  uint8_t mask = scanPorts[portSlot].mask;
+  uint8_t *readings = &pinReadings->ports[port - 1];
+  *readings = (*readings & ~mask) | (portValue & mask);
+}
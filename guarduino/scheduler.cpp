@@ -0,0 +1,224 @@
+#include "guarduino.h"
+
+
+/**
+ * A small, fixed-slot, cooperative scheduler for loop().
+ *
+ * Each task has its own period, so (e.g.) a chatty motion sensor can no longer hold off temperature reporting.
+ * Tasks run to completion and must never delay(); anything slow must be broken into steps across runs.
+ * Tasks run in the order they were added, so add the latency-sensitive ones (pin scanning) first.
+ *
+ * With PROFILE_STAGES, each task is a profiled stage of loop(): every run is timed, and so is the rate of
+ * passes through loop(). Each task also has a "deadline": how long one run is expected to take. Runs over it
+ * are counted, and schedulerPrintStats() dumps run counts and average/worst durations to Serial.
+ * schedulerEndWindow() closes a window (DIAGNOSTICS_PERIOD) of these for the diagnostic entities. Windows are
+ * counted apart from the stats above, so schedulerResetStats() ('r' on Serial) doesn't cut one short.
+ * With PROFILE_STAGES 0, none of this is compiled in.
+ */
+#define SCHEDULER_MAX_TASKS 12
+
+typedef struct task_t
+{
+    PGM_P name;               // In flash, e.g. PSTR("pins").
+    taskFunction_t run;
+    unsigned long periodMs;   // 0 = every pass through loop().
+    unsigned long deadlineUs; // One run taking longer than this counts as an overrun.
+    unsigned long lastRunAt;  // millis()
+#if PROFILE_STAGES
+    unsigned long runCount;
+    unsigned long overruns;
+    unsigned long worstUs;
+    unsigned long totalUs;
+    unsigned long windowRuns;    // In the window in progress.
+    unsigned long windowTotalUs;
+    unsigned long windowMaxUs;
+    unsigned long windowAvgUs;   // Of the last closed window.
+    unsigned long windowWorstUs;
+#endif
+} task_t;
+
+static task_t tasks[SCHEDULER_MAX_TASKS];
+static uint8_t taskCount = 0;
+#if PROFILE_STAGES
+static unsigned long passCount = 0;
+static unsigned long statsSince = 0;
+static unsigned long windowPasses = 0;
+static unsigned long windowSince = 0;
+static unsigned long windowPassRate = 0; // loop() passes per second, over the last closed window.
+#endif
+
+
+/**
+ * Adds a task in the next free slot. Tasks are due immediately after being added. "name" must be in flash (PSTR).
+ * Returns the task's slot, or -1 if all slots are taken.
+ */
+int schedulerAdd(PGM_P name, taskFunction_t run, unsigned long periodMs, unsigned long deadlineUs)
+{
+  if(taskCount >= SCHEDULER_MAX_TASKS) {
+    Serial.print(F("schedulerAdd(): no free slot for "));
+    Serial.println((const __FlashStringHelper *) name);
+    return -1;
+  }
+
+  task_t *thisTask = &tasks[taskCount];
+  memset(thisTask, '\0', sizeof(task_t));
+  thisTask->name = name;
+  thisTask->run = run;
+  thisTask->periodMs = periodMs;
+  thisTask->deadlineUs = deadlineUs;
+  thisTask->lastRunAt = millis() - periodMs;
+#if PROFILE_STAGES
+  statsSince = millis();
+  windowSince = statsSince;
+#endif
+  return taskCount++;
+}
+
+
+/**
+ * One pass: run each task which is due, once, in slot order. Call from loop().
+ */
+void schedulerRun(void)
+{
+#if PROFILE_STAGES
+  passCount++;
+  windowPasses++;
+#endif
+
+  for(uint8_t i = 0; i < taskCount; i++) {
+    task_t *thisTask = &tasks[i];
+    unsigned long now = millis();
+    if((now - thisTask->lastRunAt) < thisTask->periodMs) continue;
+    thisTask->lastRunAt = now;
+
+#if PROFILE_STAGES
+    unsigned long startedAt = micros();
+    thisTask->run();
+    unsigned long tookUs = micros() - startedAt;
+
+    thisTask->runCount++;
+    thisTask->totalUs += tookUs;
+    if(tookUs > thisTask->worstUs) thisTask->worstUs = tookUs;
+    if(tookUs > thisTask->deadlineUs) thisTask->overruns++;
+    thisTask->windowRuns++;
+    thisTask->windowTotalUs += tookUs;
+    if(tookUs > thisTask->windowMaxUs) thisTask->windowMaxUs = tookUs;
+#else
+    thisTask->run();
+#endif
+  }
+}
+
+
+#if PROFILE_STAGES
+/**
+ * Compare a task's name with "name", both in flash.
+ */
+static bool schedulerNameIs(PGM_P taskName, PGM_P name)
+{
+  for(;; taskName++, name++) {
+    char c = pgm_read_byte(taskName);
+    if(c != (char) pgm_read_byte(name)) return false;
+    if(c == '\0') return true;
+  }
+}
+
+
+/**
+ * The task called "name"'s average and worst run, in the last closed window. False if there's no such task.
+ */
+bool schedulerStageWindow(PGM_P name, unsigned long *avgUs, unsigned long *worstUs)
+{
+  for(uint8_t i = 0; i < taskCount; i++) {
+    if(! schedulerNameIs(tasks[i].name, name)) continue;
+    *avgUs = tasks[i].windowAvgUs;
+    *worstUs = tasks[i].windowWorstUs;
+    return true;
+  }
+  *avgUs = 0;
+  *worstUs = 0;
+  return false;
+}
+
+
+/**
+ * Passes through loop() per second, in the last closed window.
+ */
+unsigned long schedulerPassRate(void)
+{
+  return windowPassRate;
+}
+
+
+/**
+ * Keep this window's averages and worsts for schedulerStageWindow(), and start a new one.
+ */
+void schedulerEndWindow(void)
+{
+  unsigned long now = millis();
+  unsigned long elapsedMs = now - windowSince;
+  // windowPasses * 1000 / elapsedMs, without overflowing (or 64 bit division) at tens of thousands of passes a second.
+  windowPassRate = elapsedMs ? (((windowPasses / elapsedMs) * 1000) + (((windowPasses % elapsedMs) * 1000) / elapsedMs)) : 0;
+  windowPasses = 0;
+  windowSince = now;
+  for(uint8_t i = 0; i < taskCount; i++) {
+    task_t *thisTask = &tasks[i];
+    thisTask->windowAvgUs = thisTask->windowRuns ? (thisTask->windowTotalUs / thisTask->windowRuns) : 0;
+    thisTask->windowWorstUs = thisTask->windowMaxUs;
+    thisTask->windowRuns = 0;
+    thisTask->windowTotalUs = 0;
+    thisTask->windowMaxUs = 0;
+  }
+}
+#endif
+
+
+/**
+ * Serial dump of per-task statistics, since boot (or the last schedulerResetStats()).
+ */
+void schedulerPrintStats(void)
+{
+#if ! PROFILE_STAGES
+  Serial.println(F("Scheduler: PROFILE_STAGES is off."));
+#else
+  unsigned long elapsedMs = millis() - statsSince;
+
+  Serial.print(F("Scheduler: "));
+  Serial.print(passCount);
+  Serial.print(F(" passes in "));
+  Serial.print(elapsedMs);
+  Serial.println(F(" ms"));
+  for(uint8_t i = 0; i < taskCount; i++) {
+    task_t *thisTask = &tasks[i];
+    Serial.print(F("  "));
+    Serial.print((const __FlashStringHelper *) thisTask->name);
+    Serial.print(F(" period="));
+    Serial.print(thisTask->periodMs);
+    Serial.print(F("ms runs="));
+    Serial.print(thisTask->runCount);
+    Serial.print(F(" avg="));
+    Serial.print(thisTask->runCount ? (thisTask->totalUs / thisTask->runCount) : 0);
+    Serial.print(F("us worst="));
+    Serial.print(thisTask->worstUs);
+    Serial.print(F("us deadline="));
+    Serial.print(thisTask->deadlineUs);
+    Serial.print(F("us overruns="));
+    Serial.println(thisTask->overruns);
+  }
+#endif
+}
+
+
+void schedulerResetStats(void)
+{
+#if PROFILE_STAGES
+  for(uint8_t i = 0; i < taskCount; i++) {
+    tasks[i].runCount = 0;
+    tasks[i].overruns = 0;
+    tasks[i].worstUs = 0;
+    tasks[i].totalUs = 0;
+  }
+  passCount = 0;
+  statsSince = millis();
+#endif
+}
@@ -0,0 +1,346 @@
+#include <avr/pgmspace.h>
+#include "guarduino.h"
+
+
+/**
+ * Everything that differs between sensor types, in one table in flash, indexed by sensorType.
+ *
+ * A sensor's two pin bits make an index, (pin1 << 1) | pin2, into its row's states, names and icons,
+ * so decoding a reading is one lookup rather than a switch per type. Single-pin types never read pin2
+ * (it's usually -1), so only indexes 0 and 2 are used for them.
+ * Adding a sensor type means adding it to enum sensorType and a row here; nothing else switches on type.
+ */
+#define SENSOR_COMPONENT_NONE 0
+#define SENSOR_COMPONENT_SENSOR 1
+#define SENSOR_COMPONENT_SWITCH 2
+
+typedef struct sensorTraits_t
+{
+    PGM_P typeName;            // As written in CONFIG.INI, e.g. "door2".
+    PGM_P namePrefix;          // Start of the sensor's name, e.g. "door" for door_2223_CC1578.
+    PGM_P discoveryNameFormat; // HA "name". Given the device name, pin1 and pin2.
+    uint8_t pinCount;          // Pins read to decode a state: 2 (pin1, pin2), 1 (pin1 only) or 0.
+    uint8_t direction;         // INPUT or OUTPUT, for pinMode().
+    uint8_t component;         // SENSOR_COMPONENT_...
+    uint8_t reportMask;        // Bit N set: states[N] is worth publishing (not unknown, not offline).
+    uint8_t offlineMask;       // Bit N set: states[N] means the sensor has lost power. Its state is published, but not discovery.
+    uint8_t confirmMask;       // Bit N set: states[N] (fault, offline) must hold for DEBOUNCE_FAULT_SAMPLES before it's reported.
+    uint8_t heartbeat;         // heartbeatClass: how often an unchanged state is re-published.
+    uint8_t states[4];         // sensorStates, by (pin1 << 1) | pin2.
+    PGM_P stateNames[4];
+    PGM_P icons[4];
+} sensorTraits_t;
+
+
+static const char type_reserved[] PROGMEM = "reserved";
+static const char type_door2[] PROGMEM = "door2";
+static const char type_garagedoor2[] PROGMEM = "garagedoor2";
+static const char type_window2[] PROGMEM = "window2";
+static const char type_motion2[] PROGMEM = "motion2";
+static const char type_motion2_laser[] PROGMEM = "motion2_laser";
+static const char type_switch1[] PROGMEM = "switch1";
+static const char type_switch1_radiator[] PROGMEM = "switch1_radiator";
+static const char type_switch1_fan[] PROGMEM = "switch1_fan";
+static const char type_switch1_fire[] PROGMEM = "switch1_fire";
+static const char type_switch1_alarmlight[] PROGMEM = "switch1_alarmlight";
+
+static const char prefix_door[] PROGMEM = "door";
+static const char prefix_garagedoor[] PROGMEM = "garagedoor";
+static const char prefix_window[] PROGMEM = "window";
+static const char prefix_motion[] PROGMEM = "motion";
+static const char prefix_laser[] PROGMEM = "laser";
+static const char prefix_switch[] PROGMEM = "switch";
+
+// https://www.home-assistant.io/integrations/sensor.mqtt/#name
+static const char plain_sensor[] PROGMEM = "%s Sensor Pin1:%02d Pin2:%02d";
+static const char plain_door[] PROGMEM = "%s Door NOPin:%02d NCPin:%02d";
+static const char plain_garagedoor[] PROGMEM = "%s GarageDoor NOPin:%02d NCPin:%02d";
+static const char plain_window[] PROGMEM = "%s Window NOPin:%02d NCPin:%02d";
+static const char plain_motion[] PROGMEM = "%s Motion Pin:%02d PwrSns:%02d";
+static const char plain_laser[] PROGMEM = "%s Laser Pin:%02d PwrSns:%02d";
+static const char plain_switch[] PROGMEM = "%s Switch Pin:%02d";
+static const char plain_radiator[] PROGMEM = "%s RadiatorSwitch Pin:%02d";
+static const char plain_fan[] PROGMEM = "%s FanSwitch Pin:%02d";
+static const char plain_fire[] PROGMEM = "%s FireSwitch Pin:%02d";
+static const char plain_alarmlight[] PROGMEM = "%s AlarmSwitch Pin:%02d";
+
+// This is the value which HA displays for this "entity".
+static const char name_unknown[] PROGMEM = "unknown";
+static const char name_open[] PROGMEM = "open";
+static const char name_closed[] PROGMEM = "closed";
+static const char name_off[] PROGMEM = "OFF";
+static const char name_on[] PROGMEM = "ON";
+static const char name_offline[] PROGMEM = "offline"; // https://www.home-assistant.io/integrations/sensor.mqtt/#payload_not_available
+static const char name_fault[] PROGMEM = "wiringfault";
+static const char name_motion[] PROGMEM = "motion";
+static const char name_quiet[] PROGMEM = "quiet";
+static const char name_motion_nopower[] PROGMEM = "motion-fault";
+
+// https://pictogrammers.com/library/mdi/
+static const char icon_unknown[] PROGMEM = "mdi:help-circle";
+static const char icon_alert[] PROGMEM = "mdi:alert-circle-outline";
+static const char icon_nopower[] PROGMEM = "mdi:power-plug-off";
+static const char icon_door2_open[] PROGMEM = "mdi:door-open";
+static const char icon_door2_closed[] PROGMEM = "mdi:door-closed";
+static const char icon_garagedoor2_open[] PROGMEM = "mdi:garage-open";
+static const char icon_garagedoor2_closed[] PROGMEM = "mdi:garage";
+static const char icon_window2_open[] PROGMEM = "mdi:window-open";
+static const char icon_window2_closed[] PROGMEM = "mdi:window-closed";
+static const char icon_motion2_motion[] PROGMEM = "mdi:motion-sensor";
+static const char icon_motion2_quiet[] PROGMEM = "mdi:meditation";
+static const char icon_motion2_laser_quiet[] PROGMEM = "mdi:laser-pointer";
+static const char icon_switch1_on[] PROGMEM = "mdi:light-switch";
+static const char icon_switch1_off[] PROGMEM = "mdi:light-switch-off";
+static const char icon_switch1_radiator_on[] PROGMEM = "mdi:radiator";
+static const char icon_switch1_radiator_off[] PROGMEM = "mdi:radiator-off";
+static const char icon_switch1_fan_on[] PROGMEM = "mdi:fan";
+static const char icon_switch1_fan_off[] PROGMEM = "mdi:fan-off";
+static const char icon_switch1_fire_on[] PROGMEM = "mdi:fire";
+static const char icon_switch1_fire_off[] PROGMEM = "mdi:fire-off";
+static const char icon_switch1_alarmlight_on[] PROGMEM = "mdi:alarm-light-outline";
+static const char icon_switch1_alarmlight_off[] PROGMEM = "mdi:alarm-light-off";
+
+
+// Door, garage door and window: "pin1" is "no" aka "normally open", "pin2" is "nc" aka "normally closed".
+#define SENSOR_TRAITS_DOOR(type, prefix, plain, prefixState, iconOpen, iconClosed) \
+  { type, prefix, plain, 2, INPUT, SENSOR_COMPONENT_SENSOR, 0x0E, 0x01, 0x09, heartbeat_contact, \
+    { prefixState##_offline, prefixState##_closed, prefixState##_open, prefixState##_fault }, \
+    { name_offline, name_closed, name_open, name_fault }, \
+    { icon_nopower, iconClosed, iconOpen, icon_alert } }
+
+// Switch: "pin1" is "switch status", "pin2" is unused.
+#define SENSOR_TRAITS_SWITCH(type, plain, iconOn, iconOff) \
+  { type, prefix_switch, plain, 1, OUTPUT, SENSOR_COMPONENT_SWITCH, 0x0F, 0x00, 0x00, heartbeat_switch, \
+    { switch1_off, switch1_off, switch1_on, switch1_on }, \
+    { name_off, name_off, name_on, name_on }, \
+    { iconOff, iconOff, iconOn, iconOn } }
+
+static constexpr sensorTraits_t sensorTraits[] PROGMEM = {
+  // reserved
+  { type_reserved, NULL, plain_sensor, 0, INPUT, SENSOR_COMPONENT_NONE, 0x00, 0x00, 0x00, heartbeat_none,
+    { unknown, unknown, unknown, unknown },
+    { name_unknown, name_unknown, name_unknown, name_unknown },
+    { icon_unknown, icon_unknown, icon_unknown, icon_unknown } },
+
+  SENSOR_TRAITS_DOOR(type_door2, prefix_door, plain_door, door2, icon_door2_open, icon_door2_closed),
+  SENSOR_TRAITS_DOOR(type_garagedoor2, prefix_garagedoor, plain_garagedoor, garagedoor2, icon_garagedoor2_open, icon_garagedoor2_closed),
+  SENSOR_TRAITS_DOOR(type_window2, prefix_window, plain_window, window2, icon_window2_open, icon_window2_closed),
+
+  // Motion2: "pin1" is "data", pin2 is "power sense".
+  { type_motion2, prefix_motion, plain_motion, 2, INPUT, SENSOR_COMPONENT_SENSOR, 0x0E, 0x01, 0x05, heartbeat_motion,
+    { motion2_offline, motion2_quiet, motion2_fault, motion2_motion },
+    { name_offline, name_quiet, name_motion_nopower, name_motion },
+    { icon_nopower, icon_motion2_quiet, icon_alert, icon_motion2_motion } },
+
+  // Lasers share motion2's states, but have never had names of their own; HA has always shown "unknown".
+  { type_motion2_laser, prefix_laser, plain_laser, 2, INPUT, SENSOR_COMPONENT_SENSOR, 0x0E, 0x01, 0x05, heartbeat_motion,
+    { motion2_offline, motion2_quiet, motion2_fault, motion2_motion },
+    { name_unknown, name_unknown, name_unknown, name_unknown },
+    { icon_nopower, icon_motion2_laser_quiet, icon_alert, icon_motion2_motion } },
+
+  SENSOR_TRAITS_SWITCH(type_switch1, plain_switch, icon_switch1_on, icon_switch1_off),
+  SENSOR_TRAITS_SWITCH(type_switch1_radiator, plain_radiator, icon_switch1_radiator_on, icon_switch1_radiator_off),
+  SENSOR_TRAITS_SWITCH(type_switch1_fan, plain_fan, icon_switch1_fan_on, icon_switch1_fan_off),
+  SENSOR_TRAITS_SWITCH(type_switch1_fire, plain_fire, icon_switch1_fire_on, icon_switch1_fire_off),
+  SENSOR_TRAITS_SWITCH(type_switch1_alarmlight, plain_alarmlight, icon_switch1_alarmlight_on, icon_switch1_alarmlight_off),
+};
+static_assert(sizeof(sensorTraits) / sizeof(sensorTraits[0]) == sensorTypeCount, "sensorTraits[] needs one row per sensorType");
+
+
+/**
+ * This type's row. Anything out of range gets the "reserved" row.
+ */
+static inline const sensorTraits_t *sensorTraitsOf(sensorType type)
+{
+  if(((unsigned int) type) >= sensorTypeCount) return &sensorTraits[reserved];
+  return &sensorTraits[type];
+}
+
+
+/**
+ * The index into this sensor's states, names and icons for "pinReadings": (pin1 << 1) | pin2.
+ */
+uint8_t sensorReadingIndex(baseSensor_t sensor, const pinBitset_t *pinReadings)
+{
+  uint8_t pinCount = sensorPinCount(sensor.type);
+  uint8_t index = 0;
+  if(pinCount >= 1) index |= getBit(pinReadings, sensor.pin1) << 1;
+  if(pinCount >= 2) index |= getBit(pinReadings, sensor.pin2);
+  return index;
+}
+
+
+/**
+ * Pins read to decode this type's state: 2, 1 (pin1 only) or 0 (unused/reserved).
+ */
+uint8_t sensorPinCount(sensorType type)
+{
+  return pgm_read_byte(&sensorTraitsOf(type)->pinCount);
+}
+
+
+/**
+ * INPUT or OUTPUT.
+ */
+uint8_t sensorPinDirection(sensorType type)
+{
+  return pgm_read_byte(&sensorTraitsOf(type)->direction);
+}
+
+
+bool sensorIsSwitch(sensorType type)
+{
+  return pgm_read_byte(&sensorTraitsOf(type)->component) == SENSOR_COMPONENT_SWITCH;
+}
+
+
+/**
+ * The HA component this type is discovered as, "sensor" or "switch". NULL for unused/reserved.
+ * https://www.home-assistant.io/integrations/mqtt/#mqtt-discovery
+ */
+PGM_P sensorComponent(sensorType type)
+{
+  static const char component_sensor[] PROGMEM = "sensor";
+  static const char component_switch[] PROGMEM = "switch";
+  switch(pgm_read_byte(&sensorTraitsOf(type)->component)) {
+    case SENSOR_COMPONENT_SENSOR: return component_sensor;
+    case SENSOR_COMPONENT_SWITCH: return component_switch;
+    default: return NULL;
+  }
+}
+
+
+/**
+ * The CONFIG.INI spelling of "type", e.g. "door2".
+ */
+PGM_P sensorTypeName(sensorType type)
+{
+  return (PGM_P) pgm_read_ptr(&sensorTraitsOf(type)->typeName);
+}
+
+
+/**
+ * CONFIG.INI's spelling back to a sensorType. Anything we don't know is "unused".
+ */
+sensorType sensorTypeFromName(const char *name, size_t maxlen)
+{
+  if(! name) return unused;
+  for(uint8_t type = 1; type < sensorTypeCount; type++) {
+    if(strncmp_P(name, sensorTypeName((sensorType) type), maxlen) == 0) return (sensorType) type;
+  }
+  return unused;
+}
+
+
+/**
+ * Start of this type's sensor names, e.g. "door". NULL for unused/reserved.
+ */
+PGM_P sensorNamePrefix(sensorType type)
+{
+  return (PGM_P) pgm_read_ptr(&sensorTraitsOf(type)->namePrefix);
+}
+
+
+/**
+ * printf format for this type's HA "name". Takes the device name, pin1 and pin2.
+ */
+PGM_P sensorDiscoveryNameFormat(sensorType type)
+{
+  return (PGM_P) pgm_read_ptr(&sensorTraitsOf(type)->discoveryNameFormat);
+}
+
+
+/**
+ * Which heartbeat this type's sensors are swept by. See sendHeartbeatsMQTT().
+ */
+heartbeatClass sensorHeartbeatClass(sensorType type)
+{
+  return (heartbeatClass) pgm_read_byte(&sensorTraitsOf(type)->heartbeat);
+}
+
+
+/**
+ * Milliseconds between sweeps of "heartbeat". 0 = never.
+ */
+unsigned long heartbeatPeriod(heartbeatClass heartbeat)
+{
+  static const unsigned long periods[] PROGMEM = { 0, HEARTBEAT_CONTACT, HEARTBEAT_MOTION, HEARTBEAT_SWITCH };
+  static_assert(sizeof(periods) / sizeof(periods[0]) == heartbeatClassCount, "periods[] needs one entry per heartbeatClass");
+  if(((unsigned int) heartbeat) >= heartbeatClassCount) return 0;
+  return pgm_read_dword(&periods[heartbeat]);
+}
+
+
+/**
+ * Given a sensor, and a set of all readings, return the enumerated "state" of the sensor.
+ */
+sensorStates getSensorStateEnum(baseSensor_t sensor, const pinBitset_t *pinReadings)
+{
+  CYCLE_MARK(CYCLE_SENSOR_STATE);
+  uint8_t index = sensorReadingIndex(sensor, pinReadings);
+  return (sensorStates) pgm_read_byte(&sensorTraitsOf(sensor.type)->states[index]);
+}
+
+
+/**
+ * False if this sensor's state isn't worth sending to HA: unknown, or no power ("offline").
+ */
+bool sensorStateReportable(baseSensor_t sensor, const pinBitset_t *pinReadings)
+{
+  uint8_t index = sensorReadingIndex(sensor, pinReadings);
+  return pgm_read_byte(&sensorTraitsOf(sensor.type)->reportMask) & (1 << index);
+}
+
+
+/**
+ * True if this sensor has lost power (e.g. its supply was cut): "offline". Not reportable, so never discovered,
+ * but its state is still published, so HA shows it.
+ */
+bool sensorStateOffline(baseSensor_t sensor, const pinBitset_t *pinReadings)
+{
+  uint8_t index = sensorReadingIndex(sensor, pinReadings);
+  return pgm_read_byte(&sensorTraitsOf(sensor.type)->offlineMask) & (1 << index);
+}
+
+
+/**
+ * True if this sensor's state is one (fault, offline) which the debouncer should see hold for a while before it's reported.
+ */
+bool sensorStateNeedsConfirming(baseSensor_t sensor, const pinBitset_t *pinReadings)
+{
+  uint8_t index = sensorReadingIndex(sensor, pinReadings);
+  return pgm_read_byte(&sensorTraitsOf(sensor.type)->confirmMask) & (1 << index);
+}
+
+
+/**
+ * This is the value which HA displays for this "entity". This value is returned based on status computed in pinReadings for this sensor.
+ */
+PGM_P getSensorStateName(baseSensor_t sensor, const pinBitset_t *pinReadings)
+{
+  uint8_t index = sensorReadingIndex(sensor, pinReadings);
+  return (PGM_P) pgm_read_ptr(&sensorTraitsOf(sensor.type)->stateNames[index]);
+}
+
+
+/**
+ * As getSensorStateName(), for a reading index (sensorReadingIndex()) saved earlier, e.g. in the journal.
+ */
+PGM_P sensorStateNameAt(sensorType type, uint8_t readingIndex)
+{
+  return (PGM_P) pgm_read_ptr(&sensorTraitsOf(type)->stateNames[readingIndex & 0x03]);
+}
+
+
+/**
+ * Returns the MDI icon to use for this sensor which has it's current state.
+ * This function, when "Send Discovery" is called with every state change,  allows HA to
+ * display a dynamically different icon for this sensor based on the current state of the sensor.
+ * With DISCOVERY_ONCE, it is sent as the "icon" attribute of each JSON state instead.
+ * https://pictogrammers.com/library/mdi/
+ */
+PGM_P getSensorStateIcon(baseSensor_t sensor, const pinBitset_t *pinReadings)
+{
+  uint8_t index = sensorReadingIndex(sensor, pinReadings);
+  return (PGM_P) pgm_read_ptr(&sensorTraitsOf(sensor.type)->icons[index]);
+}
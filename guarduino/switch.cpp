@@ -4,43 +4,44 @@
 
 
 
+/**
+ * Subscribe to our switches' command topic. Call on each new MQTT session.
+ * All of our switches share the one topic; see switchValueON().
+ */
+void setupSwitchSensors(void) {
+  for(int i = 0; i < allSensorCount(); i++) {
+    if(! sensorIsSwitch(allSensors[i].type)) continue;
+    LOG(LOG_DEBUG).print(F("SUBSCRIBE "));
+    LOG(LOG_DEBUG).println(getDeviceCommandTopic());
+    pubsubClient.subscribe(getDeviceCommandTopic());
+    return;
+  }
+}
+
+
 void handleCallbackSwitches(const char *callbackValue) {
-  Serial.print("handleCallbackSwitches(): ");
-  Serial.println(callbackValue);  
-  baseSensor_t *thisSensor = NULL;
+  LOG(LOG_DEBUG).print(F("handleCallbackSwitches(): "));
+  LOG(LOG_DEBUG).println(callbackValue);
 
   for(int i = 0; i < allSensorCount(); i++) {
 
     // Is this a sensor worth considering?
-    thisSensor = &allSensors[i];
-    switch(thisSensor->type) {
-      case switch1:
-      case switch1_radiator:
-      case switch1_fan:
-      case switch1_fire:
-      case switch1_alarmlight:
-        break; // Consider this sensor below.
-      default:
-        thisSensor = NULL; // No need to consider this sensor.
-        break;
-    }
-    if(! thisSensor) continue; // Look at the next sensor.
+    baseSensor_t *thisSensor = &allSensors[i];
+    if(! sensorIsSwitch(thisSensor->type)) continue; // Look at the next sensor.
 
 
     if(strncmp(callbackValue, switchValueON(*thisSensor), strlen(callbackValue)) == 0) {
       pinMode(thisSensor->pin1, OUTPUT);
       digitalWrite(thisSensor->pin1, HIGH);
-      Serial.print("SWITCH ON: ");
-      Serial.print(switchValueON(*thisSensor));
-      Serial.println("");
+      LOG(LOG_INFO).print(F("SWITCH ON: "));
+      LOG(LOG_INFO).println(switchValueON(*thisSensor));
     }
 
     if(strncmp(callbackValue, switchValueOFF(*thisSensor), strlen(callbackValue)) == 0) {
       pinMode(thisSensor->pin1, OUTPUT);
       digitalWrite(thisSensor->pin1, LOW);
-      Serial.print("SWITCH OFF: ");
-      Serial.print(switchValueOFF(*thisSensor));
-      Serial.println("");
+      LOG(LOG_INFO).print(F("SWITCH OFF: "));
+      LOG(LOG_INFO).println(switchValueOFF(*thisSensor));
     }
 
   }  
@@ -58,13 +59,13 @@ void handleCallbackSwitches(const char *callbackValue) {
 const char *switchValueON(baseSensor_t thisSensor) {
   static char fullValue[16];
   memset(fullValue, '\0', sizeof(fullValue));
-  sprintf(fullValue, "switch_%02d-ON", thisSensor.pin1);
+  sprintf_P(fullValue, PSTR("switch_%02d-ON"), thisSensor.pin1);
   return fullValue;  
 }
 const char *switchValueOFF(baseSensor_t thisSensor) {
   static char fullValue[16];
   memset(fullValue, '\0', sizeof(fullValue));
-  sprintf(fullValue, "switch_%02d-OFF", thisSensor.pin1);
+  sprintf_P(fullValue, PSTR("switch_%02d-OFF"), thisSensor.pin1);
   return fullValue;  
 }
 
@@ -79,7 +80,7 @@ const char *switchValueOFF(baseSensor_t thisSensor) {
  * https://www.home-assistant.io/integrations/switch.mqtt#payload_on
  * https://www.home-assistant.io/integrations/switch.mqtt#payload_off
  */
-const char *readSwitchSensor(uint64_t pinReadings, baseSensor_t thisSensor)  {
+const char *readSwitchSensor(const pinBitset_t *pinReadings, baseSensor_t thisSensor)  {
   bool data = getBit(pinReadings, thisSensor.pin1);
 
   if(data == HIGH) { return switchValueON(thisSensor); }
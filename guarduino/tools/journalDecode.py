@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""
+Print a Guarduino SD card journal (JOURNAL.BIN, see journal.cpp) as text.
+
+    python3 tools/journalDecode.py JOURNAL.BIN [--config CONFIG.INI] [--offline]
+
+Each record is a journalRecord_t (guarduino.h): uint32 millis, uint8 boot, uint8 sensor, uint8 state,
+uint8 flags, little endian. State names come from enum sensorStates in guarduino.h. With --config, sensor
+numbers are shown as the sensor they were when the journal was written (if CONFIG.INI hasn't changed since).
+"""
+import argparse
+import configparser
+import os
+import re
+import struct
+import sys
+
+RECORD = struct.Struct("<IBBBB")
+SENSOR_BOOT = 0xFF
+SENSOR_REPLAYED = 0xFE
+READING_MASK = 0x03
+OFFLINE = 0x80
+
+# isPinReserved() in SDConfig.cpp. readSDConfig() skips sensors on these, so they don't take an allSensors[] slot.
+RESERVED_PINS = {0, 1, 4, 8, 10, 50, 51, 52, 53}
+MAX_SENSORS = 64
+
+
+def sensorStateNames(header):
+    """enum sensorStates, in order, from guarduino.h."""
+    with open(header) as f:
+        text = f.read()
+    body = re.search(r"enum\s+sensorStates\s*\{(.*?)\}", text, re.S).group(1)
+    body = re.sub(r"//[^\n]*", "", body)
+    names = []
+    for entry in body.split(","):
+        entry = entry.strip()
+        if not entry:
+            continue
+        name, _, value = entry.partition("=")
+        if value.strip():
+            while len(names) < int(value.strip(), 0):
+                names.append(None)
+        names.append(name.strip())
+    return names
+
+
+def sensorNames(config):
+    """allSensors[] as readSDConfig() fills it: each [sensorN] with a type, in order, minus those on reserved pins."""
+    ini = configparser.ConfigParser(inline_comment_prefixes=(";", "#"))
+    ini.read(config)
+    sensors = []
+    for i in range(MAX_SENSORS):
+        section = "sensor%d" % i
+        if not ini.has_option(section, "type"):
+            continue
+        pin1 = ini.getint(section, "pin1", fallback=-1)
+        pin2 = ini.getint(section, "pin2", fallback=-1)
+        if pin1 in RESERVED_PINS or pin2 in RESERVED_PINS:
+            continue
+        name = "%s pin1=%d" % (ini.get(section, "type"), pin1)
+        if pin2 >= 0:
+            name += " pin2=%d" % pin2
+        sensors.append(name)
+    return sensors
+
+
+def clock(ms):
+    seconds, ms = divmod(ms, 1000)
+    minutes, seconds = divmod(seconds, 60)
+    hours, minutes = divmod(minutes, 60)
+    return "%d:%02d:%02d.%03d" % (hours, minutes, seconds, ms)
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("journal", help="JOURNAL.BIN, copied off the SD card")
+    parser.add_argument("--config", help="CONFIG.INI the journal was written with, to name sensors")
+    parser.add_argument("--header", default=os.path.join(here, "..", "guarduino.h"), help="guarduino.h, for state names")
+    parser.add_argument("--offline", action="store_true", help="only transitions which happened while MQTT was down")
+    args = parser.parse_args()
+
+    states = sensorStateNames(args.header)
+    sensors = sensorNames(args.config) if args.config else []
+
+    with open(args.journal, "rb") as f:
+        data = f.read()
+    if len(data) % RECORD.size:
+        print("warning: %d trailing bytes ignored" % (len(data) % RECORD.size), file=sys.stderr)
+
+    for number in range(len(data) // RECORD.size):
+        at, boot, sensor, state, flags = RECORD.unpack_from(data, number * RECORD.size)
+        if sensor == SENSOR_BOOT:
+            if not args.offline:
+                print("%8d  boot %3d  %s  -- started --" % (number, boot, clock(at)))
+            continue
+        if sensor == SENSOR_REPLAYED:
+            if not args.offline:
+                print("%8d  boot %3d  %s  -- replayed to here --" % (number, boot, clock(at)))
+            continue
+        if args.offline and not (flags & OFFLINE):
+            continue
+
+        stateName = states[state] if state < len(states) and states[state] else "state%d" % state
+        sensorName = sensors[sensor] if sensor < len(sensors) else "sensor %d" % sensor
+        print("%8d  boot %3d  %s  %-28s %-20s reading %d%s" % (
+            number, boot, clock(at), sensorName, stateName, flags & READING_MASK, "  offline" if flags & OFFLINE else ""))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,568 @@
+/**
+ * Cycle counts for the firmware's hot paths, on the real instruction set: runs the AVR image under simavr
+ * (make simavr-bench), e.g.
+ *
+ *     cycles -s 30 -t 22:10000 build/simavr/guarduino.ino.elf build/simavr/sd.img
+ *
+ * The image is built with CYCLE_MARKS, so each CYCLE_MARK() (guarduino.h) writes its id to GPIOR0 on the way in
+ * and GPIOR1 on the way out; we note the cycle counter at each. Counts include whatever interrupts ran meanwhile.
+ *
+ * Around the ATmega2560 it models just enough of an Ethernet shield:
+ *   - a W5100 on SPI (CS pin 10), whose sockets answer DHCP with a lease and act as the MQTT broker, acking
+ *     CONNECT, SUBSCRIBE and PINGREQ, and counting each PUBLISH.
+ *   - an SD card on SPI (CS pin 4), in SPI mode, reading and writing 512 byte blocks of a FAT image (only in
+ *     memory: the file isn't changed). The Makefile builds one holding CONFIG.INI.
+ * There's no 1-Wire device, so no DS18x probes.
+ *
+ *   -s seconds  how long to run (30)
+ *   -t pin:ms   flip input pin at ms (inputs start LOW)
+ *   -H pin      drive input pin HIGH
+ *   -v          echo Serial to stderr
+ *
+ * Prints JSON: per mark, its count and min/mean/max cycles; MQTT messages and bytes (topic + payload); Serial bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_spi.h>
+#include <simavr/avr_uart.h>
+
+#define CYCLES_FREQUENCY 16000000UL
+#define CYCLES_GPIOR0 0x3E // Data space addresses.
+#define CYCLES_GPIOR1 0x4A
+#define CYCLES_DEPTH 8     // Marks open at once.
+#define CYCLES_STIMULI 32
+
+// As guarduino.h's CYCLE_* ids.
+static const char *const markNames[] = { NULL, "loop", "readSensors", "getSensorStateEnum", "mqttSensorDiscovery" };
+#define CYCLES_MARKS (sizeof(markNames) / sizeof(markNames[0]))
+
+typedef struct mark_t {
+    unsigned long count;
+    avr_cycle_count_t total;
+    avr_cycle_count_t min;
+    avr_cycle_count_t max;
+} mark_t;
+
+static avr_t *avr;
+static mark_t marks[CYCLES_MARKS];
+static struct { uint8_t id; avr_cycle_count_t at; } openMarks[CYCLES_DEPTH];
+static int openCount = 0;
+static unsigned long serialBytes = 0;
+static int serialEcho = 0;
+
+
+// ---------------------------------------------------------------------------------------------
+// Pins, as variants/mega/pins_arduino.h.
+// ---------------------------------------------------------------------------------------------
+static const char pinPort[] =
+    "EEEEGEHHHH" "BBBBJJHHDD" "DDAAAAAAAA" "CCCCCCCCDG" "GGLLLLLLLL" "BBBBFFFFFF" "FFKKKKKKKK";
+static const uint8_t pinBit[] = {
+    0, 1, 4, 5, 5, 3, 3, 4, 5, 6, // 0-9
+    4, 5, 6, 7, 1, 0, 1, 0, 3, 2, // 10-19
+    1, 0, 0, 1, 2, 3, 4, 5, 6, 7, // 20-29
+    7, 6, 5, 4, 3, 2, 1, 0, 7, 2, // 30-39
+    1, 0, 7, 6, 5, 4, 3, 2, 1, 0, // 40-49
+    3, 2, 1, 0, 0, 1, 2, 3, 4, 5, // 50-59
+    6, 7, 0, 1, 2, 3, 4, 5, 6, 7, // 60-69
+};
+#define CYCLES_PINS (sizeof(pinBit) / sizeof(pinBit[0]))
+
+static avr_irq_t *pinIrq(int pin)
+{
+    return avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(pinPort[pin]), pinBit[pin]);
+}
+
+static struct { int pin; avr_cycle_count_t at; } stimuli[CYCLES_STIMULI];
+static int stimulusCount = 0;
+static uint8_t pinLevel[CYCLES_PINS];
+
+
+// ---------------------------------------------------------------------------------------------
+// Marks: GPIOR0 = id on entry, GPIOR1 = id on exit.
+// ---------------------------------------------------------------------------------------------
+static void markEnter(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    avr->data[addr] = v;
+    if (openCount < CYCLES_DEPTH) {
+        openMarks[openCount].id = v;
+        openMarks[openCount].at = avr->cycle;
+    }
+    openCount++;
+}
+
+static void markExit(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+    avr->data[addr] = v;
+    if (openCount == 0) return;
+    openCount--;
+    if ((openCount >= CYCLES_DEPTH) || (openMarks[openCount].id != v) || (v >= CYCLES_MARKS)) return;
+
+    avr_cycle_count_t cycles = avr->cycle - openMarks[openCount].at;
+    mark_t *m = &marks[v];
+    if ((m->count == 0) || (cycles < m->min)) m->min = cycles;
+    if (cycles > m->max) m->max = cycles;
+    m->total += cycles;
+    m->count++;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// Serial (UART0).
+// ---------------------------------------------------------------------------------------------
+static void serialOutput(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    serialBytes++;
+    if (serialEcho) fputc(value, stderr);
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// W5100: 4 byte SPI frames, 0xF0 addrH addrL data to write, 0x0F addrH addrL x to read.
+// ---------------------------------------------------------------------------------------------
+#define W5100_SOCKETS 4
+#define W5100_SOCKET_SIZE 2048
+#define W5100_TX_BASE 0x4000
+#define W5100_RX_BASE 0x6000
+#define Sn(n, reg) (0x0400 + ((n) * 0x100) + (reg))
+#define Sn_MR 0x00
+#define Sn_CR 0x01
+#define Sn_IR 0x02
+#define Sn_SR 0x03
+#define Sn_DPORT 0x10
+#define Sn_TX_FSR 0x20
+#define Sn_TX_RD 0x22
+#define Sn_TX_WR 0x24
+#define Sn_RX_RSR 0x26
+#define Sn_RX_RD 0x28
+
+static uint8_t w5100[0x8000];
+static uint8_t w5100Frame[4];
+static int w5100FrameLength = 0;
+static uint16_t w5100RxIn[W5100_SOCKETS];   // Where the next received byte goes, as Sn_RX_RD counts.
+static uint8_t mqttStream[W5100_SOCKETS][8192]; // Sent on a TCP socket, not yet a whole MQTT packet.
+static size_t mqttStreamLength[W5100_SOCKETS];
+static unsigned long mqttMessages = 0;
+static unsigned long mqttBytes = 0;
+
+static uint16_t w5100Get16(uint16_t addr) { return (w5100[addr] << 8) | w5100[addr + 1]; }
+static void w5100Set16(uint16_t addr, uint16_t v) { w5100[addr] = v >> 8; w5100[addr + 1] = v & 0xFF; }
+
+static void w5100Receive(int n, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        w5100[W5100_RX_BASE + (n * W5100_SOCKET_SIZE) + (w5100RxIn[n] & (W5100_SOCKET_SIZE - 1))] = data[i];
+        w5100RxIn[n]++;
+    }
+    w5100Set16(Sn(n, Sn_RX_RSR), w5100RxIn[n] - w5100Get16(Sn(n, Sn_RX_RD)));
+}
+
+// A DHCP OFFER for a DISCOVER, an ACK for a REQUEST: 192.168.15.50/24, from 192.168.15.1.
+static void dhcpReply(int n, const uint8_t *request, size_t length)
+{
+    if ((length < 244) || (request[0] != 1)) return;
+    uint8_t type = 0;
+    for (size_t i = 240; ((i + 2) < length) && (request[i] != 255); ) {
+        if (request[i] == 0) {
+            i++;
+            continue;
+        }
+        if (request[i] == 53) type = request[i + 2];
+        i += 2 + request[i + 1];
+    }
+    if ((type != 1) && (type != 3)) return;
+
+    uint8_t reply[8 + 300];
+    memset(reply, 0, sizeof(reply));
+    uint8_t *udp = reply, *bootp = reply + 8;
+    static const uint8_t server[4] = { 192, 168, 15, 1 };
+    memcpy(udp, server, 4);
+    udp[5] = 67;
+    udp[6] = (sizeof(reply) - 8) >> 8;
+    udp[7] = (sizeof(reply) - 8) & 0xFF;
+    bootp[0] = 2;
+    bootp[1] = 1;
+    bootp[2] = 6;
+    memcpy(bootp + 4, request + 4, 4);   // xid
+    memcpy(bootp + 28, request + 28, 16); // chaddr
+    bootp[16] = 192; bootp[17] = 168; bootp[18] = 15; bootp[19] = 50; // yiaddr
+    memcpy(bootp + 20, server, 4);
+    static const uint8_t options[] = {
+        99, 130, 83, 99,               // magic cookie
+        53, 1, 0,                       // message type, filled in below
+        54, 4, 192, 168, 15, 1,         // server
+        51, 4, 0, 1, 81, 128,           // lease: a day
+        1, 4, 255, 255, 255, 0,         // subnet
+        3, 4, 192, 168, 15, 1,          // router
+        6, 4, 192, 168, 15, 1,          // DNS
+        255,
+    };
+    memcpy(bootp + 236, options, sizeof(options));
+    bootp[236 + 6] = (type == 1) ? 2 : 5;
+    w5100Receive(n, reply, sizeof(reply));
+}
+
+// Whole MQTT packets the firmware has sent: count publishes, answer the rest like a broker.
+static void mqttSent(int n, const uint8_t *data, size_t length)
+{
+    if ((mqttStreamLength[n] + length) > sizeof(mqttStream[n])) mqttStreamLength[n] = 0; // Lost sync; start again.
+    memcpy(mqttStream[n] + mqttStreamLength[n], data, length);
+    mqttStreamLength[n] += length;
+
+    for (;;) {
+        const uint8_t *p = mqttStream[n];
+        size_t have = mqttStreamLength[n], header = 1, remaining = 0;
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (header >= have) return;
+            b = p[header++];
+            remaining |= (size_t) (b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        if ((header + remaining) > have) return;
+
+        switch (p[0] & 0xF0) {
+            case 0x10: {
+                static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+                w5100Receive(n, connack, sizeof(connack));
+                break;
+            }
+            case 0x30: { // Topic length, topic, [packet id,] payload.
+                size_t packetId = ((p[0] & 0x06) != 0) ? 2 : 0;
+                mqttMessages++;
+                mqttBytes += remaining - 2 - packetId;
+                break;
+            }
+            case 0x80: {
+                const uint8_t suback[] = { 0x90, 0x03, p[header], p[header + 1], 0x00 };
+                w5100Receive(n, suback, sizeof(suback));
+                break;
+            }
+            case 0xC0: {
+                static const uint8_t pingresp[] = { 0xD0, 0x00 };
+                w5100Receive(n, pingresp, sizeof(pingresp));
+                break;
+            }
+        }
+        memmove(mqttStream[n], p + header + remaining, have - header - remaining);
+        mqttStreamLength[n] = have - header - remaining;
+    }
+}
+
+static void w5100Command(int n, uint8_t command)
+{
+    uint8_t *sr = &w5100[Sn(n, Sn_SR)];
+    switch (command) {
+        case 0x01: // OPEN
+            *sr = ((w5100[Sn(n, Sn_MR)] & 0x0F) == 0x02) ? 0x22 : 0x13; // SOCK_UDP : SOCK_INIT
+            w5100RxIn[n] = w5100Get16(Sn(n, Sn_RX_RD));
+            mqttStreamLength[n] = 0;
+            break;
+        case 0x04: // CONNECT
+            *sr = 0x17; // SOCK_ESTABLISHED
+            w5100[Sn(n, Sn_IR)] |= 0x01;
+            break;
+        case 0x08: // DISCON
+        case 0x10: // CLOSE
+            *sr = 0x00;
+            break;
+        case 0x20: { // SEND
+            uint16_t rd = w5100Get16(Sn(n, Sn_TX_RD)), wr = w5100Get16(Sn(n, Sn_TX_WR));
+            uint8_t data[W5100_SOCKET_SIZE];
+            size_t length = 0;
+            for (; rd != wr; rd++) data[length++] = w5100[W5100_TX_BASE + (n * W5100_SOCKET_SIZE) + (rd & (W5100_SOCKET_SIZE - 1))];
+            w5100Set16(Sn(n, Sn_TX_RD), wr);
+            w5100Set16(Sn(n, Sn_TX_FSR), W5100_SOCKET_SIZE);
+            w5100[Sn(n, Sn_IR)] |= 0x10; // SEND_OK
+            if (*sr == 0x22) {
+                if (w5100Get16(Sn(n, Sn_DPORT)) == 67) dhcpReply(n, data, length);
+            } else {
+                mqttSent(n, data, length);
+            }
+            break;
+        }
+        case 0x40: // RECV
+            w5100Set16(Sn(n, Sn_RX_RSR), w5100RxIn[n] - w5100Get16(Sn(n, Sn_RX_RD)));
+            break;
+    }
+}
+
+static uint8_t w5100Byte(uint8_t in)
+{
+    if (w5100FrameLength < 4) w5100Frame[w5100FrameLength] = in;
+    w5100FrameLength++;
+    if ((w5100Frame[0] != 0xF0) && (w5100Frame[0] != 0x0F)) return 0; // The library probing for a W5200/W5500: not us.
+    if (w5100FrameLength < 4) return w5100FrameLength - 1; // The W5100 answers 0, 1, 2.
+
+    uint16_t addr = ((w5100Frame[1] << 8) | w5100Frame[2]) & 0x7FFF;
+    w5100FrameLength = 0;
+    if (w5100Frame[0] == 0x0F) return w5100[addr];
+
+    if (addr == 0x0000) { // MR: reset clears itself.
+        w5100[addr] = in & 0x7F;
+        return 3;
+    }
+    if ((addr >= 0x0400) && (addr < 0x0800)) {
+        int n = (addr - 0x0400) >> 8;
+        switch (addr & 0xFF) {
+            case Sn_CR:
+                w5100Command(n, in);
+                return 3;
+            case Sn_IR:
+                w5100[addr] &= ~in;
+                return 3;
+            case Sn_TX_WR + 1:
+                w5100[addr] = in;
+                w5100Set16(Sn(n, Sn_TX_FSR), W5100_SOCKET_SIZE - (uint16_t) (w5100Get16(Sn(n, Sn_TX_WR)) - w5100Get16(Sn(n, Sn_TX_RD))));
+                return 3;
+        }
+    }
+    w5100[addr] = in;
+    return 3;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// SD card, SPI mode, SDHC (block addressed). Commands are 6 bytes; replies queue up behind them.
+// ---------------------------------------------------------------------------------------------
+static uint8_t *sdImage;
+static size_t sdBlocks;
+static uint8_t sdCommand[6];
+static int sdCommandLength = 0;
+static uint8_t sdReply[520];
+static size_t sdReplyLength = 0, sdReplyAt = 0;
+static int sdAppCommand = 0;
+static long sdWriteBlock = -1;  // CMD24 waiting for its data.
+static uint8_t sdWriteData[514];
+static int sdWriteLength = -1;  // -1 = waiting for the 0xFE token.
+
+static void sdQueue(const uint8_t *bytes, size_t length)
+{
+    sdReplyLength = sdReplyAt = 0;
+    sdReply[sdReplyLength++] = 0xFF;
+    memcpy(sdReply + sdReplyLength, bytes, length);
+    sdReplyLength += length;
+}
+
+static void sdRun(void)
+{
+    uint8_t cmd = sdCommand[0] & 0x3F;
+    uint32_t arg = (sdCommand[1] << 24) | (sdCommand[2] << 16) | (sdCommand[3] << 8) | sdCommand[4];
+    int app = sdAppCommand;
+    sdAppCommand = 0;
+
+    switch (cmd) {
+        case 0: { uint8_t r[] = { 0x01 }; sdQueue(r, sizeof(r)); break; }
+        case 8: { uint8_t r[] = { 0x01, 0x00, 0x00, 0x01, 0xAA }; sdQueue(r, sizeof(r)); break; }
+        case 55: { uint8_t r[] = { 0x01 }; sdAppCommand = 1; sdQueue(r, sizeof(r)); break; }
+        case 41: { uint8_t r[] = { app ? 0x00 : 0x05 }; sdQueue(r, sizeof(r)); break; }
+        case 58: { uint8_t r[] = { 0x00, 0xC0, 0xFF, 0x80, 0x00 }; sdQueue(r, sizeof(r)); break; } // Powered up, SDHC.
+        case 9:
+        case 10: {
+            uint8_t r[1 + 1 + 16 + 2] = { 0x00, 0xFE };
+            if (cmd == 9) { // CSD v2: C_SIZE from the image.
+                uint32_t size = (sdBlocks / 1024) - 1;
+                r[2] = 0x40;
+                r[2 + 7] = (size >> 16) & 0x3F;
+                r[2 + 8] = size >> 8;
+                r[2 + 9] = size;
+            }
+            sdQueue(r, sizeof(r));
+            break;
+        }
+        case 17: {
+            if (arg >= sdBlocks) { uint8_t r[] = { 0x04 }; sdQueue(r, sizeof(r)); break; }
+            uint8_t r[1 + 1 + 512 + 2] = { 0x00, 0xFE };
+            memcpy(r + 2, sdImage + ((size_t) arg * 512), 512);
+            sdQueue(r, sizeof(r));
+            break;
+        }
+        case 24: {
+            uint8_t r[] = { (arg < sdBlocks) ? 0x00 : 0x04 };
+            if (arg < sdBlocks) {
+                sdWriteBlock = arg;
+                sdWriteLength = -1;
+            }
+            sdQueue(r, sizeof(r));
+            break;
+        }
+        case 13: { uint8_t r[] = { 0x00, 0x00 }; sdQueue(r, sizeof(r)); break; }
+        default: { uint8_t r[] = { 0x00 }; sdQueue(r, sizeof(r)); break; } // CMD16, CMD59, ...
+    }
+}
+
+static uint8_t sdByte(uint8_t in)
+{
+    if (sdWriteBlock >= 0 && sdReplyAt >= sdReplyLength) {
+        if (sdWriteLength < 0) {
+            if (in == 0xFE) sdWriteLength = 0;
+            return 0xFF;
+        }
+        sdWriteData[sdWriteLength++] = in;
+        if (sdWriteLength < (int) sizeof(sdWriteData)) return 0xFF;
+        memcpy(sdImage + ((size_t) sdWriteBlock * 512), sdWriteData, 512);
+        sdWriteBlock = -1;
+        uint8_t r[] = { 0x05, 0x00, 0x00 }; // Accepted, then busy for a moment.
+        sdQueue(r, sizeof(r));
+        sdReplyAt = 1;
+        return 0xFF;
+    }
+
+    if (sdCommandLength > 0 || ((in & 0xC0) == 0x40)) {
+        sdCommand[sdCommandLength++] = in;
+        if (sdCommandLength == 6) {
+            sdCommandLength = 0;
+            sdRun();
+        }
+        return 0xFF;
+    }
+    return (sdReplyAt < sdReplyLength) ? sdReply[sdReplyAt++] : 0xFF;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// SPI: whoever's chip select is low answers.
+// ---------------------------------------------------------------------------------------------
+#define CYCLES_W5100_CS 10
+#define CYCLES_SD_CS 4
+
+static uint8_t w5100Selected = 0, sdSelected = 0;
+static avr_irq_t *spiIn;
+
+static void chipSelect(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    uint8_t *selected = (uint8_t *) param;
+    *selected = !value;
+    if (selected == &w5100Selected) w5100FrameLength = 0;
+    if ((selected == &sdSelected) && value) sdCommandLength = 0;
+}
+
+static void spiOutput(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    uint8_t reply = 0xFF;
+    if (w5100Selected) reply = w5100Byte(value);
+    else if (sdSelected) reply = sdByte(value);
+    avr_raise_irq(spiIn, reply);
+}
+
+
+static int parsePin(const char *s)
+{
+    int pin = atoi(s);
+    return ((pin >= 0) && (pin < (int) CYCLES_PINS)) ? pin : -1;
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned long seconds = 30;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:t:H:v")) != -1) {
+        switch (opt) {
+            case 's':
+                seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 't': {
+                const char *at = strchr(optarg, ':');
+                int pin = parsePin(optarg);
+                if (!at || (pin < 0) || (stimulusCount >= CYCLES_STIMULI)) break;
+                stimuli[stimulusCount].pin = pin;
+                stimuli[stimulusCount].at = strtoul(at + 1, NULL, 10) * (CYCLES_FREQUENCY / 1000);
+                stimulusCount++;
+                break;
+            }
+            case 'H': {
+                int pin = parsePin(optarg);
+                if (pin >= 0) pinLevel[pin] = 1;
+                break;
+            }
+            case 'v':
+                serialEcho = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s seconds] [-t pin:ms]... [-H pin]... [-v] firmware.elf sd.img\n", argv[0]);
+                return 2;
+        }
+    }
+    if ((argc - optind) != 2) {
+        fprintf(stderr, "usage: %s [-s seconds] [-t pin:ms]... [-H pin]... [-v] firmware.elf sd.img\n", argv[0]);
+        return 2;
+    }
+
+    FILE *fp = fopen(argv[optind + 1], "rb");
+    if (!fp) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    sdBlocks = ftell(fp) / 512;
+    rewind(fp);
+    sdImage = malloc(sdBlocks * 512);
+    if (!sdImage || (fread(sdImage, 512, sdBlocks, fp) != sdBlocks)) {
+        fprintf(stderr, "%s: can't read the image\n", argv[optind + 1]);
+        return 1;
+    }
+    fclose(fp);
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[optind], &firmware) != 0) {
+        fprintf(stderr, "%s: can't load\n", argv[optind]);
+        return 1;
+    }
+    avr = avr_make_mcu_by_name("atmega2560");
+    if (!avr) return 1;
+    avr_init(avr);
+    avr->frequency = CYCLES_FREQUENCY;
+    avr_load_firmware(avr, &firmware);
+
+    avr_register_io_write(avr, CYCLES_GPIOR0, markEnter, NULL);
+    avr_register_io_write(avr, CYCLES_GPIOR1, markExit, NULL);
+
+    uint32_t flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), serialOutput, NULL);
+
+    spiIn = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ('0'), SPI_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ('0'), SPI_IRQ_OUTPUT), spiOutput, NULL);
+    avr_irq_register_notify(pinIrq(CYCLES_W5100_CS), chipSelect, &w5100Selected);
+    avr_irq_register_notify(pinIrq(CYCLES_SD_CS), chipSelect, &sdSelected);
+
+    for (int pin = 0; pin < (int) CYCLES_PINS; pin++) {
+        if (pinLevel[pin]) avr_raise_irq(pinIrq(pin), 1);
+    }
+
+    avr_cycle_count_t end = seconds * CYCLES_FREQUENCY;
+    int state = cpu_Running;
+    while ((avr->cycle < end) && (state != cpu_Done) && (state != cpu_Crashed)) {
+        for (int i = 0; i < stimulusCount; i++) {
+            if ((stimuli[i].at == 0) || (avr->cycle < stimuli[i].at)) continue;
+            int pin = stimuli[i].pin;
+            pinLevel[pin] = !pinLevel[pin];
+            avr_raise_irq(pinIrq(pin), pinLevel[pin]);
+            stimuli[i].at = 0;
+        }
+        state = avr_run(avr);
+    }
+    if (state == cpu_Crashed) fprintf(stderr, "crashed at cycle %llu\n", (unsigned long long) avr->cycle);
+
+    printf("{\"seconds\": %lu, \"marks\": [\n", seconds);
+    for (size_t id = 1; id < CYCLES_MARKS; id++) {
+        const mark_t *m = &marks[id];
+        printf("    {\"name\": \"%s\", \"count\": %lu, \"min\": %llu, \"mean\": %llu, \"max\": %llu}%s\n",
+               markNames[id], m->count, (unsigned long long) m->min,
+               (unsigned long long) (m->count ? (m->total / m->count) : 0), (unsigned long long) m->max,
+               (id < (CYCLES_MARKS - 1)) ? "," : "");
+    }
+    printf("], \"mqtt_messages\": %lu, \"mqtt_bytes\": %lu, \"serial_bytes\": %lu}\n", mqttMessages, mqttBytes, serialBytes);
+    return (state == cpu_Crashed) ? 1 : 0;
+}